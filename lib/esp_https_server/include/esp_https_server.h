@@ -206,7 +206,21 @@ typedef struct httpd_ssl_config httpd_ssl_config_t;
         .keep_alive_count = 0,                    \
         .open_fn = NULL,                          \
         .close_fn = NULL,                         \
-        .uri_match_fn = NULL                      \
+        .uri_match_fn = NULL,                     \
+        .worker_threads = 1,                      \
+        .idle_timeout = 0,                        \
+        .header_timeout = 0,                      \
+        .body_timeout = 0,                        \
+        .max_keep_alive_requests = 0,             \
+        .work_queue_len = 0,                      \
+        .tx_queue_limit = ESP_HTTPD_DEF_TX_QUEUE_LIMIT, \
+        .drain_fn = NULL,                         \
+        .mem_budget = 0,                          \
+        .defer_accept_timeout = 0,                \
+        .fastopen_queue_len = 0,                  \
+        .listen_stats = false,                    \
+        .max_uri_len = 0,                         \
+        .max_req_hdr_len = 0                      \
     },                                            \
     .servercert = NULL,                           \
     .servercert_len = 0,                          \
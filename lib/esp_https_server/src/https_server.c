@@ -151,6 +151,41 @@ static int httpd_ssl_send(httpd_handle_t server, int sockfd, const char *buf, si
     return ret;
 }
 
+/* Size of the buffer the pieces of a vectored send are gathered in */
+#define HTTPD_SSL_SENDV_BUF_LEN 512
+
+/**
+ * Vectored send to a SSL socket
+ *
+ * Small leading pieces (status line, headers, short bodies) are copied into
+ * one buffer and written as a single TLS record, instead of one record per
+ * piece. A leading piece which does not fit is written on its own.
+ *
+ * @param server
+ * @param sockfd
+ * @param iov
+ * @param iovcnt
+ * @param flags
+ * @return bytes sent, negative on error
+ */
+static int httpd_ssl_sendv(httpd_handle_t server, int sockfd, const httpd_iovec_t *iov, int iovcnt, int flags)
+{
+    if (iov == NULL || iovcnt <= 0) {
+        return HTTPD_SOCK_ERR_INVALID;
+    }
+    if (iovcnt == 1 || iov[0].len >= HTTPD_SSL_SENDV_BUF_LEN) {
+        return httpd_ssl_send(server, sockfd, iov[0].base, iov[0].len, flags);
+    }
+
+    char buf[HTTPD_SSL_SENDV_BUF_LEN];
+    size_t len = 0;
+    for (int i = 0; i < iovcnt && len + iov[i].len <= sizeof(buf); i++) {
+        memcpy(buf + len, iov[i].base, iov[i].len);
+        len += iov[i].len;
+    }
+    return httpd_ssl_send(server, sockfd, buf, len, flags);
+}
+
 /**
  * Open a SSL socket for the server.
  * The fd is already open and ready to read / write raw data.
@@ -201,6 +236,8 @@ static esp_err_t httpd_ssl_open(httpd_handle_t server, int sockfd)
     httpd_sess_set_send_override(server, sockfd, httpd_ssl_send);
     httpd_sess_set_recv_override(server, sockfd, httpd_ssl_recv);
     httpd_sess_set_pending_override(server, sockfd, httpd_ssl_pending);
+    // Must follow the send override, which drops any vectored send function
+    httpd_sess_set_sendv_override(server, sockfd, httpd_ssl_sendv);
 
     // all access should now go through SSL
     LOGD(TAG, "Secure socket open");
@@ -25,6 +25,14 @@
 #include <string.h>
 #include <limits.h>
 
+#if HTTP_PARSER_SIMD && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HTTP_PARSER_SCAN_SSE42 1
+# include <nmmintrin.h>
+#elif HTTP_PARSER_SIMD && defined(__aarch64__) && defined(__ARM_NEON)
+# define HTTP_PARSER_SCAN_NEON 1
+# include <arm_neon.h>
+#endif
+
 static uint32_t max_header_size = HTTP_MAX_HEADER_SIZE;
 
 #ifndef ULLONG_MAX
@@ -276,6 +284,104 @@ static const uint8_t normal_url_char[32] = {
 
 #undef T
 
+
+/* Bytes that end a run of characters the state machine would only step
+ * over, as pairs of inclusive bounds. A range may cover more than the
+ * bytes that end the run, the byte by byte loops go on from wherever the
+ * scan stops.
+ */
+struct scan_ranges {
+  char ranges[16];
+  int len;
+};
+
+/* CTLs, SP, separators, DEL and non-ASCII */
+static const struct scan_ranges token_stops = {
+  { 0x00, ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', (char) 0xff }, 16 };
+
+/* CTLs other than HT, including CR and LF, and DEL */
+static const struct scan_ranges header_value_stops = {
+  { 0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f }, 6 };
+
+/* CTLs, SP, the query and fragment marks, DEL and in strict mode non-ASCII */
+static const struct scan_ranges url_path_stops = {
+  { 0x00, ' ', '#', '#', '?', '?', 0x7f, HTTP_PARSER_STRICT ? (char) 0xff : 0x7f }, 8 };
+
+/* Returns the first byte of [p, pe) in one of the ranges, or the start of
+ * a tail too short for a full scan */
+typedef const char *(*scan_fn)(const char *p, const char *pe, const struct scan_ranges *stops);
+
+#if HTTP_PARSER_SCAN_SSE42
+static const char *
+scan_none(const char *p, const char *pe, const struct scan_ranges *stops)
+{
+  (void) pe;
+  (void) stops;
+  return p;
+}
+
+__attribute__((target("sse4.2")))
+static const char *
+scan_sse42(const char *p, const char *pe, const struct scan_ranges *stops)
+{
+  __m128i ranges = _mm_loadu_si128((const __m128i *) stops->ranges);
+
+  for (; pe - p >= 16; p += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *) p);
+    int i = _mm_cmpestri(ranges, stops->len, b, 16,
+                         _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+    if (i != 16) {
+      return p + i;
+    }
+  }
+  return p;
+}
+
+static const char *scan_detect(const char *p, const char *pe, const struct scan_ranges *stops);
+
+static scan_fn scan = scan_detect;
+
+/* Picks the scan on first use by the features of the CPU. Parsers racing
+ * here all store the same function */
+static const char *
+scan_detect(const char *p, const char *pe, const struct scan_ranges *stops)
+{
+  __builtin_cpu_init();
+  scan = __builtin_cpu_supports("sse4.2") ? scan_sse42 : scan_none;
+  return scan(p, pe, stops);
+}
+#elif HTTP_PARSER_SCAN_NEON
+static const char *
+scan(const char *p, const char *pe, const struct scan_ranges *stops)
+{
+  for (; pe - p >= 16; p += 16) {
+    uint8x16_t b = vld1q_u8((const uint8_t *) p);
+    uint8x16_t hit = vdupq_n_u8(0);
+    uint8_t lanes[16];
+    int i;
+
+    for (i = 0; i < stops->len; i += 2) {
+      hit = vorrq_u8(hit, vandq_u8(vcgeq_u8(b, vdupq_n_u8((uint8_t) stops->ranges[i])),
+                                   vcleq_u8(b, vdupq_n_u8((uint8_t) stops->ranges[i + 1]))));
+    }
+    if (vmaxvq_u8(hit)) {
+      vst1q_u8(lanes, hit);
+      for (i = 0; !lanes[i]; i++);
+      return p + i;
+    }
+  }
+  return p;
+}
+#else
+static const char *
+scan(const char *p, const char *pe, const struct scan_ranges *stops)
+{
+  (void) pe;
+  (void) stops;
+  return p;
+}
+#endif
+
 enum state
   { s_dead = 1 /* important that this is > 0 */
 
@@ -1088,6 +1194,14 @@ reexecute:
               SET_ERRNO(HPE_INVALID_URL);
               goto error;
             }
+            if (CURRENT_STATE() == s_req_path) {
+              /* Step over the plain path characters that follow, within
+               * what is left of the header size limit */
+              const char* start = p + 1;
+              size_t left = data + len - start;
+              p = scan(start, start + MIN(left, max_header_size - nread), &url_path_stops) - 1;
+              COUNT_HEADER_SIZE(p + 1 - start);
+            }
         }
         break;
       }
@@ -1265,6 +1379,7 @@ reexecute:
             case h_general: {
               size_t left = data + len - p;
               const char* pe = p + MIN(left, max_header_size);
+              p = scan(p + 1, pe, &token_stops) - 1;
               while (p+1 < pe && TOKEN(p[1])) {
                 p++;
               }
@@ -1511,6 +1626,7 @@ reexecute:
                 size_t left = data + len - p;
                 const char* pe = p + MIN(left, max_header_size);
 
+                p = scan(p, pe, &header_value_stops);
                 for (; p != pe; p++) {
                   ch = *p;
                   if (ch == CR || ch == LF) {
@@ -52,6 +52,14 @@ typedef unsigned __int64 uint64_t;
 # define HTTP_PARSER_STRICT 1
 #endif
 
+/* Compile with -DHTTP_PARSER_SIMD=0 to scan header fields, header values
+ * and URL paths one byte at a time only. Otherwise they are scanned 16
+ * bytes at a time with SSE4.2 when the CPU has it, or with NEON on AArch64.
+ */
+#ifndef HTTP_PARSER_SIMD
+# define HTTP_PARSER_SIMD 1
+#endif
+
 /* Maximium header size allowed. If the macro is not defined
  * before including this header then the default is used. To
  * change the maximum header size, define the macro in the build
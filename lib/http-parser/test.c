@@ -3698,6 +3698,93 @@ test_invalid_header_field_token_error (int req)
   test_invalid_header_field(req, "Foo\01\test: Bar");
 }
 
+/* Runs long enough for the vector scans, ended at every offset of the
+ * first vectors and of the tail */
+#define LONG_RUN_LEN 40
+
+static size_t long_run_url_len;
+static size_t long_run_value_len;
+
+static int
+long_run_on_url (http_parser *p, const char *at, size_t length)
+{
+  (void) p;
+  (void) at;
+  long_run_url_len += length;
+  return 0;
+}
+
+static int
+long_run_on_header_value (http_parser *p, const char *at, size_t length)
+{
+  (void) p;
+  (void) at;
+  long_run_value_len += length;
+  return 0;
+}
+
+static http_parser_settings settings_long_run =
+  {.on_url = long_run_on_url
+  ,.on_header_value = long_run_on_header_value
+  };
+
+static void
+test_long_run (const char *fmt, int at, char ch, enum http_errno expected)
+{
+  char run[LONG_RUN_LEN + 1];
+  char buf[256];
+  http_parser parser;
+  size_t buflen;
+
+  memset(run, 'a', LONG_RUN_LEN);
+  run[LONG_RUN_LEN] = '\0';
+  run[at] = ch;
+  buflen = snprintf(buf, sizeof(buf), fmt, run);
+  assert(buflen < sizeof(buf));
+
+  long_run_url_len = 0;
+  long_run_value_len = 0;
+  http_parser_init(&parser, HTTP_REQUEST);
+  http_parser_execute(&parser, &settings_long_run, buf, buflen);
+  if (HTTP_PARSER_ERRNO(&parser) != expected) {
+    fprintf(stderr,
+            "\n*** Long run %s at %d: got %s, expected %s ***\n\n",
+            fmt, at, http_errno_name(HTTP_PARSER_ERRNO(&parser)),
+            http_errno_name(expected));
+    abort();
+  }
+}
+
+void
+test_long_runs (void)
+{
+  int i;
+
+  for (i = 0; i < LONG_RUN_LEN; i++) {
+    /* header values */
+    test_long_run("GET / HTTP/1.1\r\nX-Run: v%s\r\n\r\n", i, '\01', HPE_INVALID_HEADER_TOKEN);
+    test_long_run("GET / HTTP/1.1\r\nX-Run: v%s\r\n\r\n", i, '\x7f', HPE_INVALID_HEADER_TOKEN);
+    test_long_run("GET / HTTP/1.1\r\nX-Run: v%s\r\n\r\n", i, '\t', HPE_OK);
+    test_long_run("GET / HTTP/1.1\r\nX-Run: v%s\r\n\r\n", i, '\x80', HPE_OK);
+    assert(long_run_value_len == LONG_RUN_LEN + 1);
+
+    /* header fields */
+    test_long_run("GET / HTTP/1.1\r\nX%s: run\r\n\r\n", i, '@', HPE_INVALID_HEADER_TOKEN);
+    test_long_run("GET / HTTP/1.1\r\nX%s: run\r\n\r\n", i, '\x80', HPE_INVALID_HEADER_TOKEN);
+    test_long_run("GET / HTTP/1.1\r\nX%s: run\r\n\r\n", i, '-', HPE_OK);
+    test_long_run("GET / HTTP/1.1\r\nX%s: run\r\n\r\n", i, '|', HPE_OK);
+
+    /* URL paths */
+    test_long_run("GET /%s HTTP/1.1\r\n\r\n", i, '\x7f', HPE_INVALID_URL);
+    test_long_run("GET /%s HTTP/1.1\r\n\r\n", i, '?', HPE_OK);
+    assert(long_run_url_len == LONG_RUN_LEN + 1);
+    test_long_run("GET /%s HTTP/1.1\r\n\r\n", i, '#', HPE_OK);
+    assert(long_run_url_len == LONG_RUN_LEN + 1);
+    test_long_run("GET /%s HTTP/1.1\r\n\r\n", i, '~', HPE_OK);
+    assert(long_run_url_len == LONG_RUN_LEN + 1);
+  }
+}
+
 void
 test_double_content_length_error (int req)
 {
@@ -4257,6 +4344,7 @@ xmain (void)
   test_header_cr_no_lf_error(HTTP_RESPONSE);
   test_invalid_header_field_token_error(HTTP_RESPONSE);
   test_invalid_header_field_content_error(HTTP_RESPONSE);
+  test_long_runs();
 
   test_simple_type(
       "POST / HTTP/1.1\r\n"
@@ -36,6 +36,12 @@ extern "C" {
 
 #define ESP_HTTPD_DEF_CTRL_PORT         (32768)    /*!< HTTP Server control socket port*/
 
+#ifdef ESP_PLATFORM
+#define ESP_HTTPD_DEF_TX_QUEUE_LIMIT    (4 * 1024)    /*!< Default output queued per session, in bytes */
+#else
+#define ESP_HTTPD_DEF_TX_QUEUE_LIMIT    (256 * 1024)  /*!< Default output queued per session, in bytes */
+#endif
+
 ESP_EVENT_DECLARE_BASE(ESP_HTTP_SERVER_EVENT);
 
 /**
@@ -91,7 +97,21 @@ initializer that should be kept in sync
         .keep_alive_count = 0,                          \
         .open_fn = NULL,                                \
         .close_fn = NULL,                               \
-        .uri_match_fn = NULL                            \
+        .uri_match_fn = NULL,                           \
+        .worker_threads = 1,                            \
+        .idle_timeout = 0,                              \
+        .header_timeout = 0,                            \
+        .body_timeout = 0,                              \
+        .max_keep_alive_requests = 0,                   \
+        .work_queue_len = 0,                            \
+        .tx_queue_limit = ESP_HTTPD_DEF_TX_QUEUE_LIMIT, \
+        .drain_fn = NULL,                               \
+        .mem_budget = 0,                                \
+        .defer_accept_timeout = 0,                      \
+        .fastopen_queue_len = 0,                        \
+        .listen_stats = false,                          \
+        .max_uri_len = 0,                               \
+        .max_req_hdr_len = 0                            \
 }
 
 #define ESP_ERR_HTTPD_BASE              (0xb000)                    /*!< Starting number of HTTPD error codes */
@@ -103,6 +123,9 @@ initializer that should be kept in sync
 #define ESP_ERR_HTTPD_RESP_SEND         (ESP_ERR_HTTPD_BASE +  6)   /*!< Error occurred while sending response packet */
 #define ESP_ERR_HTTPD_ALLOC_MEM         (ESP_ERR_HTTPD_BASE +  7)   /*!< Failed to dynamically allocate memory for resource */
 #define ESP_ERR_HTTPD_TASK              (ESP_ERR_HTTPD_BASE +  8)   /*!< Failed to launch server task/thread */
+#define ESP_ERR_HTTPD_RANGE             (ESP_ERR_HTTPD_BASE +  9)   /*!< None of the requested byte ranges can be satisfied */
+#define ESP_ERR_HTTPD_QUEUE_FULL        (ESP_ERR_HTTPD_BASE + 10)   /*!< The work queue of the server is full */
+#define ESP_ERR_HTTPD_MEM_BUDGET        (ESP_ERR_HTTPD_BASE + 11)   /*!< The memory budget of the server is used up */
 
 /* Symbol to be used as length parameter in httpd_resp_send APIs
  * for setting buffer length to string length */
@@ -160,6 +183,17 @@ typedef esp_err_t (*httpd_open_func_t)(httpd_handle_t hd, int sockfd);
  */
 typedef void (*httpd_close_func_t)(httpd_handle_t hd, int sockfd);
 
+/**
+ * @brief  Function prototype for the end of queued output on a session.
+ *
+ * Called from the server thread once everything that had to be queued
+ * because the client did not take it right away has been written.
+ *
+ * @param[in] hd   server instance
+ * @param[in] sockfd   session socket file descriptor
+ */
+typedef void (*httpd_drain_func_t)(httpd_handle_t hd, int sockfd);
+
 /**
  * @brief  Function prototype for URI matching.
  *
@@ -194,15 +228,16 @@ typedef struct httpd_config {
     uint16_t    server_port;
 
     /**
-     * UDP Port number for asynchronously exchanging control signals
-     * between various components of the server
+     * UDP Port number of the loopback socket waking up the server when work
+     * is queued. Not used on Linux hosts, which wake it up through an eventfd
      */
     uint16_t    ctrl_port;
 
-    uint16_t    max_open_sockets;   /*!< Max number of sockets/clients connected at any time (3 sockets are reserved for internal working of the HTTP server) */
+    uint16_t    max_open_sockets;   /*!< Max number of sockets/clients connected at any time (3 sockets per worker loop, 2 on Linux hosts, are reserved for internal working of the HTTP server).
+                                         Bounded by LWIP_MAX_SOCKETS, or by the open file limit of the process on hosts. Session slots are allocated as clients connect */
     uint16_t    max_uri_handlers;   /*!< Maximum allowed uri handlers */
     uint16_t    max_resp_headers;   /*!< Maximum allowed additional headers in HTTP response */
-    uint16_t    backlog_conn;       /*!< Number of backlog connections */
+    uint16_t    backlog_conn;       /*!< Number of backlog connections. 0 sizes it from max_open_sockets, up to SOMAXCONN */
     bool        lru_purge_enable;   /*!< Purge "Least Recently Used" connection */
     uint16_t    recv_wait_timeout;  /*!< Timeout for recv function (in seconds)*/
     uint16_t    send_wait_timeout;  /*!< Timeout for send function (in seconds)*/
@@ -292,6 +327,134 @@ typedef struct httpd_config {
      * of the `httpd_uri_match_func_t` function prototype)
      */
     httpd_uri_match_func_t uri_match_fn;
+
+    /**
+     * Number of event loops (threads) serving connections.
+     *
+     * Each loop has its own listening socket bound to server_port with
+     * SO_REUSEPORT, so the kernel spreads new connections between them,
+     * and its own session table, request buffers and control socket
+     * (on port ctrl_port + loop index). max_open_sockets is shared by
+     * the loops: each accepts connections until the server as a whole
+     * is full. URI and error handlers are shared.
+     *
+     * Values above 1 are only honoured on Linux hosts, other builds
+     * always run a single loop.
+     */
+    uint8_t worker_threads;
+
+    /**
+     * Seconds a connection may stay open without a request before it is
+     * closed, 0 to keep idle connections open. Does not apply to
+     * WebSocket connections.
+     */
+    uint16_t idle_timeout;
+
+    /**
+     * Seconds a client gets to send the whole header section of a
+     * request, counted from its first piece. The request is answered with
+     * "408 Request Timeout" and the connection closed when it runs out.
+     * 0 applies idle_timeout from the last piece received instead.
+     */
+    uint16_t header_timeout;
+
+    /**
+     * Seconds a client gets to send the body of a request, counted from
+     * the end of the header section. Once it has run out, httpd_req_recv()
+     * fails with HTTPD_SOCK_ERR_FAIL. 0 for no limit beyond
+     * recv_wait_timeout on each receive.
+     */
+    uint16_t body_timeout;
+
+    /**
+     * Number of requests served on a connection before it is closed, the
+     * last response carries "Connection: close". 0 for no limit.
+     */
+    uint16_t max_keep_alive_requests;
+
+    /**
+     * Maximum number of work items queued with httpd_queue_work() and not
+     * run yet, per event loop. Queueing fails with ESP_ERR_HTTPD_QUEUE_FULL
+     * beyond it. 0 for the default: 32 on ESP targets, 1024 on hosts.
+     */
+    uint16_t work_queue_len;
+
+    /**
+     * Bytes of output queued per session when the client does not take
+     * them right away. Sends from the server thread do not wait for a slow
+     * client: what its socket does not accept is queued and written as the
+     * socket becomes writable, while the other connections are served.
+     * Only a send that would queue more than this waits for the client, as
+     * every send did before. A connection closed after its response stays
+     * open until the queued output is written, or send_wait_timeout runs
+     * out. 0 makes every send wait, as does a build without non-blocking
+     * sends (Windows). Sends from other threads always wait.
+     */
+    uint32_t tx_queue_limit;
+
+    /**
+     * Called once the output queued for a session has been written, see
+     * httpd_sess_get_tx_pending(). NULL if not needed.
+     */
+    httpd_drain_func_t drain_fn;
+
+    /**
+     * Bytes the connections of the server may use together, over all the
+     * worker loops: the session slots, receive buffers, queued output,
+     * partially received requests, async request copies and what the
+     * application accounts with httpd_sess_charge_mem(). Once it is used
+     * up, new connections are closed right away, new requests are answered
+     * with 503 Service Unavailable without their body being kept, and
+     * sessions cannot grow their buffers past CONFIG_HTTPD_RX_BUF_LEN:
+     * a receive buffer that cannot grow closes its connection, output that
+     * cannot be queued is sent waiting for the client. 0 for no budget,
+     * usage is still reported by httpd_get_mem_usage().
+     */
+    uint32_t mem_budget;
+
+    /**
+     * Seconds a new connection is held back by the kernel until its first
+     * data arrives (TCP_DEFER_ACCEPT), so that the server only wakes up
+     * for connections with a request to serve. Connections still silent
+     * after that are passed on. 0 to accept connections as they are
+     * established. Only supported on Linux hosts, ignored elsewhere.
+     */
+    uint16_t defer_accept_timeout;
+
+    /**
+     * Length of the TCP Fast Open queue of the listening socket
+     * (TCP_FASTOPEN): clients with a cookie may send their request with
+     * the SYN, saving a round trip. 0 to disable. Only supported on Linux
+     * hosts where net.ipv4.tcp_fastopen allows it for servers.
+     */
+    uint16_t fastopen_queue_len;
+
+    /**
+     * Probe every accepted connection for whether it made use of
+     * defer_accept_timeout and fastopen_queue_len, for the
+     * accepted_with_data and fastopen_accepted counters of
+     * httpd_get_listen_stats(). This costs a system call or two per
+     * connection, leave it off outside of tuning.
+     */
+    bool listen_stats;
+
+    /**
+     * Longest request URI accepted, longer ones are answered with
+     * 414 URI Too Long. 0 for CONFIG_HTTPD_MAX_URI_LEN.
+     */
+    size_t max_uri_len;
+
+    /**
+     * Longest request line and header section accepted, longer ones are
+     * answered with 431 Request Header Fields Too Large. 0 for
+     * CONFIG_HTTPD_MAX_REQ_HDR_LEN. Together with max_uri_len, at most
+     * 65535.
+     *
+     * The buffers of a request are sized for common requests and only
+     * grow up to these limits for the requests that need it, the growth
+     * counting against mem_budget until the request is done.
+     */
+    size_t max_req_hdr_len;
 } httpd_config_t;
 
 /**
@@ -373,10 +536,10 @@ esp_err_t httpd_stop(httpd_handle_t handle);
  * @{
  */
 
-/* Max supported HTTP request header length */
+/* Default max supported HTTP request header length, see max_req_hdr_len */
 #define HTTPD_MAX_REQ_HDR_LEN CONFIG_HTTPD_MAX_REQ_HDR_LEN
 
-/* Max supported HTTP request URI length */
+/* Default max supported HTTP request URI length, see max_uri_len */
 #define HTTPD_MAX_URI_LEN CONFIG_HTTPD_MAX_URI_LEN
 
 /**
@@ -385,7 +548,7 @@ esp_err_t httpd_stop(httpd_handle_t handle);
 typedef struct httpd_req {
     httpd_handle_t  handle;                     /*!< Handle to server instance */
     int             method;                     /*!< The type of HTTP request, -1 if unsupported method, HTTP_ANY for wildcard method to support every method */
-    const char      uri[HTTPD_MAX_URI_LEN + 1]; /*!< The URI of this request (1 byte extra for null termination) */
+    const char     *uri;                        /*!< The URI of this request, null terminated */
     size_t          content_len;                /*!< Length of the request body */
     void           *aux;                        /*!< Internally used members */
 
@@ -626,12 +789,17 @@ typedef enum {
     /* Incoming payload is too large */
     HTTPD_413_CONTENT_TOO_LARGE,
 
-    /* URI length greater than CONFIG_HTTPD_MAX_URI_LEN */
+    /* URI length greater than max_uri_len of httpd_config_t */
     HTTPD_414_URI_TOO_LONG,
 
-    /* Headers section larger than CONFIG_HTTPD_MAX_REQ_HDR_LEN */
+    /* Headers section larger than max_req_hdr_len of httpd_config_t */
     HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE,
 
+    /* Server is out of the memory budget of its connections,
+     * see mem_budget in httpd_config_t
+     */
+    HTTPD_503_SERVICE_UNAVAILABLE,
+
     /* Used internally for retrieving the total count of errors */
     HTTPD_ERR_CODE_MAX
 } httpd_err_code_t;
@@ -762,6 +930,41 @@ typedef int (*httpd_recv_func_t)(httpd_handle_t hd, int sockfd, char *buf, size_
  */
 typedef int (*httpd_pending_func_t)(httpd_handle_t hd, int sockfd);
 
+/**
+ * @brief  A piece of data handed to a vectored send function
+ *
+ * @note   On POSIX hosts it has the layout of struct iovec, so that the
+ *         default vectored send passes the pieces to sendmsg() as they are.
+ */
+typedef struct {
+    const void *base;   /*!< Start of the piece */
+    size_t      len;    /*!< Length of the piece */
+} httpd_iovec_t;
+
+/**
+ * @brief  Prototype for HTTPDs low-level vectored send function
+ *
+ * Sends the pieces described by iov, in order, as if they were one
+ * contiguous buffer. The server uses it to put the status line, the
+ * headers and the body of a response on the wire with a single call.
+ *
+ * @note   The same error handling rules as for httpd_send_func_t apply.
+ *         Sending fewer bytes than the total length of all pieces is not
+ *         an error, the server calls again with the remaining pieces.
+ *
+ * @param[in] hd        server instance
+ * @param[in] sockfd    session socket file descriptor
+ * @param[in] iov       pieces to send
+ * @param[in] iovcnt    number of pieces
+ * @param[in] flags     flags for the send() function
+ * @return
+ *  - Bytes : The number of bytes sent successfully
+ *  - HTTPD_SOCK_ERR_INVALID  : Invalid arguments
+ *  - HTTPD_SOCK_ERR_TIMEOUT  : Timeout/interrupted while sending
+ *  - HTTPD_SOCK_ERR_FAIL     : Unrecoverable error while sending
+ */
+typedef int (*httpd_sendv_func_t)(httpd_handle_t hd, int sockfd, const httpd_iovec_t *iov, int iovcnt, int flags);
+
 /** End of TX / RX
  * @}
  */
@@ -814,6 +1017,31 @@ esp_err_t httpd_sess_set_recv_override(httpd_handle_t hd, int sockfd, httpd_recv
  */
 esp_err_t httpd_sess_set_send_override(httpd_handle_t hd, int sockfd, httpd_send_func_t send_func);
 
+/**
+ * @brief   Override web server's vectored send function (by session FD)
+ *
+ * Responses are assembled into a list of pieces (status line, headers,
+ * body) and handed to this function in one call. Setting a send override
+ * with httpd_sess_set_send_override() drops the vectored send function of
+ * the session, and the pieces are then passed one by one to the new send
+ * function. Transports that can do better (e.g. coalesce the pieces into
+ * a single TLS record) set their vectored function after the send override.
+ *
+ * @note    This API is supposed to be called either from the context of
+ *          - an http session APIs where sockfd is a valid parameter
+ *          - a URI handler where sockfd is obtained using httpd_req_to_sockfd()
+ *
+ * @param[in] hd         HTTPD instance handle
+ * @param[in] sockfd     Session socket FD
+ * @param[in] sendv_func The vectored send function to be set for this session,
+ *                       NULL to send the pieces through the send function
+ *
+ * @return
+ *  - ESP_OK : On successfully registering override
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ */
+esp_err_t httpd_sess_set_sendv_override(httpd_handle_t hd, int sockfd, httpd_sendv_func_t sendv_func);
+
 /**
  * @brief   Override web server's pending function (by session FD)
  *
@@ -848,6 +1076,7 @@ esp_err_t httpd_sess_set_pending_override(httpd_handle_t hd, int sockfd, httpd_p
  *
  * @return
  *  - ESP_OK : async request object created
+ *  - ESP_ERR_NO_MEM : out of memory, or of the memory budget of the server
  */
 esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out);
 
@@ -908,6 +1137,9 @@ int httpd_req_to_sockfd(httpd_req_t *r);
  *    This will ensure that the erroneous socket is closed and cleaned up by
  *    the web server.
  *  - Presently Chunked Encoding is not supported
+ *  - For a request with "Expect: 100-continue" the first call sends the
+ *    "100 Continue" interim response the client waits for. Responding
+ *    without reading the body closes the connection instead.
  *
  * @param[in] r         The request being responded to
  * @param[in] buf       Pointer to a buffer that the data will be read into
@@ -969,6 +1201,33 @@ size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field);
  */
 esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size);
 
+/**
+ * @brief   Get a view of the value of a field from the request headers
+ *
+ * Unlike httpd_req_get_hdr_value_str() the value is not copied, the
+ * returned pointer refers to the NULL terminated value inside the
+ * request's own header buffer. Lookups of the first headers of a
+ * request go through an index built while parsing.
+ *
+ * @note
+ *  - This API is supposed to be called only from the context of
+ *    a URI handler where httpd_req_t* request pointer is valid.
+ *  - The view is valid until the response is sent, after which all
+ *    request headers are purged. It must not be modified.
+ *
+ * @param[in]  r        The request being responded to
+ * @param[in]  field    The field to be searched in the header
+ * @param[out] val      Pointer set to the value if the field is found
+ * @param[out] val_len  Length of the value, without the NULL terminator (may be NULL)
+ *
+ * @return
+ *  - ESP_OK : Field found in the request header
+ *  - ESP_ERR_NOT_FOUND          : Key not found
+ *  - ESP_ERR_INVALID_ARG        : Null arguments
+ *  - ESP_ERR_HTTPD_INVALID_REQ  : Invalid HTTP request pointer
+ */
+esp_err_t httpd_req_get_hdr_view(httpd_req_t *r, const char *field, const char **val, size_t *val_len);
+
 /**
  * @brief   Get Query string length from the request URL
  *
@@ -1058,6 +1317,54 @@ esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, siz
  */
 esp_err_t httpd_req_get_cookie_val(httpd_req_t *req, const char *cookie_name, char *val, size_t *val_size);
 
+/* Maximum number of byte ranges honoured in a Range header. A request
+ * asking for more gets the whole representation */
+#define HTTPD_MAX_RANGES 8
+
+/**
+ * @brief A byte range of a representation, as requested by a Range header
+ */
+typedef struct {
+    size_t start;   /*!< Offset of the first byte */
+    size_t len;     /*!< Number of bytes, never zero */
+} httpd_range_t;
+
+/**
+ * @brief   Get the byte ranges asked for by the Range header of the request
+ *
+ * The "bytes" ranges of the Range header are resolved against the length
+ * of the representation: suffix ranges ("-500") count from the end, open
+ * ranges ("9500-") run to the end and ranges reaching past the end are
+ * cut. Ranges starting past the end are dropped.
+ *
+ * The Range header is ignored (count set to 0) when it is missing, cannot
+ * be parsed, asks for more than HTTPD_MAX_RANGES ranges, or when an
+ * If-Range header does not match validator.
+ *
+ * @note
+ *  - This API is supposed to be called only from the context of
+ *    a URI handler where httpd_req_t* request pointer is valid.
+ *  - Request headers are purged once a response is sent, call this before.
+ *
+ * @param[in]  r            The request being responded to
+ * @param[in]  total_len    Length of the complete representation
+ * @param[in]  validator    Entity tag or Last-Modified date of the representation,
+ *                          compared with If-Range. NULL if there is none, any
+ *                          If-Range then disables the ranges.
+ * @param[out] ranges       Array of HTTPD_MAX_RANGES entries receiving the ranges
+ * @param[out] count        Number of ranges stored, 0 to send the whole representation
+ *
+ * @return
+ *  - ESP_OK : Ranges (possibly none) stored
+ *  - ESP_ERR_HTTPD_RANGE        : The header was valid but no range can be satisfied,
+ *                                 a 416 response is due
+ *  - ESP_ERR_INVALID_ARG        : Null arguments
+ *  - ESP_ERR_HTTPD_INVALID_REQ  : Invalid HTTP request pointer
+ *  - ESP_ERR_NO_MEM             : Memory allocation failure
+ */
+esp_err_t httpd_req_get_ranges(httpd_req_t *r, size_t total_len, const char *validator,
+                               httpd_range_t *ranges, size_t *count);
+
 /**
  * @brief Test if a URI matches the given wildcard template.
  *
@@ -1202,14 +1509,110 @@ static inline esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *r, const char *str
     return httpd_resp_send_chunk(r, str, (str == NULL) ? 0 : HTTPD_RESP_USE_STRLEN);
 }
 
+/**
+ * @brief   API to send a range of an open file as a complete HTTP response.
+ *
+ * This API sends len bytes of the file, starting at offset, with a
+ * Content-Length header. On plain sockets of Linux hosts the data is
+ * copied to the socket by the kernel with sendfile(). Elsewhere, and
+ * whenever a send override is installed for the session (e.g. TLS),
+ * the file is read in blocks of CONFIG_HTTPD_FILE_BUF_LEN bytes and
+ * sent through the session's send functions.
+ *
+ * Status code, content type and additional headers are set the same
+ * way as for httpd_resp_send().
+ *
+ * @note
+ *  - This API is supposed to be called only from the context of
+ *    a URI handler where httpd_req_t* request pointer is valid.
+ *  - Once this API is called, the request has been responded to.
+ *  - The file position of fd is undefined afterwards. The file is
+ *    not closed.
+ *  - If the file holds less than len bytes after offset, the response
+ *    is cut short and ESP_ERR_HTTPD_RESP_SEND is returned. The session
+ *    should then be closed, as the client waits for the missing bytes.
+ *
+ * @param[in] r         The request being responded to
+ * @param[in] fd        Descriptor of the file, open for reading
+ * @param[in] offset    Offset in the file of the first byte to send
+ * @param[in] len       Number of bytes to send
+ *
+ * @return
+ *  - ESP_OK : On successfully sending the response packet
+ *  - ESP_ERR_INVALID_ARG : Null request pointer or invalid file descriptor
+ *  - ESP_ERR_HTTPD_RESP_HDR    : Essential headers are too large for internal buffer
+ *  - ESP_ERR_HTTPD_RESP_SEND   : Error in raw send, or reading the file failed
+ *  - ESP_ERR_HTTPD_ALLOC_MEM   : Failed to allocate the read buffer
+ *  - ESP_ERR_HTTPD_INVALID_REQ : Invalid request
+ */
+esp_err_t httpd_resp_send_file(httpd_req_t *r, int fd, off_t offset, size_t len);
+
+/**
+ * @brief   API to send a buffer as HTTP response, honouring the Range header of the request.
+ *
+ * The ranges of the request are obtained with httpd_req_get_ranges(). No
+ * range sends the whole buffer like httpd_resp_send(), a single range is
+ * sent as 206 Partial Content with a Content-Range header, several ranges
+ * as a 206 multipart/byteranges body whose parts carry the content type
+ * set with httpd_resp_set_type(). A Range that cannot be satisfied is
+ * answered with 416 Range Not Satisfiable. Accept-Ranges is always sent.
+ *
+ * @note
+ *  - This API is supposed to be called only from the context of
+ *    a URI handler where httpd_req_t* request pointer is valid.
+ *  - Once this API is called, the request has been responded to.
+ *  - Besides the headers set with httpd_resp_set_hdr(), up to two
+ *    headers are added, max_resp_headers must leave room for them.
+ *
+ * @param[in] r         The request being responded to
+ * @param[in] buf       Buffer holding the complete representation
+ * @param[in] buf_len   Length of the buffer
+ * @param[in] validator Entity tag or Last-Modified date checked against If-Range, may be NULL
+ *
+ * @return
+ *  - ESP_OK : On successfully sending the response packet
+ *  - ESP_ERR_INVALID_ARG : Null request pointer
+ *  - ESP_ERR_HTTPD_RESP_HDR    : Essential headers are too large for internal buffer
+ *  - ESP_ERR_HTTPD_RESP_SEND   : Error in raw send
+ *  - ESP_ERR_HTTPD_INVALID_REQ : Invalid request
+ *  - ESP_ERR_NO_MEM            : Memory allocation failure while reading the Range header
+ */
+esp_err_t httpd_resp_send_range(httpd_req_t *r, const char *buf, size_t buf_len, const char *validator);
+
+/**
+ * @brief   API to send an open file as HTTP response, honouring the Range header of the request.
+ *
+ * Same as httpd_resp_send_range(), with the data read from the file like
+ * httpd_resp_send_file() does.
+ *
+ * @param[in] r         The request being responded to
+ * @param[in] fd        Descriptor of the file, open for reading
+ * @param[in] file_len  Length of the file
+ * @param[in] validator Entity tag or Last-Modified date checked against If-Range, may be NULL
+ *
+ * @return
+ *  - ESP_OK : On successfully sending the response packet
+ *  - ESP_ERR_INVALID_ARG : Null request pointer or invalid file descriptor
+ *  - ESP_ERR_HTTPD_RESP_HDR    : Essential headers are too large for internal buffer
+ *  - ESP_ERR_HTTPD_RESP_SEND   : Error in raw send, or reading the file failed
+ *  - ESP_ERR_HTTPD_ALLOC_MEM   : Failed to allocate the read buffer
+ *  - ESP_ERR_HTTPD_INVALID_REQ : Invalid request
+ *  - ESP_ERR_NO_MEM            : Memory allocation failure while reading the Range header
+ */
+esp_err_t httpd_resp_send_file_range(httpd_req_t *r, int fd, size_t file_len, const char *validator);
+
 /* Some commonly used status codes */
 #define HTTPD_200      "200 OK"                     /*!< HTTP Response 200 */
 #define HTTPD_204      "204 No Content"             /*!< HTTP Response 204 */
+#define HTTPD_206      "206 Partial Content"        /*!< HTTP Response 206 */
 #define HTTPD_207      "207 Multi-Status"           /*!< HTTP Response 207 */
+#define HTTPD_304      "304 Not Modified"           /*!< HTTP Response 304 */
 #define HTTPD_400      "400 Bad Request"            /*!< HTTP Response 400 */
 #define HTTPD_404      "404 Not Found"              /*!< HTTP Response 404 */
 #define HTTPD_408      "408 Request Timeout"        /*!< HTTP Response 408 */
+#define HTTPD_416      "416 Range Not Satisfiable"  /*!< HTTP Response 416 */
 #define HTTPD_500      "500 Internal Server Error"  /*!< HTTP Response 500 */
+#define HTTPD_503      "503 Service Unavailable"    /*!< HTTP Response 503 */
 
 /**
  * @brief   API to set the HTTP status code
@@ -1610,6 +2013,9 @@ esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd);
  * @note    Calling this API is only necessary if the LRU Purge Enable option
  *          is enabled.
  *
+ * @note    Outside of the server thread serving the session, the update is
+ *          queued to that thread with httpd_queue_work().
+ *
  * @param[in] handle    Handle to server returned by httpd_start
  * @param[in] sockfd    The socket descriptor of the session for which LRU counter
  *                      is to be updated
@@ -1621,6 +2027,126 @@ esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd);
  */
 esp_err_t httpd_sess_update_lru_counter(httpd_handle_t handle, int sockfd);
 
+/**
+ * @brief   Get the number of bytes of output queued for a session
+ *
+ * Output is queued when sends from the server thread find the socket of
+ * the client full, see tx_queue_limit in httpd_config_t. Producers, for
+ * instance ones pushing WebSocket frames from httpd_queue_work(), can use
+ * it to skip or coalesce data for a slow client, and drain_fn to resume
+ * once the queue is written.
+ *
+ * @note    Outside of the server thread the value is only a snapshot.
+ *
+ * @param[in]  handle   Handle to server returned by httpd_start
+ * @param[in]  sockfd   The socket descriptor of the session
+ * @param[out] pending  Bytes queued and not written yet
+ *
+ * @return
+ *  - ESP_OK : Socket found
+ *  - ESP_ERR_NOT_FOUND   : Socket not found
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ */
+esp_err_t httpd_sess_get_tx_pending(httpd_handle_t handle, int sockfd, size_t *pending);
+
+/**
+ * @brief   Get the bytes of the memory budget a session uses
+ *
+ * This is the session slot, its receive buffer, queued output, partially
+ * received request and async request copies, plus what was charged with
+ * httpd_sess_charge_mem(). See mem_budget in httpd_config_t.
+ *
+ * @note    Outside of the server thread the value is only a snapshot.
+ *
+ * @param[in]  handle   Handle to server returned by httpd_start
+ * @param[in]  sockfd   The socket descriptor of the session
+ * @param[out] used     Bytes used by the session
+ *
+ * @return
+ *  - ESP_OK : Socket found
+ *  - ESP_ERR_NOT_FOUND   : Socket not found
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ */
+esp_err_t httpd_sess_get_mem_usage(httpd_handle_t handle, int sockfd, size_t *used);
+
+/**
+ * @brief   Charge memory the application allocated for a session, for
+ *          instance its context, to the session and the server budget
+ *
+ * The charge is returned to the budget by httpd_sess_release_mem(), or
+ * when the session is closed.
+ *
+ * @param[in] handle    Handle to server returned by httpd_start
+ * @param[in] sockfd    The socket descriptor of the session
+ * @param[in] bytes     Bytes to charge
+ *
+ * @return
+ *  - ESP_OK : Bytes charged
+ *  - ESP_ERR_HTTPD_MEM_BUDGET : The budget of the server cannot cover them, nothing was charged
+ *  - ESP_ERR_NOT_FOUND   : Socket not found
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ */
+esp_err_t httpd_sess_charge_mem(httpd_handle_t handle, int sockfd, size_t bytes);
+
+/**
+ * @brief   Return bytes charged by httpd_sess_charge_mem() to the budget
+ *
+ * @param[in] handle    Handle to server returned by httpd_start
+ * @param[in] sockfd    The socket descriptor of the session
+ * @param[in] bytes     Bytes to release, at most what the session uses
+ *
+ * @return
+ *  - ESP_OK : Bytes released
+ *  - ESP_ERR_NOT_FOUND   : Socket not found
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ */
+esp_err_t httpd_sess_release_mem(httpd_handle_t handle, int sockfd, size_t bytes);
+
+/**
+ * @brief   Get the memory used by the connections of the server, all its
+ *          worker loops together, and its budget
+ *
+ * @param[in]  handle   Handle to server returned by httpd_start
+ * @param[out] used     Bytes used, may be NULL
+ * @param[out] budget   mem_budget of the configuration, 0 for none, may be NULL
+ *
+ * @return
+ *  - ESP_OK : Usage retrieved
+ *  - ESP_ERR_INVALID_ARG : Null handle
+ */
+esp_err_t httpd_get_mem_usage(httpd_handle_t handle, size_t *used, size_t *budget);
+
+/**
+ * @brief Listening socket settings in effect and connection counters,
+ *        over all the worker loops of a server
+ */
+typedef struct {
+    uint16_t backlog;               /*!< Listen backlog, after auto-sizing */
+    bool     defer_accept;          /*!< TCP_DEFER_ACCEPT is set on the listening socket */
+    bool     fastopen;              /*!< TCP_FASTOPEN is set on the listening socket */
+    uint32_t accepted;              /*!< Connections accepted */
+    uint32_t accepted_with_data;    /*!< Connections whose data had arrived when accepted. Only counted with defer_accept and listen_stats */
+    uint32_t fastopen_accepted;     /*!< Connections which carried data in their SYN. Only counted with fastopen and listen_stats */
+} httpd_listen_stats_t;
+
+/**
+ * @brief   Get the listening socket settings in effect and how many
+ *          connections were accepted
+ *
+ * Tells whether defer_accept_timeout and fastopen_queue_len could be
+ * applied, and whether clients take advantage of them.
+ *
+ * @note    The counters are only a snapshot while the server runs.
+ *
+ * @param[in]  handle   Handle to server returned by httpd_start
+ * @param[out] stats    Settings and counters
+ *
+ * @return
+ *  - ESP_OK : Stats retrieved
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ */
+esp_err_t httpd_get_listen_stats(httpd_handle_t handle, httpd_listen_stats_t *stats);
+
 /**
  * @brief   Returns list of current socket descriptors of active sessions
  *
@@ -1665,21 +2191,140 @@ typedef void (*httpd_work_fn_t)(void *arg);
  *          and send it to the persistently opened connection. This facility is for use
  *          by such protocols.
  *
+ * @note    The queue holds at most work_queue_len items. With
+ *          CONFIG_HTTPD_QUEUE_WORK_BLOCKING this call waits for room,
+ *          otherwise it fails with ESP_ERR_HTTPD_QUEUE_FULL and the caller
+ *          decides whether to retry, coalesce or drop the work.
+ *
  * @param[in] handle    Handle to server returned by httpd_start
  * @param[in] work      Pointer to the function to be executed in the HTTPD's context
  * @param[in] arg       Pointer to the arguments that should be passed to this function
  *
  * @return
  *  - ESP_OK   : On successfully queueing the work
- *  - ESP_FAIL : Failure in ctrl socket
+ *  - ESP_ERR_HTTPD_QUEUE_FULL : The work queue is full
+ *  - ESP_FAIL : Failure in waiting for room in the queue
  *  - ESP_ERR_INVALID_ARG : Null arguments
  */
 esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg);
 
+/**
+ * @brief   A work function with its argument, for httpd_queue_work_batch()
+ */
+typedef struct {
+    httpd_work_fn_t fn;     /*!< Function to be executed in the HTTPD's context */
+    void *arg;              /*!< Argument passed to fn */
+} httpd_work_t;
+
+/**
+ * @brief   Queue execution of several functions in HTTPD's context
+ *
+ * The works are queued in order and run in that order, the server is
+ * woken up once for all of them. Without CONFIG_HTTPD_QUEUE_WORK_BLOCKING,
+ * queueing stops at the first work not fitting in the queue, the works
+ * before it are queued and will run.
+ *
+ * @param[in]  handle   Handle to server returned by httpd_start
+ * @param[in]  works    Works to queue
+ * @param[in]  count    Number of works
+ * @param[out] queued   Number of works queued, may be NULL
+ *
+ * @return
+ *  - ESP_OK   : All works were queued
+ *  - ESP_ERR_HTTPD_QUEUE_FULL : The queue got full, only *queued works were queued
+ *  - ESP_FAIL : Failure in waking up the server to make room, only *queued
+ *               works were queued
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ */
+esp_err_t httpd_queue_work_batch(httpd_handle_t handle, const httpd_work_t *works, size_t count, size_t *queued);
+
+/**
+ * @brief   Get the number of works queued and not run yet
+ *
+ * Lets producers shed or coalesce load before the queue is full. The
+ * values are a snapshot, other threads may be queueing meanwhile.
+ *
+ * @param[in]  handle   Handle to server returned by httpd_start
+ * @param[out] depth    Number of works waiting to run
+ * @param[out] capacity Maximum number of works waiting to run, may be NULL
+ *
+ * @return
+ *  - ESP_OK   : On success
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ */
+esp_err_t httpd_queue_work_depth(httpd_handle_t handle, size_t *depth, size_t *capacity);
+
 /** End of Group Work Queue
  * @}
  */
 
+/* ************** Group: Static Files ************** */
+/** @name Static Files
+ * A ready made URI handler serving the files of a directory
+ * @{
+ */
+
+/**
+ * @brief Configuration of httpd_static_handler(), passed as user_ctx of the URI handler
+ */
+typedef struct httpd_static_config {
+    const char *base_path;      /*!< Directory the files are served from, without trailing '/' */
+    const char *uri_prefix;     /*!< Part of the URI stripped before it is mapped to a file
+                                     (e.g. "/static"), NULL to map the whole URI */
+    const char *index_file;     /*!< File served for URIs ending with '/', NULL to answer 404 */
+    const char *cache_control;  /*!< Value of the Cache-Control header sent with every file
+                                     (e.g. "no-cache", "public, max-age=86400"), NULL to omit it */
+} httpd_static_config_t;
+
+/**
+ * @brief   URI handler serving the files of a directory
+ *
+ * The URI of the request, without the query and the configured prefix, is
+ * appended to base_path. Every file is sent with a strong ETag, derived
+ * from its size and modification time, and a Last-Modified header. A
+ * request carrying If-None-Match (or, without it, If-Modified-Since) that
+ * still matches the file is answered with 304 Not Modified, without the
+ * file being opened. Range requests are answered as by
+ * httpd_resp_send_file_range(), with the ETag checked against If-Range.
+ * The content type is guessed from the file extension.
+ *
+ * Register it with a wildcard matcher:
+ * @code{c}
+ * static const httpd_static_config_t assets = {
+ *     .base_path     = "/spiffs/www",
+ *     .uri_prefix    = "/static",
+ *     .index_file    = "index.html",
+ *     .cache_control = "public, max-age=3600",
+ * };
+ * httpd_uri_t uri = {
+ *     .uri      = "/static/" "*",
+ *     .method   = HTTP_GET,
+ *     .handler  = httpd_static_handler,
+ *     .user_ctx = (void *) &assets,
+ * };
+ * // with config.uri_match_fn = httpd_uri_match_wildcard
+ * httpd_register_uri_handler(server, &uri);
+ * @endcode
+ *
+ * @note
+ *  - URIs containing ".." path segments or backslashes are answered
+ *    with 404.
+ *  - The handler adds up to five response headers, max_resp_headers
+ *    in the server configuration must leave room for them.
+ *
+ * @param[in] req   The request being responded to, user_ctx pointing to
+ *                  an httpd_static_config_t
+ *
+ * @return
+ *  - ESP_OK   : The file, 304 or 404 was sent
+ *  - ESP_FAIL : Sending failed, the session will be closed
+ */
+esp_err_t httpd_static_handler(httpd_req_t *req);
+
+/** End of Group Static Files
+ * @}
+ */
+
 /* ************** Group: WebSocket ************** */
 /** @name WebSocket
  * Functions and structs for WebSocket server
@@ -1766,6 +2411,8 @@ esp_err_t httpd_ws_send_frame(httpd_req_t *req, httpd_ws_frame_t *pkt);
  * using internally configured httpd send function
  *
  * This API should rarely be called directly, with an exception of asynchronous send using httpd_queue_work.
+ * Called that way, a frame the client does not take right away is queued on the session,
+ * see tx_queue_limit in httpd_config_t and httpd_sess_get_tx_pending().
  *
  * @param[in] hd      Server instance data
  * @param[in] fd      Socket descriptor for sending data
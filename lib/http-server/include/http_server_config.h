@@ -4,4 +4,6 @@
 #define CONFIG_HTTPD_SERVER_EVENT_POST_TIMEOUT 2000
 #define CONFIG_HTTPD_MAX_REQ_HDR_LEN 1024
 #define CONFIG_HTTPD_PURGE_BUF_LEN 32
+#define CONFIG_HTTPD_RX_BUF_LEN 4096
+#define CONFIG_HTTPD_FILE_BUF_LEN 16384
 #define CONFIG_HTTPD_WS_SUPPORT 1
@@ -26,6 +26,10 @@
 
 #include <log.h>
 
+#include "util/poller.h"
+#include "util/timer_wheel.h"
+#include "util/work_queue.h"
+
 #ifdef _WIN32
 #include "port/win/network.h"
 #else
@@ -44,13 +48,81 @@ extern "C" {
 #define NEWLIB_NANO_COMPAT_CAST(size_t_var)  size_t_var
 #endif
 
-/* Size of request data block/chunk (not to be confused with chunked encoded data)
- * that is received and parsed in one turn of the parsing process. This should not
- * exceed the scratch buffer size and should at least be 8 bytes */
-#define PARSER_BLOCK_SIZE  128
+/* Number of session slots allocated at once whenever the socket database
+ * runs out of free slots, up to max_open_sockets */
+#define HTTPD_SESS_CHUNK_SLOTS  16
+
+/* Maximum number of pieces gathered for one vectored send. A response with
+ * more custom headers than fit is flushed in several calls. The pieces live
+ * on the stack of whichever task sends the response, so this stays small */
+#define HTTPD_SENDV_MAX_IOV  16
+
+/* Sends from the server thread are tried without waiting and what the
+ * socket does not take is queued on the session, which needs sends that
+ * can be made non-blocking one call at a time */
+#ifdef _WIN32
+#define HTTPD_TX_QUEUE     0
+#define HTTPD_SEND_NOWAIT  0
+#else
+#define HTTPD_TX_QUEUE     1
+#define HTTPD_SEND_NOWAIT  MSG_DONTWAIT
+#endif
+
+/* Maximum number of work items queued for a server loop and not run yet,
+ * when httpd_config_t.work_queue_len is 0 */
+#ifdef ESP_PLATFORM
+#define HTTPD_WORK_QUEUE_LEN  32
+#else
+#define HTTPD_WORK_QUEUE_LEN  1024
+#endif
+
+/* Sizes the scratch and URI buffers of a server loop start with. They
+ * grow for a request that needs it, up to max_req_hdr_len / max_uri_len
+ * of the configuration, and are trimmed back when it is done */
+#define HTTPD_SCRATCH_INIT_LEN  512
+#define HTTPD_URI_INIT_LEN      128
+
+/* Largest scratch buffer, header offsets in it are 16 bits */
+#define HTTPD_SCRATCH_MAX  UINT16_MAX
 
-/* Calculate the maximum size needed for the scratch buffer */
-#define HTTPD_SCRATCH_BUF  MAX(HTTPD_MAX_REQ_HDR_LEN, HTTPD_MAX_URI_LEN)
+/* Request headers indexed while parsing, lookups of the headers past
+ * them walk the scratch buffer */
+#define HTTPD_HDR_INDEX_LEN  32
+
+/**
+ * @brief Location of a request header in the scratch buffer
+ */
+struct httpd_hdr_entry {
+    uint16_t name_off;                  /*!< Offset of the field name */
+    uint16_t name_len;                  /*!< Length of the field name */
+    uint16_t value_off;                 /*!< Offset of the value, NULL terminated */
+    uint16_t value_len;                 /*!< Length of the value */
+    uint32_t hash;                      /*!< Hash of the lower case field name, see httpd_hdr_hash() */
+};
+
+/**
+ * @brief Request headers recognized while parsing, the values of
+ *        which are kept in httpd_req_aux for lookups without a search
+ */
+enum httpd_known_hdr {
+    HTTPD_HDR_HOST = 0,
+    HTTPD_HDR_CONNECTION,
+    HTTPD_HDR_CONTENT_TYPE,
+    HTTPD_HDR_ACCEPT_ENCODING,
+    HTTPD_HDR_COOKIE,
+    HTTPD_HDR_EXPECT,
+    HTTPD_HDR_UPGRADE,
+    HTTPD_HDR_KNOWN_MAX,
+    HTTPD_HDR_UNKNOWN = HTTPD_HDR_KNOWN_MAX
+};
+
+/**
+ * @brief Value of a request header in the scratch buffer
+ */
+struct httpd_hdr_value {
+    const char *value;                  /*!< NULL terminated value, NULL if the header is absent */
+    size_t      len;                    /*!< Length of the value */
+};
 
 /* Formats a log string to prepend context function name */
 // #define LOG_FMT(x)      "%s: " x, __func__
@@ -69,6 +141,12 @@ struct thread_data {
     } status;           /*!< State of the thread */
 };
 
+/**
+ * @brief   State of a request whose header has not been received completely.
+ *          Defined in httpd_parse.c
+ */
+struct httpd_parse_state;
+
 /**
  * @brief A database of all the open sockets in the system.
  */
@@ -83,11 +161,29 @@ struct sock_db {
     httpd_send_func_t send_fn;              /*!< Send function for this socket */
     httpd_recv_func_t recv_fn;              /*!< Receive function for this socket */
     httpd_pending_func_t pending_fn;        /*!< Pending function for this socket */
+    httpd_sendv_func_t sendv_fn;            /*!< Vectored send function for this socket, NULL to use send_fn */
     uint64_t lru_counter;                   /*!< LRU Counter indicating when the socket was last used */
-    bool lru_socket;                        /*!< Flag indicating LRU socket */
-    char pending_data[PARSER_BLOCK_SIZE];   /*!< Buffer for pending data to be received */
+    struct sock_db *lru_prev;               /*!< Less recently used session on the LRU list */
+    struct sock_db *lru_next;               /*!< More recently used session on the LRU list */
+    char *rx_buf;                           /*!< Receive buffer, only allocated while it holds data */
+    size_t rx_size;                         /*!< Size of rx_buf */
+    size_t rx_start;                        /*!< Offset of the pending data in rx_buf */
     size_t pending_len;                     /*!< Length of pending data to be received */
+    char *tx_buf;                           /*!< Output not taken by the socket yet, only allocated while it holds data */
+    size_t tx_size;                         /*!< Size of tx_buf */
+    size_t tx_start;                        /*!< Offset of the queued output in tx_buf */
+    size_t tx_len;                          /*!< Length of the queued output */
+    bool tx_close;                          /*!< Close the session once the queued output is written */
+    size_t mem_used;                        /*!< Bytes of the memory budget used by the session, updated atomically */
     bool for_async_req;                     /*!< If true, the socket will not be LRU purged */
+    bool ready;                             /*!< Session is queued on the server's ready list */
+    struct sock_db *ready_prev;             /*!< Previous session on the ready list */
+    struct sock_db *ready_next;             /*!< Next session on the ready list */
+    struct sock_db *free_next;              /*!< Next slot on the free list, only used while fd is -1 */
+    httpd_timer_t timer;                    /*!< Idle or header deadline of the session */
+    bool timer_header;                      /*!< timer is the header deadline of a partially received request */
+    unsigned requests;                      /*!< Number of requests received on this connection */
+    struct httpd_parse_state *parse_state;  /*!< Request received only in part so far, NULL between requests */
 #ifdef CONFIG_HTTPD_WS_SUPPORT
     bool ws_handshake_done;                 /*!< True if it has done WebSocket handshake (if this socket is a valid WS) */
     bool ws_close;                          /*!< Set to true to close the socket later (when WS Close frame received) */
@@ -103,18 +199,28 @@ struct sock_db {
  */
 struct httpd_req_aux {
     struct sock_db *sd;                             /*!< Pointer to socket database */
-    char            scratch[HTTPD_SCRATCH_BUF + 1]; /*!< Temporary buffer for our operations (1 byte extra for null termination) */
+    char           *scratch;                        /*!< Temporary buffer for our operations (1 byte extra for null termination) */
+    size_t          scratch_size;                   /*!< Size of scratch, without the byte for null termination */
+    char           *uri;                            /*!< Buffer of the request URI, pointed to by httpd_req_t */
+    size_t          uri_size;                       /*!< Size of uri, without the byte for null termination */
     size_t          remaining_len;                  /*!< Amount of data remaining to be fetched */
     char           *status;                         /*!< HTTP response's status code */
     char           *content_type;                   /*!< HTTP response's content type */
     bool            first_chunk_sent;               /*!< Used to indicate if first chunk sent */
     unsigned        req_hdrs_count;                 /*!< Count of total headers in request packet */
+    unsigned        hdr_index_count;                /*!< Headers of the request in hdr_index */
+    struct httpd_hdr_entry hdr_index[HTTPD_HDR_INDEX_LEN]; /*!< First headers of the request, built while parsing */
+    struct httpd_hdr_value known_hdrs[HTTPD_HDR_KNOWN_MAX]; /*!< First value of each well-known request header */
+    uint8_t                known_hdrs_seen;                 /*!< Bit per well-known header whose value is set */
+    bool            expect_continue;                /*!< 100 Continue is sent once the handler reads the body */
     unsigned        resp_hdrs_count;                /*!< Count of additional headers in response packet */
     struct resp_hdr {
         const char *field;
         const char *value;
     } *resp_hdrs;                                   /*!< Additional headers in response packet */
     struct http_parser_url url_parse_res;           /*!< URL parsing result, used for retrieving URL elements */
+    uint64_t        body_deadline;                  /*!< Time by which the body must be received, 0 for none */
+    bool            close_conn;                     /*!< Close the connection after the response */
 #ifdef CONFIG_HTTPD_WS_SUPPORT
     bool ws_handshake_detect;                       /*!< WebSocket handshake detection flag */
     httpd_ws_type_t ws_type;                        /*!< WebSocket frame type */
@@ -130,18 +236,47 @@ struct httpd_req_aux {
 struct httpd_data {
     httpd_config_t config;                  /*!< HTTPD server configuration */
     int listen_fd;                          /*!< Server listener FD */
-    int ctrl_fd;                            /*!< Ctrl message receiver FD */
+    int ctrl_fd;                            /*!< Doorbell FD of the work queue */
 #if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
-    SemaphoreHandle_t ctrl_sock_semaphore;  /*!< Ctrl socket semaphore */
+    SemaphoreHandle_t ctrl_sock_semaphore;  /*!< Counts the free entries of the work queue */
 #endif
-    int msg_fd;                             /*!< Ctrl message sender FD */
+    httpd_work_queue_t *work_queue;         /*!< Work items queued from any thread */
     struct thread_data hd_td;               /*!< Information for the HTTPD thread */
-    struct sock_db *hd_sd;                  /*!< The socket database */
-    int hd_sd_active_count;                 /*!< The number of the active sockets */
+    struct sock_db **hd_sd;                 /*!< The socket database, as chunks of HTTPD_SESS_CHUNK_SLOTS slots */
+    int hd_sd_capacity;                     /*!< The number of allocated slots in the socket database */
+    int hd_sd_active_count;                 /*!< The number of the active sockets, updated atomically */
+    struct sock_db *hd_sd_free;             /*!< Free slots of the socket database, linked through free_next */
+    struct sock_db **hd_fd_map;             /*!< Active sessions hashed by descriptor, open addressing */
+    uint8_t hd_fd_map_bits;                 /*!< hd_fd_map has (1 << hd_fd_map_bits) entries */
+    httpd_os_mutex_t hd_fd_map_lock;        /*!< Held by the loop while changing hd_fd_map, and by other threads while looking it up */
+    bool hd_fd_map_lock_init;               /*!< hd_fd_map_lock was created */
     httpd_uri_t **hd_calls;                 /*!< Registered URI handlers */
     struct httpd_req hd_req;                /*!< The current HTTPD request */
     struct httpd_req_aux hd_req_aux;        /*!< Additional data about the HTTPD request kept unexposed */
     uint64_t lru_counter;                   /*!< LRU counter */
+    struct sock_db *lru_head;               /*!< Least recently used active session */
+    struct sock_db *lru_tail;               /*!< Most recently used active session */
+    httpd_poller_t *poller;                 /*!< Readiness backend watching listen, ctrl and session sockets */
+    httpd_poll_event_t *poll_events;        /*!< Event buffer for httpd_poll_wait() */
+    int poll_max_events;                    /*!< Size of poll_events */
+    bool listen_armed;                      /*!< Listen socket is currently watched for new connections */
+    bool lru_stalled;                       /*!< No session could be closed for a waiting connection, the listen socket is left out of one poll wait */
+    uint8_t lru_peer;                       /*!< Worker loop asked next to close a session for this one */
+    bool listen_opts_inherited;             /*!< Accepted sockets inherit the timeouts and keep-alive of the listen socket */
+    bool listen_defer_accept;               /*!< TCP_DEFER_ACCEPT is set on the listen socket */
+    bool listen_fastopen;                   /*!< TCP_FASTOPEN is set on the listen socket */
+    int accepted;                           /*!< Connections accepted by this loop, updated atomically */
+    int accepted_with_data;                 /*!< Of which had data waiting, counted with TCP_DEFER_ACCEPT */
+    int fastopen_accepted;                  /*!< Of which carried data in their SYN, counted with TCP_FASTOPEN */
+    struct sock_db *ready_head;             /*!< Sessions with input waiting to be processed */
+    struct sock_db *ready_tail;             /*!< Last session on the ready list */
+    int ready_count;                        /*!< Number of sessions on the ready list */
+    httpd_timer_wheel_t timers;             /*!< Deadlines of the sessions */
+    struct httpd_data *primary;             /*!< Instance owning the state shared by all worker loops (itself for the first loop) */
+    struct httpd_data **workers;            /*!< All the worker loops of the server, primary included. Only set on the primary */
+    uint8_t worker_count;                   /*!< Number of entries in workers */
+    size_t mem_used;                        /*!< Bytes used by the sessions of all the loops, only kept on the primary, updated atomically */
+    int sess_open;                          /*!< Sessions open in all the loops, only kept on the primary, updated atomically */
 
     /* Array of registered error handler functions */
     httpd_err_handler_func_t *err_handler_fns;
@@ -165,9 +300,27 @@ typedef int (*httpd_session_enum_function)(struct sock_db *session, void *contex
  */
 void httpd_sess_enum(struct httpd_data *hd, httpd_session_enum_function enum_function, void *context);
 
+/**
+ * @brief  Enumerates the open sessions, from any thread
+ *
+ * The sessions are taken from the descriptor map under its lock, so that
+ * the sessions of a worker loop can be listed while the loop runs.
+ * The enumeration function must not call back into the server.
+ *
+ * @param[in] hd            Server instance data
+ * @param[in] enum_function Enumeration function, which will be called for each open session
+ * @param[in] context       Context, which will be passed to the enumeration function
+ */
+void httpd_sess_enum_open(struct httpd_data *hd, httpd_session_enum_function enum_function, void *context);
+
 /**
  * @brief   Returns next free session slot (fd<0)
  *
+ * The slot at the head of the free list is returned without taking it,
+ * httpd_sess_attach() does. The socket database is grown by one chunk
+ * if all the allocated slots are in use and max_open_sockets is not
+ * reached yet.
+ *
  * @param[in] hd    Server instance data
  *
  * @return
@@ -176,15 +329,43 @@ void httpd_sess_enum(struct httpd_data *hd, httpd_session_enum_function enum_fun
  */
 struct sock_db *httpd_sess_get_free(struct httpd_data *hd);
 
+/**
+ * @brief   Takes a free session slot for a descriptor and makes the
+ *          session known to httpd_sess_get(), without touching the socket
+ *
+ * @param[in] hd    Server instance data
+ * @param[in] fd    Descriptor of the session
+ *
+ * @return
+ *  - +VE : The session, counted as active
+ *  - NULL: No slot is available
+ */
+struct sock_db *httpd_sess_attach(struct httpd_data *hd, int fd);
+
 /**
  * @brief Retrieve a session by its descriptor
  *
+ * The sessions of a worker loop are hashed by descriptor, so the lookup
+ * does not depend on the number of connections.
+ *
  * @param[in] hd     Server instance data
  * @param[in] sockfd Socket FD
  * @return pointer into the socket DB, or NULL if not found
  */
 struct sock_db *httpd_sess_get(struct httpd_data *hd, int sockfd);
 
+/**
+ * @brief Get the server handle of the worker loop owning a socket
+ *
+ * Work related to a session must be queued with this handle, so that it
+ * runs on the thread serving the session.
+ *
+ * @param[in] handle Server handle (any of its worker loops)
+ * @param[in] sockfd Socket FD
+ * @return handle of the owning loop, or handle itself if sockfd is unknown
+ */
+httpd_handle_t httpd_sess_owner(httpd_handle_t handle, int sockfd);
+
 /**
  * @brief Delete sessions whose FDs have became invalid.
  *        This is a recovery strategy e.g. after select() fails.
@@ -243,15 +424,75 @@ void httpd_sess_delete(struct httpd_data *hd, struct sock_db *session);
 void httpd_sess_free_ctx(void **ctx, httpd_free_ctx_fn_t free_fn);
 
 /**
- * @brief   Add descriptors present in the socket database to an fdset and
- *          update the value of maxfd which are needed by the select function
- *          for looking through all available sockets for incoming data.
+ * @brief   Queue a session on the ready list so that it gets processed
+ *          by the server loop without waiting for a new poller event.
+ *          Does nothing if the session is already queued.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] session Session
+ */
+void httpd_sess_set_ready(struct httpd_data *hd, struct sock_db *session);
+
+/**
+ * @brief   Remove a session from the ready list, if queued.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] session Session
+ */
+void httpd_sess_clear_ready(struct httpd_data *hd, struct sock_db *session);
+
+/**
+ * @brief   Checks if receiving on a session would return right away
+ *
+ * True when data is pending (see httpd_sess_pending()) or when the socket
+ * has data, an orderly shutdown or an error queued. Used to stop reading a
+ * request that has not been received completely, instead of blocking the
+ * server thread until the client sends the rest.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] session Session
+ *
+ * @return True if a receive would not block
+ */
+bool httpd_sess_can_recv(struct httpd_data *hd, struct sock_db *session);
+
+/**
+ * @brief   Checks if a session that was just processed must be processed
+ *          again without waiting for the poller.
+ *
+ * Besides the pending data checked by httpd_sess_pending(), with an edge
+ * triggered poller this also peeks the socket, as bytes which were already
+ * queued in the kernel when the last request was read (e.g. a pipelined
+ * request, or a close) will not produce another event.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] session Session
+ *
+ * @return True if the session should be processed again
+ */
+bool httpd_sess_has_input(struct httpd_data *hd, struct sock_db *session);
+
+/**
+ * @brief   Stop watching a session socket while it is owned by an
+ *          asynchronous request handler.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] session Session
+ */
+void httpd_sess_suspend(struct httpd_data *hd, struct sock_db *session);
+
+/**
+ * @brief   Resume watching a session socket once the asynchronous request
+ *          handler is done with it. Safe to call from any task, the poller
+ *          is updated from the server task through httpd_queue_work().
+ *
+ * @param[in] session Session
  *
- * @param[in]  hd    Server instance data
- * @param[out] fdset File descriptor set to be updated.
- * @param[out] maxfd Maximum value among all file descriptors.
+ * @return
+ *  - ESP_OK   : on successfully queuing the work
+ *  - ESP_FAIL : in case of control socket error while sending
  */
-void httpd_sess_set_descriptors(struct httpd_data *hd, fd_set *fdset, int *maxfd);
+esp_err_t httpd_sess_resume(struct sock_db *session);
 
 /**
  * @brief   Checks if session can accept another connection from new client.
@@ -284,6 +525,99 @@ bool httpd_is_sess_available(struct httpd_data *hd);
  */
 bool httpd_sess_pending(struct httpd_data *hd, struct sock_db *session);
 
+/**
+ * @brief   Update the events watched for a session socket: readability,
+ *          and writability while output is queued on it.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] session Session
+ */
+void httpd_sess_watch(struct httpd_data *hd, struct sock_db *session);
+
+/**
+ * @brief   Keep a session to be closed open until its queued output is
+ *          written, or send_wait_timeout runs out. Nothing more is read
+ *          from it meanwhile.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] session Session
+ *
+ * @return True if the session lingers, false if it has nothing queued
+ *         and can be deleted right away
+ */
+bool httpd_sess_linger(struct httpd_data *hd, struct sock_db *session);
+
+/**
+ * @brief   Charge bytes allocated for a session to it and to the memory
+ *          budget of the server. Safe from any thread.
+ *
+ * @param[in] session Session
+ * @param[in] bytes   Bytes allocated
+ * @param[in] force   Charge them even over the budget, for what a session
+ *                    needs to be answered at all
+ *
+ * @return
+ *  - ESP_OK                   : bytes charged
+ *  - ESP_ERR_HTTPD_MEM_BUDGET : the budget cannot cover them, nothing was charged
+ */
+esp_err_t httpd_sess_mem_charge(struct sock_db *session, size_t bytes, bool force);
+
+/**
+ * @brief   Return bytes charged by httpd_sess_mem_charge() to the budget,
+ *          at most what the session uses
+ *
+ * @param[in] session Session
+ * @param[in] bytes   Bytes freed
+ */
+void httpd_sess_mem_release(struct sock_db *session, size_t bytes);
+
+/**
+ * @brief   Check whether the connections of the server used up its memory budget
+ *
+ * @param[in] hd      Server instance data
+ *
+ * @return True if there is a budget and nothing is left of it
+ */
+bool httpd_mem_exhausted(struct httpd_data *hd);
+
+/**
+ * @brief   Charge memory of a server loop, not owned by any session,
+ *          to the memory budget
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] bytes   Bytes about to be allocated
+ *
+ * @return
+ *  - ESP_OK : Bytes charged
+ *  - ESP_ERR_HTTPD_MEM_BUDGET : Budget exceeded, nothing charged
+ */
+esp_err_t httpd_mem_charge(struct httpd_data *hd, size_t bytes);
+
+/**
+ * @brief   Return bytes charged by httpd_mem_charge() to the budget
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] bytes   Bytes freed
+ */
+void httpd_mem_release(struct httpd_data *hd, size_t bytes);
+
+/**
+ * @brief   Point the well-known request headers at a copy of the
+ *          scratch buffer they were found in
+ *
+ * @param[in] ra      Request with the copy as its scratch buffer
+ * @param[in] old     Scratch buffer the headers point into
+ */
+void httpd_req_rebase_hdrs(struct httpd_req_aux *ra, const char *old);
+
+/**
+ * @brief   Closes the sessions whose idle or header deadline has passed.
+ *          Called from the server loop on every iteration.
+ *
+ * @param[in] hd  Server instance data
+ */
+void httpd_sess_expire(struct httpd_data *hd);
+
 /**
  * @brief   Removes the least recently used client from the session
  *
@@ -291,14 +625,34 @@ bool httpd_sess_pending(struct httpd_data *hd, struct sock_db *session);
  * max number of connections is reached, in which case the client which
  * is inactive for the longest will be removed from the session.
  *
+ * The session is taken from the head of the LRU list, skipping sessions
+ * held by async requests, and closed right away. Must be called from
+ * the thread of the loop.
+ *
  * @param[in] hd  Server instance data
  *
  * @return
- *  - ESP_OK    : if session closure initiated successfully
- *  - ESP_FAIL  : if failed
+ *  - ESP_OK    : if a session was closed
+ *  - ESP_FAIL  : if no session can be closed
  */
 esp_err_t httpd_sess_close_lru(struct httpd_data *hd);
 
+/**
+ * @brief   Asks another worker loop to close its least recently used
+ *          session, for a loop which has none to close itself
+ *
+ * The loops are asked in turn, one per call. The session is closed on
+ * the thread of the loop owning it, which wakes the other loops up to
+ * accept again if the server was full.
+ *
+ * @param[in] hd  Server instance data of the calling loop
+ *
+ * @return
+ *  - ESP_OK    : if another loop was asked
+ *  - ESP_FAIL  : if there is no other loop, or its work queue is full
+ */
+esp_err_t httpd_sess_close_lru_elsewhere(struct httpd_data *hd);
+
 /**
  * @brief   Closes all sessions
  *
@@ -384,6 +738,17 @@ bool httpd_validate_req_ptr(httpd_req_t *r);
  */
 esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd);
 
+/**
+ * @brief   Resets the request of the server loop for the next request or
+ *          WebSocket frame.
+ *
+ * @note    Only lengths and counters are reset, the buffers are not cleared
+ *          as their content is only read up to those.
+ *
+ * @param[in] hd  Server instance data
+ */
+void httpd_req_reset(struct httpd_data *hd);
+
 /**
  * @brief   For an HTTP request, resets the resources allocated for it and
  *          purges any data left to be received
@@ -432,6 +797,55 @@ esp_err_t httpd_req_handle_err(httpd_req_t *req, httpd_err_code_t error);
  */
 int httpd_send(httpd_req_t *req, const char *buf, size_t buf_len);
 
+/**
+ * @brief   Send data on a session, in order with the output queued on it.
+ *
+ * On the server thread, sends are tried without waiting and what the socket
+ * does not take is queued on the session, to be written by
+ * httpd_sess_flush() when the socket becomes writable. A send which would
+ * queue more than tx_queue_limit bytes waits for the client instead. From
+ * other threads, sends always wait.
+ *
+ * @param[in] session Session
+ * @param[in] iov     Pieces to send, updated as they go out
+ * @param[in] iovcnt  Number of pieces
+ * @param[in] flags   Flags for mode selection
+ *
+ * @return
+ *  - ESP_OK   : all the data was sent or queued
+ *  - ESP_FAIL : on socket error, or failing to queue the data
+ */
+esp_err_t httpd_sess_sendv(struct sock_db *session, httpd_iovec_t *iov, int iovcnt, int flags);
+
+/**
+ * @brief   Write the output queued on a session, as much as the socket
+ *          takes without waiting. Called when the socket is writable.
+ *
+ * Once everything is written, the session stops watching writability and
+ * drain_fn is called.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] session Session
+ *
+ * @return
+ *  - ESP_OK   : on progress, or nothing to do
+ *  - ESP_FAIL : on socket error, the session must be deleted
+ */
+esp_err_t httpd_sess_flush(struct httpd_data *hd, struct sock_db *session);
+
+/**
+ * @brief   Write all the output queued on a session, waiting for the
+ *          client as needed. Used before another thread takes the socket over.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] session Session
+ *
+ * @return
+ *  - ESP_OK   : nothing is queued anymore
+ *  - ESP_FAIL : on socket error
+ */
+esp_err_t httpd_sess_drain(struct httpd_data *hd, struct sock_db *session);
+
 /**
  * @brief   For receiving HTTP request data
  *
@@ -442,6 +856,10 @@ int httpd_send(httpd_req_t *req, const char *buf, size_t buf_len);
  *          completing a packet in case when all the remaining part of the packet is
  *          in the pending buffer.
  *
+ * @note    Reads shorter than CONFIG_HTTPD_RX_BUF_LEN are served from the session
+ *          receive buffer, which is refilled with a single receive of as much as
+ *          the socket holds. Data read ahead stays pending for the next call.
+ *
  * @param[in]  req    Pointer to new HTTP request which only has the socket descriptor
  * @param[out] buf    Pointer to the buffer which will be filled with the received data
  * @param[in] buf_len Length of the buffer
@@ -457,11 +875,11 @@ int httpd_recv_with_opt(httpd_req_t *r, char *buf, size_t buf_len, bool halt_aft
 /**
  * @brief   For un-receiving HTTP request data
  *
- * This function copies data into internal buffer pending_data so that
- * when httpd_recv is called, it first fetches this pending data and
- * then only starts receiving from the socket
+ * This function puts data back in front of the pending data in the
+ * session receive buffer so that when httpd_recv is called, it first
+ * fetches this pending data and then only starts receiving from the socket
  *
- * @note    If data is too large for the internal buffer then only
+ * @note    If the receive buffer cannot grow enough then only
  *          part of the data is unreceived, reflected in the returned
  *          length. Make sure that such truncation is checked for and
  *          handled properly.
@@ -491,6 +909,24 @@ size_t httpd_unrecv(struct httpd_req *r, const char *buf, size_t buf_len);
  */
 int httpd_default_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags);
 
+/**
+ * @brief   This is the low level default vectored send function of the HTTPD.
+ *          This should NEVER be called directly. The semantics of this is
+ *          similar to sendmsg() of the BSD socket API, sending at most
+ *          HTTPD_SENDV_MAX_IOV pieces per call.
+ *
+ * @param[in] hd      Server instance data
+ * @param[in] sockfd  Socket descriptor for sending data
+ * @param[in] iov     Pieces to send
+ * @param[in] iovcnt  Number of pieces
+ * @param[in] flags   Flags for mode selection
+ *
+ * @return
+ *  - Length of data : if successful
+ *  - -1             : if failed (appropriate errno is set)
+ */
+int httpd_default_sendv(httpd_handle_t hd, int sockfd, const httpd_iovec_t *iov, int iovcnt, int flags);
+
 /**
  * @brief   This is the low level default recv function of the HTTPD. This should
  *          NEVER be called directly. The semantics of this is exactly similar to
@@ -4,12 +4,17 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#if defined(__linux__) && !defined(ESP_PLATFORM) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* accept4() */
+#endif
+
 #include <string.h>
 #include <stdint.h>
 #include "port/events.h"
 #include "esp_httpd_priv.h"
 #include <malloc.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -20,6 +25,12 @@
     #include <netinet/tcp.h>
 #endif
 
+#if !defined(_WIN32) && !defined(ESP_PLATFORM)
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <limits.h>
+#endif
+
 #include <errno.h>
 
 #ifdef ESP_PLATFORM
@@ -38,22 +49,49 @@
 
 #include <log.h>
 
-#if defined(CONFIG_LWIP_MAX_SOCKETS)
-#define HTTPD_MAX_SOCKETS CONFIG_LWIP_MAX_SOCKETS
-#else
-/* LwIP component is not included into the build, use a default value */
-#define HTTPD_MAX_SOCKETS 15
-#endif
-#include "util/ctrl_sock.h"
-
 static const int DEFAULT_KEEP_ALIVE_IDLE = 5;
 static const int DEFAULT_KEEP_ALIVE_INTERVAL= 5;
 static const int DEFAULT_KEEP_ALIVE_COUNT= 3;
 
-typedef struct {
-    fd_set *fdset;
-    struct httpd_data *hd;
-} process_session_context_t;
+/* Time the server loop sleeps in the poller when nothing is ready */
+#define HTTPD_POLL_TIMEOUT_MS 100
+
+/* Upper bound of events fetched from the poller in one turn */
+#define HTTPD_POLL_MAX_EVENTS 64
+
+/* Upper bound of pipelined requests served back to back on one session
+ * before the other ready sessions get their turn */
+#define HTTPD_PIPELINE_MAX_REQS 8
+
+/* Several worker loops can only share the server port where the kernel
+ * balances connections between listeners bound with SO_REUSEPORT */
+#if defined(__linux__) && defined(SO_REUSEPORT) && !defined(ESP_PLATFORM)
+#define HTTPD_REUSEPORT 1
+#else
+#define HTTPD_REUSEPORT 0
+#endif
+
+/* Connections accepted per wakeup of the listening socket, which is then
+ * non-blocking. Only where accepted sockets do not inherit non-blocking
+ * mode from it, Windows accepts one connection per wakeup */
+#if defined(__linux__) || defined(ESP_PLATFORM)
+#define HTTPD_ACCEPT_BATCH 16
+#else
+#define HTTPD_ACCEPT_BATCH 1
+#endif
+
+/* Linux accepted sockets inherit the timeouts and keep-alive set on the
+ * listening socket, and accept4() marks them close-on-exec at once */
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+#define HTTPD_ACCEPT4 1
+#else
+#define HTTPD_ACCEPT4 0
+#endif
+
+/* Listen backlog when backlog_conn is 0, where the stack does not tell */
+#ifndef SOMAXCONN
+#define SOMAXCONN 16
+#endif
 
 static const char *TAG = "httpd";
 
@@ -67,59 +105,38 @@ void esp_http_server_dispatch_event(int32_t event_id, const void* event_data, si
     }
 }
 
-static esp_err_t httpd_accept_conn(struct httpd_data *hd, int listen_fd)
+/* Apply the configured timeouts and keep-alive to a socket. Set on the
+ * listening socket where accepted sockets inherit them */
+static esp_err_t httpd_sock_set_opts(struct httpd_data *hd, int fd)
 {
-    /* If no space is available for new session, close the least recently used one */
-    if (hd->config.lru_purge_enable == true) {
-        if (!httpd_is_sess_available(hd)) {
-            /* Queue asynchronous closure of the least recently used session */
-            return httpd_sess_close_lru(hd);
-            /* Returning from this allows the main server thread to process
-             * the queued asynchronous control message for closing LRU session.
-             * Since connection request hasn't been addressed yet using accept()
-             * therefore httpd_accept_conn() will be called again, but this time
-             * with space available for one session
-             */
-        }
-    }
-
-    struct sockaddr_storage addr_from;
-    socklen_t addr_from_len = sizeof(addr_from);
-    int new_fd = accept(listen_fd, (struct sockaddr *)&addr_from, &addr_from_len);
-    if (new_fd < 0) {
-        LOGE(TAG, LOG_FMT("error in accept (%d)"), errno);
-        return ESP_FAIL;
-    }
-    LOGD(TAG, LOG_FMT("newfd = %d"), new_fd);
-
 // #ifdef _WIN32
 //     DWORD timeout_ms = hd->config.recv_wait_timeout * 1000;
-//     if (setsockopt(new_fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout_ms, sizeof(timeout_ms)) < 0) {
+//     if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout_ms, sizeof(timeout_ms)) < 0) {
 //         LOGE(TAG, LOG_FMT("error in setsockopt SO_RCVTIMEO (%d)"), WSAGetLastError());
-//         goto exit;
+//         return ESP_FAIL;
 //     }
 
 //     timeout_ms = hd->config.send_wait_timeout * 1000;
-//     if (setsockopt(new_fd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout_ms, sizeof(timeout_ms)) < 0) {
+//     if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout_ms, sizeof(timeout_ms)) < 0) {
 //         LOGE(TAG, LOG_FMT("error in setsockopt SO_SNDTIMEO (%d)"), WSAGetLastError());
-//         goto exit;
+//         return ESP_FAIL;
 //     }
 // #else
     struct timeval tv;
     /* Set recv timeout of this fd as per config */
     tv.tv_sec = hd->config.recv_wait_timeout;
     tv.tv_usec = 0;
-    if (setsockopt(new_fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof(tv)) < 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof(tv)) < 0) {
         LOGE(TAG, LOG_FMT("error in setsockopt SO_RCVTIMEO (%d)"), errno);
-        goto exit;
+        return ESP_FAIL;
     }
 
     /* Set send timeout of this fd as per config */
     tv.tv_sec = hd->config.send_wait_timeout;
     tv.tv_usec = 0;
-    if (setsockopt(new_fd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv, sizeof(tv)) < 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv, sizeof(tv)) < 0) {
         LOGE(TAG, LOG_FMT("error in setsockopt SO_SNDTIMEO (%d)"), errno);
-        goto exit;
+        return ESP_FAIL;
     }
 // #endif
 
@@ -130,15 +147,15 @@ static esp_err_t httpd_accept_conn(struct httpd_data *hd, int listen_fd)
         int keep_alive_count = hd->config.keep_alive_count ? hd->config.keep_alive_count : DEFAULT_KEEP_ALIVE_COUNT;
         LOGD(TAG, "Enable TCP keep alive. idle: %d, interval: %d, count: %d", keep_alive_idle, keep_alive_interval, keep_alive_count);
 
-        if (setsockopt(new_fd, SOL_SOCKET, SO_KEEPALIVE, (char*)&keep_alive_enable, sizeof(keep_alive_enable)) < 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (char*)&keep_alive_enable, sizeof(keep_alive_enable)) < 0) {
             LOGE(TAG, LOG_FMT("error in setsockopt SO_KEEPALIVE (%d)"), errno);
-            goto exit;
+            return ESP_FAIL;
         }
 
 #ifdef __APPLE__
-        if (setsockopt(new_fd, IPPROTO_TCP, TCP_KEEPALIVE, &keep_alive_idle, sizeof(keep_alive_idle)) < 0) {
+        if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE, &keep_alive_idle, sizeof(keep_alive_idle)) < 0) {
                 LOGE(TAG, LOG_FMT("error in setsockopt TCP_KEEPALIVE (%d)"), errno);
-                goto exit;
+                return ESP_FAIL;
         }
 #elif _WIN32
         struct tcp_keepalive ka;
@@ -151,34 +168,107 @@ static esp_err_t httpd_accept_conn(struct httpd_data *hd, int listen_fd)
         ka.keepalivetime = keep_alive_idle * 1000;         // Idle time (in milliseconds)
         ka.keepaliveinterval = keep_alive_interval * 1000; // Interval time (in milliseconds)
 
-        if (WSAIoctl(new_fd, SIO_KEEPALIVE_VALS, &ka, sizeof(ka), 
+        if (WSAIoctl(fd, SIO_KEEPALIVE_VALS, &ka, sizeof(ka), 
                     NULL, 0, &dwBytes, NULL, NULL) == SOCKET_ERROR) 
         {
             // LOGE uses errno, but Winsock uses WSAGetLastError().
             // You'll need a wrapper to get the Windows error code.
             // For simplicity here, use a placeholder error reporting:
             LOGE(TAG, LOG_FMT("error in WSAIoctl SIO_KEEPALIVE_VALS (%d)"), WSAGetLastError());
-            goto exit;
+            return ESP_FAIL;
         }
 #else
-        if (setsockopt(new_fd, IPPROTO_TCP, TCP_KEEPIDLE, &keep_alive_idle, sizeof(keep_alive_idle)) < 0) {
+        if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &keep_alive_idle, sizeof(keep_alive_idle)) < 0) {
             LOGE(TAG, LOG_FMT("error in setsockopt TCP_KEEPIDLE (%d)"), errno);
-            goto exit;
+            return ESP_FAIL;
         }
-        if (setsockopt(new_fd, IPPROTO_TCP, TCP_KEEPINTVL, &keep_alive_interval, sizeof(keep_alive_interval)) < 0) {
+        if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &keep_alive_interval, sizeof(keep_alive_interval)) < 0) {
             LOGE(TAG, LOG_FMT("error in setsockopt TCP_KEEPINTVL (%d)"), errno);
-            goto exit;
+            return ESP_FAIL;
         }
-        if (setsockopt(new_fd, IPPROTO_TCP, TCP_KEEPCNT, &keep_alive_count, sizeof(keep_alive_count)) < 0) {
+        if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &keep_alive_count, sizeof(keep_alive_count)) < 0) {
             LOGE(TAG, LOG_FMT("error in setsockopt TCP_KEEPCNT (%d)"), errno);
-            goto exit;
+            return ESP_FAIL;
+        }
+#endif
+    }
+    return ESP_OK;
+}
+
+/* Count an accepted connection, and whether it made use of the
+ * listening socket options. Only costs system calls with listen_stats */
+static void httpd_count_accept(struct httpd_data *hd, int fd)
+{
+    httpd_os_atomic_add(&hd->accepted, 1);
+    if (!hd->config.listen_stats) {
+        return;
+    }
+#ifdef TCP_DEFER_ACCEPT
+    int pending = 0;
+    if (hd->listen_defer_accept && ioctl(fd, FIONREAD, &pending) == 0 && pending > 0) {
+        httpd_os_atomic_add(&hd->accepted_with_data, 1);
+    }
+#endif
+#if defined(TCP_FASTOPEN) && defined(TCPI_OPT_SYN_DATA)
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if (hd->listen_fastopen &&
+        getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0 &&
+        (info.tcpi_options & TCPI_OPT_SYN_DATA)) {
+        httpd_os_atomic_add(&hd->fastopen_accepted, 1);
+    }
+#endif
+}
+
+/* Accept one connection waiting on the listening socket. A session is
+ * only evicted for it when the poller reported a connection waiting.
+ * Returns ESP_ERR_NOT_FOUND once nothing more can be accepted during
+ * this wakeup, ESP_FAIL if the connection was accepted and dropped */
+static esp_err_t httpd_accept_conn(struct httpd_data *hd, int listen_fd, bool waiting)
+{
+    /* If no space is available for new session, close the least recently used one */
+    if (hd->config.lru_purge_enable == true && waiting) {
+        if (!httpd_is_sess_available(hd)) {
+            /* The closure happens right here, so that the connection
+             * request can be accepted without another loop round-trip.
+             * If every session is held by an async request, or the
+             * other loops hold them, the connection stays queued until
+             * one is released. Another loop is asked to close one, and
+             * the listen socket is not watched in the meantime, it would
+             * report the connection over and over */
+            if (httpd_sess_close_lru(hd) != ESP_OK) {
+                httpd_sess_close_lru_elsewhere(hd);
+                hd->lru_stalled = true;
+                return ESP_ERR_NOT_FOUND;
+            }
         }
+    } else if (!httpd_is_sess_available(hd)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    struct sockaddr_storage addr_from;
+    socklen_t addr_from_len = sizeof(addr_from);
+#if HTTPD_ACCEPT4
+    int new_fd = accept4(listen_fd, (struct sockaddr *)&addr_from, &addr_from_len, SOCK_CLOEXEC);
+#else
+    int new_fd = accept(listen_fd, (struct sockaddr *)&addr_from, &addr_from_len);
 #endif
+    if (new_fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOGE(TAG, LOG_FMT("error in accept (%d)"), errno);
+        }
+        return ESP_ERR_NOT_FOUND;
+    }
+    LOGD(TAG, LOG_FMT("newfd = %d"), new_fd);
+
+    if (!hd->listen_opts_inherited && httpd_sock_set_opts(hd, new_fd) != ESP_OK) {
+        goto exit;
     }
     if (ESP_OK != httpd_sess_new(hd, new_fd)) {
         LOGE(TAG, LOG_FMT("session creation failed"));
         goto exit;
     }
+    httpd_count_accept(hd, new_fd);
     LOGD(TAG, LOG_FMT("complete"));
     esp_http_server_dispatch_event(HTTP_SERVER_EVENT_ON_CONNECTED, &new_fd, sizeof(int));
     return ESP_OK;
@@ -187,15 +277,6 @@ exit:
     return ESP_FAIL;
 }
 
-struct httpd_ctrl_data {
-    enum httpd_ctrl_msg {
-        HTTPD_CTRL_SHUTDOWN,
-        HTTPD_CTRL_WORK,
-    } hc_msg;
-    httpd_work_fn_t hc_work;
-    void *hc_work_arg;
-};
-
 esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg)
 {
     if (handle == NULL || work == NULL) {
@@ -203,29 +284,132 @@ esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *ar
     }
 
     struct httpd_data *hd = (struct httpd_data *) handle;
-    struct httpd_ctrl_data msg = {0};
-    memset(&msg, 0, sizeof(struct httpd_ctrl_data));
-        msg.hc_msg = HTTPD_CTRL_WORK;
-        msg.hc_work = work;
-        msg.hc_work_arg = arg;
 #if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
     // Semaphore is acquired here and released after work function is executed.
-    if (xSemaphoreTake(hd->ctrl_sock_semaphore, portMAX_DELAY) == pdTRUE) {
+    if (xSemaphoreTake(hd->ctrl_sock_semaphore, portMAX_DELAY) != pdTRUE) {
+        LOGE(TAG, "Unable to acquire semaphore");
+        return ESP_FAIL;
+    }
 #endif
-        int ret = cs_send_to_ctrl_sock(hd->msg_fd, hd->config.ctrl_port, &msg, sizeof(msg));
-        if (ret < 0) {
-            LOGW(TAG, LOG_FMT("failed to queue work"));
+    esp_err_t ret = httpd_work_queue_push(hd->work_queue, work, arg);
+    if (ret != ESP_OK) {
+        LOGW(TAG, LOG_FMT("failed to queue work"));
 #if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
-            xSemaphoreGive(hd->ctrl_sock_semaphore);
+        xSemaphoreGive(hd->ctrl_sock_semaphore);
 #endif
-            return ESP_FAIL;
+        return ESP_ERR_HTTPD_QUEUE_FULL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_queue_work_batch(httpd_handle_t handle, const httpd_work_t *works, size_t count, size_t *queued)
+{
+    if (queued) {
+        *queued = 0;
+    }
+    if (handle == NULL || (works == NULL && count)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (works[i].fn == NULL) {
+            return ESP_ERR_INVALID_ARG;
         }
-        return ESP_OK;
-#if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
     }
-    LOGE(TAG, "Unable to acquire semaphore");
-    return ESP_FAIL;
+
+    struct httpd_data *hd = (struct httpd_data *) handle;
+    esp_err_t ret = ESP_OK;
+    size_t i;
+    for (i = 0; i < count; i++) {
+#if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
+        if (xSemaphoreTake(hd->ctrl_sock_semaphore, 0) != pdTRUE) {
+            // Let the server run the works queued so far to make room
+            if (i && httpd_work_queue_notify(hd->work_queue) != ESP_OK) {
+                ret = ESP_FAIL;
+                break;
+            }
+            if (xSemaphoreTake(hd->ctrl_sock_semaphore, portMAX_DELAY) != pdTRUE) {
+                LOGE(TAG, "Unable to acquire semaphore");
+                ret = ESP_FAIL;
+                break;
+            }
+        }
+#endif
+        if (httpd_work_queue_enqueue(hd->work_queue, works[i].fn, works[i].arg) != ESP_OK) {
+#if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
+            xSemaphoreGive(hd->ctrl_sock_semaphore);
 #endif
+            ret = ESP_ERR_HTTPD_QUEUE_FULL;
+            break;
+        }
+    }
+    if (queued) {
+        *queued = i;
+    }
+    // The works are queued either way, the next work queued rings again
+    if (i && httpd_work_queue_notify(hd->work_queue) != ESP_OK) {
+        LOGW(TAG, LOG_FMT("failed to wake up the server"));
+    }
+    if (ret != ESP_OK) {
+        LOGW(TAG, LOG_FMT("queued %"NEWLIB_NANO_COMPAT_FORMAT" of %"NEWLIB_NANO_COMPAT_FORMAT" works"),
+             NEWLIB_NANO_COMPAT_CAST(i), NEWLIB_NANO_COMPAT_CAST(count));
+    }
+    return ret;
+}
+
+esp_err_t httpd_queue_work_depth(httpd_handle_t handle, size_t *depth, size_t *capacity)
+{
+    if (handle == NULL || depth == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct httpd_data *hd = (struct httpd_data *) handle;
+    *depth = httpd_work_queue_depth(hd->work_queue);
+    if (capacity) {
+        *capacity = httpd_work_queue_capacity(hd->work_queue);
+    }
+    return ESP_OK;
+}
+
+typedef struct {
+    size_t max_fds;
+    size_t *fds;
+    int *client_fds;
+    esp_err_t ret;
+} client_list_context_t;
+
+static int httpd_list_client(struct sock_db *session, void *context)
+{
+    client_list_context_t *ctx = (client_list_context_t *) context;
+    if (session->fd == -1) {
+        return 1;
+    }
+    if (*ctx->fds >= ctx->max_fds) {
+        ctx->ret = ESP_ERR_INVALID_ARG;
+        return 0;
+    }
+    ctx->client_fds[(*ctx->fds)++] = session->fd;
+    return 1;
+}
+
+esp_err_t httpd_get_listen_stats(httpd_handle_t handle, httpd_listen_stats_t *stats)
+{
+    if (handle == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct httpd_data *hd = ((struct httpd_data *) handle)->primary;
+    memset(stats, 0, sizeof(*stats));
+    stats->backlog = hd->config.backlog_conn;
+    stats->defer_accept = hd->listen_defer_accept;
+    stats->fastopen = hd->listen_fastopen;
+    int count = hd->workers ? hd->worker_count : 1;
+    for (int i = 0; i < count; i++) {
+        struct httpd_data *worker = hd->workers ? hd->workers[i] : hd;
+        stats->accepted += httpd_os_atomic_load(&worker->accepted);
+        stats->accepted_with_data += httpd_os_atomic_load(&worker->accepted_with_data);
+        stats->fastopen_accepted += httpd_os_atomic_load(&worker->fastopen_accepted);
+    }
+    return ESP_OK;
 }
 
 esp_err_t httpd_get_client_list(httpd_handle_t handle, size_t *fds, int *client_fds)
@@ -234,18 +418,22 @@ esp_err_t httpd_get_client_list(httpd_handle_t handle, size_t *fds, int *client_
     if (hd == NULL || fds == NULL || *fds == 0 || client_fds == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
-    size_t max_fds = *fds;
+    client_list_context_t context = {
+        .max_fds = *fds,
+        .fds = fds,
+        .client_fds = client_fds,
+        .ret = ESP_OK
+    };
     *fds = 0;
-    for (int i = 0; i < hd->config.max_open_sockets; ++i) {
-        if (hd->hd_sd[i].fd != -1) {
-            if (*fds < max_fds) {
-                client_fds[(*fds)++] = hd->hd_sd[i].fd;
-            } else {
-                return ESP_ERR_INVALID_ARG;
-            }
-        }
+    struct httpd_data *primary = hd->primary ? hd->primary : hd;
+    if (!primary->workers) {
+        httpd_sess_enum_open(hd, httpd_list_client, &context);
+        return context.ret;
     }
-    return ESP_OK;
+    for (int i = 0; i < primary->worker_count && context.ret == ESP_OK; i++) {
+        httpd_sess_enum_open(primary->workers[i], httpd_list_client, &context);
+    }
+    return context.ret;
 }
 
 void *httpd_get_global_user_ctx(httpd_handle_t handle)
@@ -261,115 +449,139 @@ void *httpd_get_global_transport_ctx(httpd_handle_t handle)
 
 static void httpd_process_ctrl_msg(struct httpd_data *hd)
 {
-    struct httpd_ctrl_data msg;
-    int ret = recv(hd->ctrl_fd, (char*)&msg, sizeof(msg), 0);
-    if (ret <= 0) {
-        LOGW(TAG, LOG_FMT("error in recv (%d)"), errno);
+    int run = httpd_work_queue_run(hd->work_queue);
+    LOGD(TAG, LOG_FMT("ran %d work items"), run);
 #if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
+    while (run-- > 0) {
         xSemaphoreGive(hd->ctrl_sock_semaphore);
-#endif
-        return;
     }
-    if (ret != sizeof(msg)) {
-        LOGW(TAG, LOG_FMT("incomplete msg"));
-#if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
-        xSemaphoreGive(hd->ctrl_sock_semaphore);
-#endif
-        return;
-    }
-
-    switch (msg.hc_msg) {
-    case HTTPD_CTRL_WORK:
-        if (msg.hc_work) {
-            LOGD(TAG, LOG_FMT("work"));
-            (*msg.hc_work)(msg.hc_work_arg);
-        }
-        break;
-    case HTTPD_CTRL_SHUTDOWN:
-        LOGD(TAG, LOG_FMT("shutdown"));
-        hd->hd_td.status = THREAD_STOPPING;
-        break;
-    default:
-        break;
-    }
-#if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
-    xSemaphoreGive(hd->ctrl_sock_semaphore);
+#else
+    (void) run;
 #endif
 }
 
-// Called for each session from httpd_server
-static int httpd_process_session(struct sock_db *session, void *context)
+/* Queued by httpd_shutdown, runs on the loop being stopped */
+static void httpd_stop_work(void *arg)
 {
-    if ((!session) || (!context)) {
-        return 0;
-    }
-
-    if (session->fd < 0) {
-        return 1;
-    }
+    struct httpd_data *hd = (struct httpd_data *) arg;
+    LOGD(TAG, LOG_FMT("shutdown"));
+    hd->hd_td.status = THREAD_STOPPING;
+}
 
-    // session is busy in an async task, do not process here.
-    if (session->for_async_req) {
-        return 1;
-    }
+/* Process the sessions on the ready list. Sessions which still have input
+ * afterwards are queued again at the tail, but only the sessions which were
+ * queued when this started are visited, so that one busy client cannot
+ * starve the control socket or the listener. */
+static void httpd_process_ready_sessions(struct httpd_data *hd)
+{
+    int budget = hd->ready_count;
+    while (budget-- > 0 && hd->ready_head) {
+        struct sock_db *session = hd->ready_head;
+        httpd_sess_clear_ready(hd, session);
+
+        // session is busy in an async task, do not process here.
+        if (session->fd < 0 || session->for_async_req) {
+            continue;
+        }
 
-    process_session_context_t *ctx = (process_session_context_t *)context;
-    int fd = session->fd;
+        LOGD(TAG, LOG_FMT("processing socket %d"), session->fd);
+        esp_err_t ret;
+        int served = 0;
+        do {
+            ret = httpd_sess_process(hd, session);
+            /* Data left in the receive buffer after a complete request
+             * belongs to the next, pipelined, request */
+        } while (ret == ESP_OK && ++served < HTTPD_PIPELINE_MAX_REQS &&
+                 session->pending_len && !session->parse_state && !session->for_async_req);
+        if (ret != ESP_OK) {
+            // Output still queued goes out before the connection is closed
+            if (!httpd_sess_linger(hd, session)) {
+                httpd_sess_delete(hd, session); // Delete session
+            }
+            continue;
+        }
 
-    if (FD_ISSET(fd, ctx->fdset) || httpd_sess_pending(ctx->hd, session)) {
-        LOGD(TAG, LOG_FMT("processing socket %d"), fd);
-        if (httpd_sess_process(ctx->hd, session) != ESP_OK) {
-            httpd_sess_delete(ctx->hd, session); // Delete session
+        if (session->for_async_req) {
+            // handed over to an async handler, which resumes it when done
+            httpd_sess_suspend(hd, session);
+        } else if (httpd_sess_has_input(hd, session)) {
+            httpd_sess_set_ready(hd, session);
         }
     }
-    return 1;
 }
 
 /* Manage in-coming connection or data requests */
 static esp_err_t httpd_server(struct httpd_data *hd)
 {
-    fd_set read_set;
-    FD_ZERO(&read_set);
-    struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 }; // 100 ms timeout
-    if (hd->config.lru_purge_enable || httpd_is_sess_available(hd)) {
-        /* Only listen for new connections if server has capacity to
-         * handle more (or when LRU purge is enabled, in which case
-         * older connections will be closed) */
-        FD_SET(hd->listen_fd, &read_set);
-    }
-    FD_SET(hd->ctrl_fd, &read_set);
-
-    int tmp_max_fd;
-    httpd_sess_set_descriptors(hd, &read_set, &tmp_max_fd);
-    int maxfd = MAX(hd->listen_fd, tmp_max_fd);
-    tmp_max_fd = maxfd;
-    maxfd = MAX(hd->ctrl_fd, tmp_max_fd);
-
-    LOGD(TAG, LOG_FMT("doing select maxfd+1 = %d"), maxfd + 1);
-    // int active_cnt = select(maxfd + 1, &read_set, NULL, NULL, NULL);
-    int active_cnt = select(maxfd + 1, &read_set, NULL, NULL, &timeout);
+    /* Only listen for new connections if server has capacity to
+     * handle more (or when LRU purge is enabled, in which case
+     * older connections will be closed). The capacity is shared by
+     * all the worker loops, a loop closing a session while the server
+     * is full wakes the others up to listen again. A loop which found
+     * no session to close sits out one poll wait before trying again */
+    bool accept_conn = (hd->config.lru_purge_enable && !hd->lru_stalled) ||
+                       (httpd_os_atomic_load(&hd->primary->sess_open) < hd->config.max_open_sockets);
+    if (accept_conn != hd->listen_armed) {
+        httpd_poll_mod(hd->poller, hd->listen_fd, accept_conn ? HTTPD_POLL_IN : 0, &hd->listen_fd);
+        hd->listen_armed = accept_conn;
+    }
+
+    /* Don't sleep if sessions are still waiting to be processed */
+    int timeout_ms = hd->ready_head ? 0 : HTTPD_POLL_TIMEOUT_MS;
+    int active_cnt = httpd_poll_wait(hd->poller, hd->poll_events, hd->poll_max_events, timeout_ms);
+    hd->lru_stalled = false;
     if (active_cnt < 0) {
-        LOGE(TAG, LOG_FMT("error in select (%d)"), errno);
+        if (errno == EINTR) {
+            return ESP_OK;
+        }
+        LOGE(TAG, LOG_FMT("error in poll (%d)"), errno);
         httpd_sess_delete_invalid(hd);
-        // If select fails with EBADF, it's a critical error.
+        // If polling fails with EBADF, it's a critical error.
         // Returning ESP_FAIL will cause the httpd_thread to exit.
         if (errno == EBADF) {
             // Invalidate listen_fd as well, as it could also be the source of EBADF
             hd->listen_fd = -1;
             return ESP_FAIL;
         }
-        return ESP_OK; // For other non-critical select errors, continue.
+        return ESP_OK; // For other non-critical errors, continue.
     }
 
+    bool ctrl_ready = false;
+    bool listen_ready = false;
+    for (int i = 0; i < active_cnt; i++) {
+        void *data = hd->poll_events[i].data;
+        if (data == &hd->ctrl_fd) {
+            ctrl_ready = true;
+        } else if (data == &hd->listen_fd) {
+            listen_ready = true;
+        } else {
+            struct sock_db *session = (struct sock_db *) data;
+            uint32_t events = hd->poll_events[i].events;
+            // Queued output goes out first, failing or finishing
+            // a lingering close ends the session
+            if (session->tx_len && httpd_sess_flush(hd, session) != ESP_OK) {
+                httpd_sess_delete(hd, session);
+                continue;
+            }
+            if ((events & (HTTPD_POLL_IN | HTTPD_POLL_ERR)) && !session->tx_close) {
+                httpd_sess_set_ready(hd, session);
+            }
+        }
+    }
+
+    /* Idle connections and stalled requests are dropped before
+     * serving the others */
+    httpd_sess_expire(hd);
+
     /* Case0: Do we have a control message? */
-    if (FD_ISSET(hd->ctrl_fd, &read_set)) {
+    if (ctrl_ready) {
         LOGD(TAG, LOG_FMT("processing ctrl message"));
         httpd_process_ctrl_msg(hd);
         if (hd->hd_td.status == THREAD_STOPPING) {
             LOGD(TAG, LOG_FMT("stopping thread"));
-            // Invalidate ctrl_fd immediately to prevent further select errors
+            // Invalidate ctrl_fd immediately to prevent further poll errors
             // during thread shutdown sequence.
-            cs_free_ctrl_sock(hd->ctrl_fd);
+            httpd_poll_del(hd->poller, hd->ctrl_fd);
             hd->ctrl_fd = -1;
             return ESP_FAIL;
         }
@@ -377,18 +589,22 @@ static esp_err_t httpd_server(struct httpd_data *hd)
 
     /* Case1: Do we have any activity on the current data
      * sessions? */
-    process_session_context_t context = {
-        .fdset = &read_set,
-        .hd = hd
-    };
-    httpd_sess_enum(hd, httpd_process_session, &context);
+    httpd_process_ready_sessions(hd);
 
     /* Case2: Do we have any incoming connection requests to
      * process? */
-    if (FD_ISSET(hd->listen_fd, &read_set)) {
+    if (listen_ready) {
         LOGD(TAG, LOG_FMT("processing listen socket %d"), hd->listen_fd);
-        if (httpd_accept_conn(hd, hd->listen_fd) != ESP_OK) {
-            LOGW(TAG, LOG_FMT("error accepting new connection"));
+        /* Drain the backlog, bounded so that a connection storm does not
+         * hold up the sessions */
+        for (int i = 0; i < HTTPD_ACCEPT_BATCH; i++) {
+            esp_err_t ret = httpd_accept_conn(hd, hd->listen_fd, i == 0);
+            if (ret == ESP_ERR_NOT_FOUND) {
+                break;
+            }
+            if (ret != ESP_OK) {
+                LOGW(TAG, LOG_FMT("error accepting new connection"));
+            }
         }
     }
     return ESP_OK;
@@ -410,11 +626,10 @@ static void httpd_thread(void *arg)
     }
 
     LOGD(TAG, LOG_FMT("web server exiting"));
-    close(hd->msg_fd);
-    LOGD(TAG, LOG_FMT("free control socket"));
-    // cs_free_ctrl_sock(hd->ctrl_fd);
     LOGD(TAG, LOG_FMT("close sessions"));
     httpd_sess_close_all(hd);
+    httpd_poll_destroy(hd->poller);
+    hd->poller = NULL;
     LOGD(TAG, LOG_FMT("close listen socket"));
     close(hd->listen_fd);
     hd->hd_td.status = THREAD_STOPPED;
@@ -457,6 +672,38 @@ static esp_err_t httpd_server_init(struct httpd_data *hd)
          * it does not affect the normal working of the HTTP Server */
         LOGW(TAG, LOG_FMT("error in setsockopt SO_REUSEADDR (%d)"), errno);
     }
+#if HTTPD_REUSEPORT
+    /* Every worker loop binds its own listening socket to the server
+     * port, the kernel spreads new connections between them */
+    if (hd->config.worker_threads > 1 &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char*)&enable, sizeof(enable)) < 0) {
+        LOGE(TAG, LOG_FMT("error in setsockopt SO_REUSEPORT (%d)"), errno);
+        close(fd);
+        return ESP_FAIL;
+    }
+#endif
+
+#ifdef TCP_DEFER_ACCEPT
+    /* Only wake up for connections with a request to serve */
+    if (hd->config.defer_accept_timeout) {
+        int timeout = hd->config.defer_accept_timeout;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &timeout, sizeof(timeout)) < 0) {
+            LOGW(TAG, LOG_FMT("error in setsockopt TCP_DEFER_ACCEPT (%d)"), errno);
+        } else {
+            hd->listen_defer_accept = true;
+        }
+    }
+#endif
+#ifdef TCP_FASTOPEN
+    if (hd->config.fastopen_queue_len) {
+        int qlen = hd->config.fastopen_queue_len;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) < 0) {
+            LOGW(TAG, LOG_FMT("error in setsockopt TCP_FASTOPEN (%d)"), errno);
+        } else {
+            hd->listen_fastopen = true;
+        }
+    }
+#endif
 
     int ret = bind(fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
     if (ret < 0) {
@@ -498,129 +745,210 @@ static esp_err_t httpd_server_init(struct httpd_data *hd)
         return ESP_FAIL;
     }
 
-    int ctrl_fd = cs_create_ctrl_sock(hd->config.ctrl_port);
-    if (ctrl_fd < 0) {
-        LOGE(TAG, LOG_FMT("error in creating ctrl socket (%d) for port %d"), errno, hd->config.ctrl_port);
+#if HTTPD_ACCEPT_BATCH > 1
+    /* Let the accept loop stop once the backlog is drained */
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        LOGE(TAG, LOG_FMT("error in fcntl O_NONBLOCK (%d)"), errno);
         close(fd);
         return ESP_FAIL;
     }
+#endif
+#if HTTPD_ACCEPT4
+    /* Set once here instead of on every accepted socket */
+    hd->listen_opts_inherited = (httpd_sock_set_opts(hd, fd) == ESP_OK);
+#endif
 
-    int msg_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (msg_fd < 0) {
-        LOGE(TAG, LOG_FMT("error in creating msg socket (%d)"), errno);
+    if (httpd_work_queue_create(&hd->work_queue, hd->config.work_queue_len, hd->config.ctrl_port) != ESP_OK) {
+        LOGE(TAG, LOG_FMT("error in creating work queue for port %d"), hd->config.ctrl_port);
+        close(fd);
+        return ESP_FAIL;
+    }
+    int ctrl_fd = httpd_work_queue_fd(hd->work_queue);
+
+    /* Listening and control sockets are level triggered, sessions are
+     * added as they get accepted */
+    hd->poll_max_events = MIN(hd->config.max_open_sockets + 2, HTTPD_POLL_MAX_EVENTS);
+    hd->poll_events = calloc(hd->poll_max_events, sizeof(httpd_poll_event_t));
+    if (!hd->poll_events ||
+        httpd_poll_create(&hd->poller, hd->config.max_open_sockets + 2) != ESP_OK ||
+        httpd_poll_add(hd->poller, fd, HTTPD_POLL_IN, &hd->listen_fd) != ESP_OK ||
+        httpd_poll_add(hd->poller, ctrl_fd, HTTPD_POLL_IN, &hd->ctrl_fd) != ESP_OK) {
+        LOGE(TAG, LOG_FMT("error in creating poller"));
+        httpd_poll_destroy(hd->poller);
+        hd->poller = NULL;
         close(fd);
-        close(ctrl_fd);
+        httpd_work_queue_destroy(hd->work_queue);
+        hd->work_queue = NULL;
         return ESP_FAIL;
     }
 
     hd->listen_fd = fd;
     hd->ctrl_fd = ctrl_fd;
-    hd->msg_fd  = msg_fd;
+    hd->listen_armed = true;
     return ESP_OK;
 }
 
-static struct httpd_data *httpd_create(const httpd_config_t *config)
+static void httpd_delete(struct httpd_data *hd);
+
+/* Allocate a worker loop. The first loop (primary == NULL) owns the URI
+ * and error handlers, the other ones share them with it */
+static struct httpd_data *httpd_create(const httpd_config_t *config, struct httpd_data *primary)
 {
     /* Allocate memory for httpd instance data */
     struct httpd_data *hd = calloc(1, sizeof(struct httpd_data));
-    memset(hd, 0, sizeof(struct httpd_data));
     if (!hd) {
         LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP server instance"));
         return NULL;
     }
-    hd->hd_calls = calloc(config->max_uri_handlers, sizeof(httpd_uri_t *));
-    if (!hd->hd_calls) {
-        LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP URI handlers"));
-        free(hd);
-        return NULL;
+    /* Save the configuration for this instance */
+    hd->config = *config;
+    hd->primary = primary ? primary : hd;
+    if (primary) {
+        hd->hd_calls = primary->hd_calls;
+        hd->err_handler_fns = primary->err_handler_fns;
+    } else {
+        hd->hd_calls = calloc(config->max_uri_handlers, sizeof(httpd_uri_t *));
+        if (!hd->hd_calls) {
+            LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP URI handlers"));
+            httpd_delete(hd);
+            return NULL;
+        }
+        hd->err_handler_fns = calloc(HTTPD_ERR_CODE_MAX, sizeof(httpd_err_handler_func_t));
+        if (!hd->err_handler_fns) {
+            LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP error handlers"));
+            httpd_delete(hd);
+            return NULL;
+        }
     }
-    hd->hd_sd = calloc(config->max_open_sockets, sizeof(struct sock_db));
+    /* Only the chunk directory is allocated here, session slots are
+     * allocated as connections come in */
+    hd->hd_sd = calloc((config->max_open_sockets + HTTPD_SESS_CHUNK_SLOTS - 1) / HTTPD_SESS_CHUNK_SLOTS,
+                       sizeof(struct sock_db *));
     if (!hd->hd_sd) {
         LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP session data"));
-        free(hd->hd_calls);
-        free(hd);
+        httpd_delete(hd);
+        return NULL;
+    }
+    httpd_timer_wheel_init(&hd->timers, httpd_os_time_ms());
+    /* The descriptor map is kept at most half full */
+    hd->hd_fd_map_bits = 1;
+    while ((1 << hd->hd_fd_map_bits) < 2 * config->max_open_sockets) {
+        hd->hd_fd_map_bits++;
+    }
+    hd->hd_fd_map = calloc(1 << hd->hd_fd_map_bits, sizeof(struct sock_db *));
+    if (!hd->hd_fd_map) {
+        LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP session map"));
+        httpd_delete(hd);
+        return NULL;
+    }
+    if (httpd_os_mutex_init(&hd->hd_fd_map_lock) != OS_SUCCESS) {
+        LOGE(TAG, LOG_FMT("Failed to create HTTP session map lock"));
+        httpd_delete(hd);
         return NULL;
     }
+    hd->hd_fd_map_lock_init = true;
     struct httpd_req_aux *ra = &hd->hd_req_aux;
     ra->resp_hdrs = calloc(config->max_resp_headers, sizeof(struct resp_hdr));
     if (!ra->resp_hdrs) {
         LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP response headers"));
-        free(hd->hd_sd);
-        free(hd->hd_calls);
-        free(hd);
+        httpd_delete(hd);
         return NULL;
     }
-    hd->err_handler_fns = calloc(HTTPD_ERR_CODE_MAX, sizeof(httpd_err_handler_func_t));
-    if (!hd->err_handler_fns) {
-        LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP error handlers"));
-        free(ra->resp_hdrs);
-        free(hd->hd_sd);
-        free(hd->hd_calls);
-        free(hd);
+    ra->scratch = malloc(HTTPD_SCRATCH_INIT_LEN + 1);
+    ra->uri = malloc(HTTPD_URI_INIT_LEN + 1);
+    if (!ra->scratch || !ra->uri) {
+        LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP request buffers"));
+        httpd_delete(hd);
         return NULL;
     }
-    /* Save the configuration for this instance */
-    hd->config = *config;
+    ra->scratch_size = HTTPD_SCRATCH_INIT_LEN;
+    ra->uri_size = HTTPD_URI_INIT_LEN;
     return hd;
 }
 
+/* Free a worker loop. Deleting the primary also deletes the other loops
+ * and the handlers they share */
 static void httpd_delete(struct httpd_data *hd)
 {
+    if (hd->primary == hd && hd->workers) {
+        for (int i = 1; i < hd->worker_count; i++) {
+            httpd_delete(hd->workers[i]);
+        }
+        free(hd->workers);
+    }
+
     struct httpd_req_aux *ra = &hd->hd_req_aux;
     /* Free memory of httpd instance data */
-    free(hd->err_handler_fns);
     free(ra->resp_hdrs);
+    free(ra->scratch);
+    free(ra->uri);
+    for (int i = 0; i < hd->hd_sd_capacity; i += HTTPD_SESS_CHUNK_SLOTS) {
+        free(hd->hd_sd[i / HTTPD_SESS_CHUNK_SLOTS]);
+    }
     free(hd->hd_sd);
+    free(hd->hd_fd_map);
+    if (hd->hd_fd_map_lock_init) {
+        httpd_os_mutex_delete(&hd->hd_fd_map_lock);
+    }
+    httpd_poll_destroy(hd->poller);
+    free(hd->poll_events);
+    httpd_work_queue_destroy(hd->work_queue);
+#if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
+    if (hd->ctrl_sock_semaphore) {
+        vSemaphoreDelete(hd->ctrl_sock_semaphore);
+    }
+#endif
 
-    /* Free registered URI handlers */
-    httpd_unregister_all_uri_handlers(hd);
-    free(hd->hd_calls);
+    if (hd->primary == hd) {
+        free(hd->err_handler_fns);
+        /* Free registered URI handlers */
+        if (hd->hd_calls) {
+            httpd_unregister_all_uri_handlers(hd);
+            free(hd->hd_calls);
+        }
+    }
     free(hd);
 }
 
-esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+/* Number of sockets the server may have open at the same time */
+static int httpd_max_sockets(void)
 {
-    if (handle == NULL || config == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    /* Sanity check about whether LWIP is configured for providing the
-     * maximum number of open sockets sufficient for the server. Though,
-     * this check doesn't guarantee that many sockets will actually be
-     * available at runtime as other processes may use up some sockets.
-     * Note that server also uses 3 sockets for its internal use :
-     *     1) listening for new TCP connections
-     *     2) for sending control messages over UDP
-     *     3) for receiving control messages over UDP
-     * So the total number of required sockets is max_open_sockets + 3
-     */
-    if (HTTPD_MAX_SOCKETS < config->max_open_sockets + 3) {
-        LOGE(TAG, "Config option max_open_sockets is too large (max allowed %d, 3 sockets used by HTTP server internally)\n\t"
-                 "Either decrease this or configure LWIP_MAX_SOCKETS to a larger value",
-                 HTTPD_MAX_SOCKETS - 3);
-        return ESP_ERR_INVALID_ARG;
+#if defined(CONFIG_LWIP_MAX_SOCKETS)
+    return CONFIG_LWIP_MAX_SOCKETS;
+#elif defined(_WIN32)
+    /* Winsock fd_set holds at most FD_SETSIZE sockets */
+    return FD_SETSIZE;
+#else
+    /* Bounded by the descriptor limit of the process */
+    int max_sockets = INT_MAX;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < INT_MAX) {
+        max_sockets = (int) rl.rlim_cur;
     }
+#if !HTTPD_POLL_EPOLL
+    /* select() cannot watch descriptors beyond FD_SETSIZE */
+    max_sockets = MIN(max_sockets, FD_SETSIZE);
+#endif
+    return max_sockets;
+#endif
+}
 
-    struct httpd_data *hd = httpd_create(config);
-    if (hd == NULL) {
-        /* Failed to allocate memory */
-        return ESP_ERR_HTTPD_ALLOC_MEM;
-    }
+/* Create the sockets of a worker loop and launch its thread */
+static esp_err_t httpd_launch(struct httpd_data *hd)
+{
 #if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
-    /* Using a Counting Semaphore with count equals CONFIG_LWIP_UDP_RECVMBOX_SIZE
-     * as the number of UDP messages which can be stored is equal to UDP mailbox size.
-     * Using this, we can make sure that the work function is always received by the ctrl socket.
+    /* Using a Counting Semaphore with count equals the length of the work queue,
+     * so that a work item is never dropped because the queue is full.
      */
-    hd->ctrl_sock_semaphore = xSemaphoreCreateCounting(CONFIG_LWIP_UDP_RECVMBOX_SIZE, CONFIG_LWIP_UDP_RECVMBOX_SIZE);
+    hd->ctrl_sock_semaphore = xSemaphoreCreateCounting(hd->config.work_queue_len, hd->config.work_queue_len);
     if (hd->ctrl_sock_semaphore == NULL) {
         LOGE(TAG, "Failed to create Semaphore");
-        httpd_delete(hd);
         return ESP_ERR_HTTPD_ALLOC_MEM;
     }
 #endif
 
     if (httpd_server_init(hd) != ESP_OK) {
-        httpd_delete(hd);
         return ESP_FAIL;
     }
 
@@ -632,9 +960,125 @@ esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
                                hd->config.core_id,
                                hd->config.task_caps) != ESP_OK) {
         /* Failed to launch task */
-        httpd_delete(hd);
         return ESP_ERR_HTTPD_TASK;
     }
+    return ESP_OK;
+}
+
+/* Ask worker loops to shut down and wait for all their threads to exit */
+static esp_err_t httpd_shutdown(struct httpd_data **loops, int count)
+{
+    for (int i = 0; i < count; i++) {
+        esp_err_t ret;
+        while ((ret = httpd_queue_work(loops[i], httpd_stop_work, loops[i])) == ESP_ERR_HTTPD_QUEUE_FULL) {
+            httpd_os_thread_sleep(10);
+        }
+        if (ret != ESP_OK) {
+            LOGE(TAG, "Failed to send shutdown signal err=%d", ret);
+            return ESP_FAIL;
+        }
+    }
+
+    LOGD(TAG, LOG_FMT("sent control msg to stop server"));
+    for (int i = 0; i < count; i++) {
+        while (loops[i]->hd_td.status != THREAD_STOPPED) {
+            httpd_os_thread_sleep(100);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    if (handle == NULL || config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int worker_count = config->worker_threads ? config->worker_threads : 1;
+#if !HTTPD_REUSEPORT
+    if (worker_count > 1) {
+        LOGW(TAG, LOG_FMT("worker_threads not supported on this platform, running a single loop"));
+        worker_count = 1;
+    }
+#endif
+    /* The sessions are shared by the worker loops, any loop may serve
+     * up to max_open_sockets of them while the others serve none */
+    httpd_config_t worker_config = *config;
+    worker_config.worker_threads = worker_count;
+    if (!worker_config.backlog_conn) {
+        worker_config.backlog_conn = MIN(MAX(worker_config.max_open_sockets, 5), SOMAXCONN);
+    }
+    if (!worker_config.work_queue_len) {
+        worker_config.work_queue_len = HTTPD_WORK_QUEUE_LEN;
+    }
+    if (!worker_config.max_uri_len) {
+        worker_config.max_uri_len = HTTPD_MAX_URI_LEN;
+    }
+    if (!worker_config.max_req_hdr_len) {
+        worker_config.max_req_hdr_len = HTTPD_MAX_REQ_HDR_LEN;
+    }
+    if (MAX(worker_config.max_uri_len, worker_config.max_req_hdr_len) > HTTPD_SCRATCH_MAX) {
+        LOGE(TAG, LOG_FMT("max_uri_len and max_req_hdr_len must not exceed %d"), HTTPD_SCRATCH_MAX);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Sanity check about whether LWIP (or the host, through the open file
+     * limit of the process) allows the maximum number of open sockets
+     * configured for the server. Though,
+     * this check doesn't guarantee that many sockets will actually be
+     * available at runtime as other processes may use up some sockets.
+     * Note that every worker loop also uses descriptors for its internal use :
+     *     1) listening for new TCP connections
+     *     2) the doorbell of its work queue, an eventfd on Linux hosts, or
+     *        two loopback UDP sockets elsewhere, one sending and one receiving
+     * So the total number of required sockets is max_open_sockets + 2
+     * (max_open_sockets + 3 without eventfd) with a single loop
+     */
+    int max_sockets = httpd_max_sockets();
+    int internal_sockets = (HTTPD_WORK_QUEUE_EVENTFD ? 2 : 3) * worker_count;
+    if (max_sockets < worker_config.max_open_sockets + internal_sockets) {
+        LOGE(TAG, "Config option max_open_sockets is too large (max allowed %d, %d sockets used by HTTP server internally)\n\t"
+                 "Either decrease this or configure LWIP_MAX_SOCKETS (RLIMIT_NOFILE on hosts) to a larger value",
+                 max_sockets - internal_sockets, internal_sockets);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct httpd_data *hd = httpd_create(&worker_config, NULL);
+    if (hd == NULL) {
+        /* Failed to allocate memory */
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    hd->workers = calloc(worker_count, sizeof(struct httpd_data *));
+    if (hd->workers == NULL) {
+        httpd_delete(hd);
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    hd->workers[hd->worker_count++] = hd;
+
+    esp_err_t ret = httpd_launch(hd);
+    int launched = ret == ESP_OK ? 1 : 0;
+    for (int i = 1; i < worker_count && ret == ESP_OK; i++) {
+        /* Other loops listen on the port bound by the first one (which
+         * may have been picked by the system) and have their own
+         * control socket */
+        worker_config.server_port = hd->config.server_port;
+        worker_config.ctrl_port = config->ctrl_port + i;
+        struct httpd_data *worker = httpd_create(&worker_config, hd);
+        if (worker == NULL) {
+            ret = ESP_ERR_HTTPD_ALLOC_MEM;
+            break;
+        }
+        hd->workers[hd->worker_count++] = worker;
+        ret = httpd_launch(worker);
+        if (ret == ESP_OK) {
+            launched++;
+        }
+    }
+    if (ret != ESP_OK) {
+        httpd_shutdown(hd->workers, launched);
+        httpd_delete(hd);
+        return ret;
+    }
 
     *handle = (httpd_handle_t)hd;
     esp_http_server_dispatch_event(HTTP_SERVER_EVENT_START, NULL, 0);
@@ -648,21 +1092,12 @@ esp_err_t httpd_stop(httpd_handle_t handle)
     if (hd == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
+    hd = hd->primary;
 
-    struct httpd_ctrl_data msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.hc_msg = HTTPD_CTRL_SHUTDOWN;
-    int ret = 0;
-    if ((ret = cs_send_to_ctrl_sock(hd->msg_fd, hd->config.ctrl_port, &msg, sizeof(msg))) < 0) {
-        LOGE(TAG, "Failed to send shutdown signal err=%d", ret);
+    if (httpd_shutdown(hd->workers, hd->worker_count) != ESP_OK) {
         return ESP_FAIL;
     }
 
-    LOGD(TAG, LOG_FMT("sent control msg to stop server"));
-    while (hd->hd_td.status != THREAD_STOPPED) {
-        httpd_os_thread_sleep(100);
-    }
-
     /* Release global user context, if not NULL */
     if (hd->config.global_user_ctx) {
         if (hd->config.global_user_ctx_free_fn) {
@@ -684,9 +1119,6 @@ esp_err_t httpd_stop(httpd_handle_t handle)
     }
 
     LOGD(TAG, LOG_FMT("server stopped"));
-#if CONFIG_HTTPD_QUEUE_WORK_BLOCKING
-    vSemaphoreDelete(hd->ctrl_sock_semaphore);
-#endif
     httpd_delete(hd);
     esp_http_server_dispatch_event(HTTP_SERVER_EVENT_STOP, NULL, 0);
     return ESP_OK;
@@ -55,12 +55,114 @@ typedef struct {
         size_t      length;
     } last;
 
+    /* Well-known header the value of which is being parsed */
+    enum httpd_known_hdr known_hdr;
+
     /* State variables */
     bool   paused;          /*!< Parser is paused */
     size_t pre_parsed;      /*!< Length of data to be skipped while parsing */
     size_t raw_datalen;     /*!< Full length of the raw data in scratch buffer */
 } parser_data_t;
 
+/* Request received only in part so far. Kept in the session between
+ * readiness events, so that parsing continues where it stopped instead
+ * of waiting for the client to send the rest. Pointers kept by the parser
+ * data refer to the scratch buffer of the server loop, which may have
+ * moved by the time the request continues, so they are rebased on it
+ * once the buffer content is restored. */
+struct httpd_parse_state {
+    http_parser            parser;
+    parser_data_t          data;
+    int                    method;
+    size_t                 content_len;
+    size_t                 remaining_len;
+    unsigned               req_hdrs_count;
+    unsigned               hdr_index_count;
+    struct httpd_hdr_entry hdr_index[HTTPD_HDR_INDEX_LEN];
+    struct httpd_hdr_value known_hdrs[HTTPD_HDR_KNOWN_MAX];
+    uint8_t                known_hdrs_seen;
+    struct http_parser_url url_parse_res;
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    bool                   ws_handshake_detect;
+#endif
+    const char            *base;        /*!< Scratch buffer the pointers refer to */
+    int                    offset;      /*!< Length of the scratch buffer in use */
+    size_t                 uri_len;     /*!< Length of the URI, kept after the scratch content */
+    char                   scratch[];   /*!< Content of the scratch buffer, then the URI */
+};
+
+/* Grow a request buffer of the server loop to hold at least len bytes
+ * and the null termination, keeping its content. The growth is charged
+ * to the memory budget until httpd_req_bufs_trim() */
+static esp_err_t httpd_req_buf_grow(struct httpd_data *hd, char **buf, size_t *size, size_t len)
+{
+    if (len <= *size) {
+        return ESP_OK;
+    }
+    if (httpd_mem_charge(hd, len - *size) != ESP_OK) {
+        LOGW(TAG, LOG_FMT("memory budget used up, request buffer not grown"));
+        return ESP_ERR_HTTPD_MEM_BUDGET;
+    }
+    char *grown = realloc(*buf, len + 1);
+    if (!grown) {
+        LOGE(TAG, LOG_FMT("Failed to allocate memory for request buffer"));
+        httpd_mem_release(hd, len - *size);
+        return ESP_ERR_NO_MEM;
+    }
+    *buf = grown;
+    *size = len;
+    return ESP_OK;
+}
+
+/* Shrink the request buffers of the server loop back to their initial
+ * sizes once a request that grew them is done */
+static void httpd_req_bufs_trim(struct httpd_data *hd)
+{
+    struct httpd_req_aux *ra = &hd->hd_req_aux;
+    if (ra->scratch_size > HTTPD_SCRATCH_INIT_LEN) {
+        char *trimmed = realloc(ra->scratch, HTTPD_SCRATCH_INIT_LEN + 1);
+        if (trimmed) {
+            httpd_mem_release(hd, ra->scratch_size - HTTPD_SCRATCH_INIT_LEN);
+            ra->scratch = trimmed;
+            ra->scratch_size = HTTPD_SCRATCH_INIT_LEN;
+        }
+    }
+    if (ra->uri_size > HTTPD_URI_INIT_LEN) {
+        char *trimmed = realloc(ra->uri, HTTPD_URI_INIT_LEN + 1);
+        if (trimmed) {
+            httpd_mem_release(hd, ra->uri_size - HTTPD_URI_INIT_LEN);
+            ra->uri = trimmed;
+            ra->uri_size = HTTPD_URI_INIT_LEN;
+        }
+    }
+    hd->hd_req.uri = ra->uri;
+}
+
+void httpd_req_rebase_hdrs(struct httpd_req_aux *ra, const char *old)
+{
+    for (int i = 0; i < HTTPD_HDR_KNOWN_MAX; i++) {
+        if (ra->known_hdrs_seen & (1U << i)) {
+            ra->known_hdrs[i].value = ra->scratch + ((uintptr_t) ra->known_hdrs[i].value - (uintptr_t) old);
+        }
+    }
+}
+
+/* Grow the scratch buffer for more of the request being parsed, up to
+ * the configured limits */
+static void httpd_req_scratch_grow(struct httpd_data *hd, parser_data_t *data, size_t limit)
+{
+    struct httpd_req_aux *ra = &hd->hd_req_aux;
+    const char *old = ra->scratch;
+    if (httpd_req_buf_grow(hd, &ra->scratch, &ra->scratch_size, MIN(2 * ra->scratch_size, limit)) != ESP_OK) {
+        return;
+    }
+    LOGD(TAG, LOG_FMT("scratch buffer grown to %"NEWLIB_NANO_COMPAT_FORMAT), NEWLIB_NANO_COMPAT_CAST(ra->scratch_size));
+    httpd_req_rebase_hdrs(ra, old);
+    if (data->last.at) {
+        data->last.at = ra->scratch + ((uintptr_t) data->last.at - (uintptr_t) old);
+    }
+}
+
 static esp_err_t verify_url (http_parser *parser)
 {
     parser_data_t *parser_data  = (parser_data_t *) parser->data;
@@ -79,17 +181,27 @@ static esp_err_t verify_url (http_parser *parser)
         return ESP_FAIL;
     }
 
-    if (sizeof(r->uri) < (length + 1)) {
+    struct httpd_data *hd = (struct httpd_data *) r->handle;
+    if (length > hd->config.max_uri_len) {
         LOGW(TAG, LOG_FMT("URI length (%"NEWLIB_NANO_COMPAT_FORMAT") greater than supported (%"NEWLIB_NANO_COMPAT_FORMAT")"),
-                 NEWLIB_NANO_COMPAT_CAST(length), NEWLIB_NANO_COMPAT_CAST(sizeof(r->uri)));
+                 NEWLIB_NANO_COMPAT_CAST(length), NEWLIB_NANO_COMPAT_CAST(hd->config.max_uri_len));
         parser_data->error = HTTPD_414_URI_TOO_LONG;
         return ESP_FAIL;
     }
 
+    esp_err_t ret = httpd_req_buf_grow(hd, &ra->uri, &ra->uri_size, length);
+    if (ret != ESP_OK) {
+        parser_data->error = (ret == ESP_ERR_HTTPD_MEM_BUDGET) ?
+                             HTTPD_503_SERVICE_UNAVAILABLE : HTTPD_500_INTERNAL_SERVER_ERROR;
+        return ESP_FAIL;
+    }
+
     /* Keep URI with terminating null character. Note URI string pointed
      * by 'at' is not NULL terminated, therefore use length provided by
      * parser while copying the URI to buffer */
-    strlcpy((char *)r->uri, at, (length));// + 1)); //TODO (DROR): identify why it behaves differently in mingw
+    memcpy(ra->uri, at, length);
+    ra->uri[length] = '\0';
+    r->uri = ra->uri;
     LOGD(TAG, LOG_FMT("received URI = %s"), r->uri);
 
     /* Make sure version is HTTP/1.1 or HTTP/1.0 (legacy compliance purpose) */
@@ -139,9 +251,10 @@ static esp_err_t cb_url(http_parser *parser,
     LOGD(TAG, LOG_FMT("processing url = %.*s"), (int)length, at);
 
     /* Update length of URL string */
-    if ((parser_data->last.length += length) > HTTPD_MAX_URI_LEN) {
-        LOGW(TAG, LOG_FMT("URI length (%"NEWLIB_NANO_COMPAT_FORMAT") greater than supported (%d)"),
-                 NEWLIB_NANO_COMPAT_CAST(parser_data->last.length), HTTPD_MAX_URI_LEN);
+    struct httpd_data *hd = (struct httpd_data *) parser_data->req->handle;
+    if ((parser_data->last.length += length) > hd->config.max_uri_len) {
+        LOGW(TAG, LOG_FMT("URI length (%"NEWLIB_NANO_COMPAT_FORMAT") greater than supported (%"NEWLIB_NANO_COMPAT_FORMAT")"),
+                 NEWLIB_NANO_COMPAT_CAST(parser_data->last.length), NEWLIB_NANO_COMPAT_CAST(hd->config.max_uri_len));
         parser_data->error = HTTPD_414_URI_TOO_LONG;
         parser_data->status = PARSING_FAILED;
         return ESP_FAIL;
@@ -199,6 +312,119 @@ static size_t continue_parsing(http_parser *parser, size_t length)
     return length;
 }
 
+/* FNV-1a hash of a header field name, case folded */
+static uint32_t httpd_hdr_hash(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    while (len--) {
+        char c = *name++;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = (hash ^ (uint8_t) c) * 16777619u;
+    }
+    return hash;
+}
+
+/* Well-known header with the given field name, told apart by length
+ * and first character before the name is compared */
+static enum httpd_known_hdr httpd_known_hdr_id(const char *name, size_t len)
+{
+    static const char *const known_names[HTTPD_HDR_KNOWN_MAX] = {
+        [HTTPD_HDR_HOST]            = "Host",
+        [HTTPD_HDR_CONNECTION]      = "Connection",
+        [HTTPD_HDR_CONTENT_TYPE]    = "Content-Type",
+        [HTTPD_HDR_ACCEPT_ENCODING] = "Accept-Encoding",
+        [HTTPD_HDR_COOKIE]          = "Cookie",
+        [HTTPD_HDR_EXPECT]          = "Expect",
+        [HTTPD_HDR_UPGRADE]         = "Upgrade",
+    };
+    enum httpd_known_hdr id;
+
+    switch (len) {
+    case 4:
+        id = HTTPD_HDR_HOST;
+        break;
+    case 6:
+        id = ((name[0] | 0x20) == 'c') ? HTTPD_HDR_COOKIE : HTTPD_HDR_EXPECT;
+        break;
+    case 7:
+        id = HTTPD_HDR_UPGRADE;
+        break;
+    case 10:
+        id = HTTPD_HDR_CONNECTION;
+        break;
+    case 12:
+        id = HTTPD_HDR_CONTENT_TYPE;
+        break;
+    case 15:
+        id = HTTPD_HDR_ACCEPT_ENCODING;
+        break;
+    default:
+        return HTTPD_HDR_UNKNOWN;
+    }
+    return strncasecmp(name, known_names[id], len) == 0 ? id : HTTPD_HDR_UNKNOWN;
+}
+
+/* Index the field name of the header being parsed, once it is complete */
+static void hdr_field_complete(parser_data_t *parser_data)
+{
+    struct httpd_req_aux *ra = parser_data->req->aux;
+    const char *at = parser_data->last.at;
+    size_t length  = parser_data->last.length;
+
+    if (ra->hdr_index_count < HTTPD_HDR_INDEX_LEN) {
+        struct httpd_hdr_entry *entry = &ra->hdr_index[ra->hdr_index_count];
+        entry->name_off = at - ra->scratch;
+        entry->name_len = length;
+        entry->hash = httpd_hdr_hash(at, length);
+    }
+    parser_data->known_hdr = httpd_known_hdr_id(at, length);
+}
+
+/* Record the value of the header being parsed, once it is complete */
+static void hdr_value_complete(parser_data_t *parser_data)
+{
+    struct httpd_req_aux *ra = parser_data->req->aux;
+    const char *at = parser_data->last.at;
+    size_t length  = parser_data->last.length;
+
+    if (ra->hdr_index_count < HTTPD_HDR_INDEX_LEN) {
+        struct httpd_hdr_entry *entry = &ra->hdr_index[ra->hdr_index_count++];
+        entry->value_off = at - ra->scratch;
+        entry->value_len = length;
+    }
+    if (parser_data->known_hdr != HTTPD_HDR_UNKNOWN &&
+        !(ra->known_hdrs_seen & (1U << parser_data->known_hdr))) {
+        ra->known_hdrs_seen |= 1U << parser_data->known_hdr;
+        ra->known_hdrs[parser_data->known_hdr].value = at;
+        ra->known_hdrs[parser_data->known_hdr].len = length;
+    }
+}
+
+/* First value of a well-known request header, or NULL if not received */
+static const char *httpd_known_hdr_value(const struct httpd_req_aux *ra, enum httpd_known_hdr id)
+{
+    return (ra->known_hdrs_seen & (1U << id)) ? ra->known_hdrs[id].value : NULL;
+}
+
+/* Whether a comma separated header value lists the given token */
+static bool httpd_hdr_has_token(const char *value, const char *token)
+{
+    size_t token_len = strlen(token);
+    while (*value) {
+        while (*value == ' ' || *value == '\t' || *value == ',') {
+            value++;
+        }
+        size_t len = strcspn(value, ", \t");
+        if (len == token_len && strncasecmp(value, token, len) == 0) {
+            return true;
+        }
+        value += len;
+    }
+    return false;
+}
+
 /* http_parser callback on header field in HTTP request
  * May be invoked AT LEAST once every header field
  */
@@ -236,6 +462,7 @@ static esp_err_t cb_header_field(http_parser *parser, const char *at, size_t len
          * (key: value) pair with null characters */
         char *term_start = (char *)parser_data->last.at + parser_data->last.length;
         memset(term_start, '\0', at - term_start);
+        hdr_value_complete(parser_data);
 
         /* Store current values of the parser callback arguments */
         parser_data->last.at     = at;
@@ -267,6 +494,8 @@ static esp_err_t cb_header_value(http_parser *parser, const char *at, size_t len
 
     /* Check previous status */
     if (parser_data->status == PARSING_HDR_FIELD) {
+        hdr_field_complete(parser_data);
+
         /* Store current values of the parser callback arguments */
         parser_data->last.at     = at;
         parser_data->last.length = 0;
@@ -324,6 +553,7 @@ static esp_err_t cb_headers_complete(http_parser *parser)
     } else if (parser_data->status == PARSING_HDR_VALUE) {
         /* Locate end of last header */
         char *at = (char *)parser_data->last.at + parser_data->last.length;
+        hdr_value_complete(parser_data);
 
         /* Check if there is data left to parse. This value should
          * at least be equal to the number of line terminators, i.e. 2 */
@@ -410,9 +640,30 @@ static esp_err_t cb_headers_complete(http_parser *parser)
 #endif
     }
 
+    /* A client expecting 100 Continue waits before sending the body, so
+     * the request is complete now. The interim response is sent once the
+     * handler reads the body, a handler may refuse it without doing so */
+    const char *expect = httpd_known_hdr_value(ra, HTTPD_HDR_EXPECT);
+    if (expect && r->content_len && parser->http_minor >= 1 &&
+        strcasecmp(expect, "100-continue") == 0) {
+        ra->expect_continue = true;
+    }
+
     parser_data->status = PARSING_BODY;
     ra->remaining_len = r->content_len;
     esp_http_server_dispatch_event(HTTP_SERVER_EVENT_ON_HEADER, &(ra->sd->fd), sizeof(int));
+
+    if (ra->expect_continue) {
+        if (pause_parsing(parser, parser_data->last.at) != ESP_OK) {
+            parser_data->error = HTTPD_500_INTERNAL_SERVER_ERROR;
+            parser_data->status = PARSING_FAILED;
+            return ESP_FAIL;
+        }
+        parser_data->last.at     = 0;
+        parser_data->last.length = 0;
+        parser_data->status      = PARSING_COMPLETE;
+        LOGD(TAG, LOG_FMT("body expected after 100 Continue"));
+    }
     return ESP_OK;
 }
 
@@ -494,7 +745,7 @@ static int read_block(httpd_req_t *req, size_t offset, size_t length)
     struct httpd_req_aux *raux  = req->aux;
 
     /* Limits the read to scratch buffer size */
-    ssize_t buf_len = MIN(length, (sizeof(raux->scratch) - offset));
+    ssize_t buf_len = MIN(length, (raux->scratch_size - offset));
     if (buf_len <= 0) {
         return 0;
     }
@@ -526,6 +777,7 @@ static int read_block(httpd_req_t *req, size_t offset, size_t length)
         return HTTPD_SOCK_ERR_FAIL;
     }
 
+    raux->scratch[offset + nbytes] = '\0';
     LOGD(TAG, LOG_FMT("received HTTP request block size = %d"), nbytes);
     return nbytes;
 }
@@ -625,23 +877,140 @@ static void parse_init(httpd_req_t *r, http_parser *parser, parser_data_t *data)
     data->settings.on_message_complete = cb_no_body;
 }
 
-/* Function that receives TCP data and runs parser on it
+/* Size of a request kept by parse_save() */
+static size_t parse_state_size(int offset, size_t uri_len)
+{
+    return sizeof(struct httpd_parse_state) + offset + uri_len + 1;
+}
+
+/* Keep the request received so far in the session */
+static esp_err_t parse_save(httpd_req_t *r, http_parser *parser, parser_data_t *data, int offset)
+{
+    struct httpd_req_aux *ra = r->aux;
+    size_t uri_len = strlen(r->uri);
+    size_t size = parse_state_size(offset, uri_len);
+    if (httpd_sess_mem_charge(ra->sd, size, false) != ESP_OK) {
+        LOGW(TAG, LOG_FMT("memory budget used up, dropping partial request"));
+        return ESP_ERR_HTTPD_MEM_BUDGET;
+    }
+    struct httpd_parse_state *state = malloc(size);
+    if (!state) {
+        LOGE(TAG, LOG_FMT("Failed to allocate memory for partial request"));
+        httpd_sess_mem_release(ra->sd, size);
+        return ESP_ERR_NO_MEM;
+    }
+    state->parser = *parser;
+    state->data = *data;
+    state->method = r->method;
+    state->content_len = r->content_len;
+    state->remaining_len = ra->remaining_len;
+    state->req_hdrs_count = ra->req_hdrs_count;
+    state->hdr_index_count = ra->hdr_index_count;
+    memcpy(state->hdr_index, ra->hdr_index, sizeof(state->hdr_index));
+    memcpy(state->known_hdrs, ra->known_hdrs, sizeof(state->known_hdrs));
+    state->known_hdrs_seen = ra->known_hdrs_seen;
+    state->url_parse_res = ra->url_parse_res;
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    state->ws_handshake_detect = ra->ws_handshake_detect;
+#endif
+    state->base = ra->scratch;
+    state->offset = offset;
+    state->uri_len = uri_len;
+    memcpy(state->scratch, ra->scratch, offset);
+    memcpy(state->scratch + offset, r->uri, uri_len + 1);
+    ra->sd->parse_state = state;
+    LOGD(TAG, LOG_FMT("request incomplete, %d bytes kept"), offset);
+
+    /* Buffers grown for the request are not needed until it continues */
+    httpd_req_bufs_trim(r->handle);
+    return ESP_OK;
+}
+
+/* Restore the request kept by parse_save() and return the offset at
+ * which parsing continues */
+static int parse_restore(httpd_req_t *r, http_parser *parser, parser_data_t *data)
+{
+    struct httpd_req_aux *ra = r->aux;
+    struct httpd_parse_state *state = ra->sd->parse_state;
+    int offset = state->offset;
+    size_t size = parse_state_size(offset, state->uri_len);
+    ra->sd->parse_state = NULL;
+    if (httpd_req_buf_grow(r->handle, &ra->scratch, &ra->scratch_size, offset) != ESP_OK ||
+        httpd_req_buf_grow(r->handle, &ra->uri, &ra->uri_size, state->uri_len) != ESP_OK) {
+        LOGW(TAG, LOG_FMT("no room to continue partial request"));
+        free(state);
+        httpd_sess_mem_release(ra->sd, size);
+        return -1;
+    }
+    *parser = state->parser;
+    *data = state->data;
+    parser->data = (void *)data;
+    r->method = state->method;
+    r->content_len = state->content_len;
+    ra->remaining_len = state->remaining_len;
+    ra->req_hdrs_count = state->req_hdrs_count;
+    ra->hdr_index_count = state->hdr_index_count;
+    memcpy(ra->hdr_index, state->hdr_index, sizeof(ra->hdr_index));
+    memcpy(ra->known_hdrs, state->known_hdrs, sizeof(ra->known_hdrs));
+    ra->known_hdrs_seen = state->known_hdrs_seen;
+    ra->url_parse_res = state->url_parse_res;
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ra->ws_handshake_detect = state->ws_handshake_detect;
+#endif
+    memcpy(ra->scratch, state->scratch, offset);
+    memcpy(ra->uri, state->scratch + offset, state->uri_len + 1);
+    r->uri = ra->uri;
+    httpd_req_rebase_hdrs(ra, state->base);
+    if (data->last.at) {
+        data->last.at = ra->scratch + ((uintptr_t) data->last.at - (uintptr_t) state->base);
+    }
+    free(state);
+    httpd_sess_mem_release(ra->sd, size);
+    return offset;
+}
+
+/* Function that receives TCP data and runs parser on it. Returns
+ * ESP_OK with the state kept in the session when the request has not
+ * been received completely and no more data is available yet.
  */
 static esp_err_t httpd_parse_req(struct httpd_data *hd)
 {
     httpd_req_t *r = &hd->hd_req;
+    struct httpd_req_aux *ra = &hd->hd_req_aux;
+    struct sock_db *sd = ra->sd;
     int blk_len,  offset;
     http_parser   parser = {};
     parser_data_t parser_data = {};
 
-    /* Initialize parser */
-    parse_init(r, &parser, &parser_data);
+    /* Request line and headers are received into the scratch buffer */
+    size_t limit = MAX(hd->config.max_uri_len, hd->config.max_req_hdr_len);
+
+    if (sd->parse_state) {
+        /* Continue with the request received so far */
+        if ((offset = parse_restore(r, &parser, &parser_data)) < 0) {
+            return ESP_FAIL;
+        }
+    } else {
+        /* Initialize parser */
+        parse_init(r, &parser, &parser_data);
 
-    /* Set offset to start of scratch buffer */
-    offset = 0;
+        /* Set offset to start of scratch buffer */
+        offset = 0;
+    }
     do {
+        /* Never wait for the rest of a request, it would hold up all
+         * the other sessions of this server loop */
+        if (!httpd_sess_can_recv(hd, sd)) {
+            return parse_save(r, &parser, &parser_data, offset);
+        }
+
+        /* Make room for more of the request */
+        if ((size_t) offset >= ra->scratch_size && ra->scratch_size < limit) {
+            httpd_req_scratch_grow(hd, &parser_data, limit);
+        }
+
         /* Read block into scratch buffer */
-        if ((blk_len = read_block(r, offset, PARSER_BLOCK_SIZE)) < 0) {
+        if ((blk_len = read_block(r, offset, limit - MIN((size_t) offset, limit))) < 0) {
             if (blk_len == HTTPD_SOCK_ERR_TIMEOUT) {
                 /* Retry read in case of non-fatal timeout error.
                  * read_block() ensures that the timeout error is
@@ -669,14 +1038,37 @@ static esp_err_t httpd_parse_req(struct httpd_data *hd)
     } while (parser_data.status != PARSING_COMPLETE);
 
     LOGD(TAG, LOG_FMT("parsing complete"));
+    if (httpd_mem_exhausted(hd)) {
+        /* Shed the request rather than let its handler and body
+         * take more of the memory budget */
+        return httpd_req_handle_err(r, HTTPD_503_SERVICE_UNAVAILABLE);
+    }
+    if (hd->config.body_timeout && ra->remaining_len) {
+        ra->body_deadline = httpd_os_time_ms() + hd->config.body_timeout * 1000;
+    }
+    if (hd->config.max_keep_alive_requests &&
+        ++sd->requests >= hd->config.max_keep_alive_requests) {
+        ra->close_conn = true;
+    }
+
+    /* Persistence is the default from HTTP/1.1 on, a client may turn it
+     * off, while HTTP/1.0 clients have to ask for it */
+    const char *connection = httpd_known_hdr_value(ra, HTTPD_HDR_CONNECTION);
+    if (parser.http_minor == 0) {
+        if (!connection || !httpd_hdr_has_token(connection, "keep-alive")) {
+            ra->close_conn = true;
+        }
+    } else if (connection && httpd_hdr_has_token(connection, "close")) {
+        ra->close_conn = true;
+    }
     return httpd_uri(hd);
 }
 
-static void init_req(httpd_req_t *r, httpd_config_t *config)
+static void init_req(httpd_req_t *r)
 {
     r->handle = 0;
     r->method = 0;
-    memset((char*)r->uri, 0, sizeof(r->uri));
+    r->uri = 0;
     r->content_len = 0;
     r->aux = 0;
     r->user_ctx = 0;
@@ -685,20 +1077,25 @@ static void init_req(httpd_req_t *r, httpd_config_t *config)
     r->ignore_sess_ctx_changes = 0;
 }
 
-static void init_req_aux(struct httpd_req_aux *ra, httpd_config_t *config)
+static void init_req_aux(struct httpd_req_aux *ra)
 {
     ra->sd = 0;
-    memset(ra->scratch, 0, sizeof(ra->scratch));
+    ra->scratch[0] = '\0';
+    ra->uri[0] = '\0';
     ra->remaining_len = 0;
     ra->status = 0;
     ra->content_type = 0;
     ra->first_chunk_sent = 0;
     ra->req_hdrs_count = 0;
+    ra->hdr_index_count = 0;
+    ra->known_hdrs_seen = 0;
+    ra->expect_continue = false;
     ra->resp_hdrs_count = 0;
+    ra->body_deadline = 0;
+    ra->close_conn = false;
 #if CONFIG_HTTPD_WS_SUPPORT
     ra->ws_handshake_detect = false;
 #endif
-    memset(ra->resp_hdrs, 0, config->max_resp_headers * sizeof(struct resp_hdr));
 }
 
 static void httpd_req_cleanup(httpd_req_t *r)
@@ -723,6 +1120,9 @@ static void httpd_req_cleanup(httpd_req_t *r)
     ra->sd->free_ctx = r->free_ctx;
     ra->sd->ignore_sess_ctx_changes = r->ignore_sess_ctx_changes;
 
+    /* Buffers grown for the request are given back */
+    httpd_req_bufs_trim(r->handle);
+
     /* Clear out the request and request_aux structures */
     ra->sd = NULL;
     r->handle = NULL;
@@ -733,13 +1133,21 @@ static void httpd_req_cleanup(httpd_req_t *r)
 /* Function that processes incoming TCP data and
  * updates the http request data httpd_req_t
  */
-esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd)
+void httpd_req_reset(struct httpd_data *hd)
 {
     httpd_req_t *r = &hd->hd_req;
-    init_req(r, &hd->config);
-    init_req_aux(&hd->hd_req_aux, &hd->config);
+    httpd_req_bufs_trim(hd);
+    init_req(r);
+    init_req_aux(&hd->hd_req_aux);
     r->handle = hd;
     r->aux = &hd->hd_req_aux;
+    r->uri = hd->hd_req_aux.uri;
+}
+
+esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd)
+{
+    httpd_req_t *r = &hd->hd_req;
+    httpd_req_reset(hd);
 
     /* Associate the request to the socket */
     struct httpd_req_aux *ra = r->aux;
@@ -798,7 +1206,7 @@ esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd)
 
     /* Parse request */
     ret = httpd_parse_req(hd);
-    if (ret != ESP_OK) {
+    if (ret != ESP_OK || sd->parse_state) {
         httpd_req_cleanup(r);
     }
     return ret;
@@ -977,20 +1385,42 @@ esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
     return ESP_ERR_NOT_FOUND;
 }
 
-/* Get the length of the value string of a header request field */
-size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+/* Locate the value of a request header field. Well-known headers are
+ * read from their own fields, the headers indexed while parsing are
+ * matched by hash, and the ones past the index are walked in the
+ * scratch buffer. Returns the NULL terminated value, or NULL */
+static const char *httpd_req_find_hdr(struct httpd_req_aux *ra, const char *field, size_t *len)
 {
-    if (r == NULL || field == NULL) {
-        return 0;
+    size_t   field_len = strlen(field);
+    unsigned indexed   = MIN(ra->hdr_index_count, ra->req_hdrs_count);
+
+    enum httpd_known_hdr known = httpd_known_hdr_id(field, field_len);
+    if (known != HTTPD_HDR_UNKNOWN && ra->req_hdrs_count && httpd_known_hdr_value(ra, known)) {
+        *len = ra->known_hdrs[known].len;
+        return ra->known_hdrs[known].value;
     }
 
-    if (!httpd_valid_req(r)) {
-        return 0;
+    uint32_t hash = httpd_hdr_hash(field, field_len);
+
+    for (unsigned i = 0; i < indexed; i++) {
+        const struct httpd_hdr_entry *entry = &ra->hdr_index[i];
+        if (entry->hash == hash && entry->name_len == field_len &&
+            strncasecmp(ra->scratch + entry->name_off, field, field_len) == 0) {
+            *len = entry->value_len;
+            return ra->scratch + entry->value_off;
+        }
     }
 
-    struct httpd_req_aux *ra = r->aux;
-    const char   *hdr_ptr = ra->scratch;         /*!< Request headers are kept in scratch buffer */
-    unsigned      count   = ra->req_hdrs_count;  /*!< Count set during parsing  */
+    const char *hdr_ptr = ra->scratch;                  /*!< Request headers are kept in scratch buffer */
+    unsigned    count   = ra->req_hdrs_count - indexed; /*!< Headers left past the index */
+    if (indexed) {
+        /* Continue after the value of the last indexed header */
+        const struct httpd_hdr_entry *last = &ra->hdr_index[indexed - 1];
+        hdr_ptr += last->value_off + last->value_len;
+        while (count && *hdr_ptr == '\0') {
+            hdr_ptr++;
+        }
+    }
 
     while (count--) {
         /* Search for the ':' character. Else, it would mean
@@ -1005,8 +1435,8 @@ size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
          * Compare lengths first as field from header is not
          * null terminated (has ':' in the end).
          */
-        if ((val_ptr - hdr_ptr != strlen(field)) ||
-            (strncasecmp(hdr_ptr, field, strlen(field)))) {
+        if ((val_ptr - hdr_ptr != field_len) ||
+            (strncasecmp(hdr_ptr, field, field_len))) {
             if (count) {
                 /* Jump to end of header field-value string */
                 hdr_ptr = 1 + strchr(hdr_ptr, '\0');
@@ -1027,9 +1457,25 @@ size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
         while ((*val_ptr != '\0') && (*val_ptr == ' ')) {
             val_ptr++;
         }
-        return strlen(val_ptr);
+        *len = strlen(val_ptr);
+        return val_ptr;
     }
-    return 0;
+    return NULL;
+}
+
+/* Get the length of the value string of a header request field */
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    if (r == NULL || field == NULL) {
+        return 0;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return 0;
+    }
+
+    size_t len;
+    return httpd_req_find_hdr(r->aux, field, &len) ? len : 0;
 }
 
 /* Get the value of a field from the request headers */
@@ -1043,60 +1489,42 @@ esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *v
         return ESP_ERR_HTTPD_INVALID_REQ;
     }
 
-    struct httpd_req_aux *ra = r->aux;
-    const char   *hdr_ptr = ra->scratch;         /*!< Request headers are kept in scratch buffer */
-    unsigned     count    = ra->req_hdrs_count;  /*!< Count set during parsing  */
-    const size_t buf_len  = val_size;
-
-    while (count--) {
-        /* Search for the ':' character. Else, it would mean
-         * that the field is invalid
-         */
-        const char *val_ptr = strchr(hdr_ptr, ':');
-        if (!val_ptr) {
-            break;
-        }
-
-        /* If the field, does not match, continue searching.
-         * Compare lengths first as field from header is not
-         * null terminated (has ':' in the end).
-         */
-        if ((val_ptr - hdr_ptr != strlen(field)) ||
-            (strncasecmp(hdr_ptr, field, strlen(field)))) {
-            if (count) {
-                /* Jump to end of header field-value string */
-                hdr_ptr = 1 + strchr(hdr_ptr, '\0');
-
-                /* Skip all null characters (with which the line
-                 * terminators had been overwritten) */
-                while (*hdr_ptr == '\0') {
-                    hdr_ptr++;
-                }
-            }
-            continue;
-        }
+    size_t len;
+    const char *val_ptr = httpd_req_find_hdr(r->aux, field, &len);
+    if (!val_ptr) {
+        return ESP_ERR_NOT_FOUND;
+    }
 
-        /* Skip ':' */
-        val_ptr++;
+    /* Get the NULL terminated value and copy it to the caller's buffer. */
+    strlcpy(val, val_ptr, val_size);
 
-        /* Skip preceding space */
-        while ((*val_ptr != '\0') && (*val_ptr == ' ')) {
-            val_ptr++;
-        }
+    /* If buffer length is smaller than needed, return truncation error */
+    if (val_size < len + 1) {
+        return ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+    return ESP_OK;
+}
 
-        /* Get the NULL terminated value and copy it to the caller's buffer. */
-        strlcpy(val, val_ptr, buf_len);
+esp_err_t httpd_req_get_hdr_view(httpd_req_t *r, const char *field, const char **val, size_t *val_len)
+{
+    if (r == NULL || field == NULL || val == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
 
-        /* Update value length, including one byte for null */
-        val_size = strlen(val_ptr) + 1;
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
 
-        /* If buffer length is smaller than needed, return truncation error */
-        if (buf_len < val_size) {
-            return ESP_ERR_HTTPD_RESULT_TRUNC;
-        }
-        return ESP_OK;
+    size_t len;
+    const char *val_ptr = httpd_req_find_hdr(r->aux, field, &len);
+    if (!val_ptr) {
+        return ESP_ERR_NOT_FOUND;
     }
-    return ESP_ERR_NOT_FOUND;
+    *val = val_ptr;
+    if (val_len) {
+        *val_len = len;
+    }
+    return ESP_OK;
 }
 
 /* Helper function to get a cookie value from a cookie string of the type "cookie1=val1; cookie2=val2" */
@@ -1164,27 +1592,140 @@ esp_err_t static httpd_cookie_key_value(const char *cookie_str, const char *key,
 /* Get the value of a cookie from the request headers */
 esp_err_t httpd_req_get_cookie_val(httpd_req_t *req, const char *cookie_name, char *val, size_t *val_size)
 {
-    esp_err_t ret;
-    size_t hdr_len_cookie = httpd_req_get_hdr_value_len(req, "Cookie");
-    char *cookie_str = NULL;
+    const char *cookie_str;
+    size_t hdr_len_cookie = 0;
 
-    if (hdr_len_cookie <= 0) {
+    /* The value is NULL terminated in place, no copy is needed */
+    if (httpd_req_get_hdr_view(req, "Cookie", &cookie_str, &hdr_len_cookie) != ESP_OK ||
+        hdr_len_cookie == 0) {
         return ESP_ERR_NOT_FOUND;
     }
-    cookie_str = malloc(hdr_len_cookie + 1);
-    if (cookie_str == NULL) {
-        LOGE(TAG, "Failed to allocate memory for cookie string");
-        return ESP_ERR_NO_MEM;
+    return httpd_cookie_key_value(cookie_str, cookie_name, val, val_size);
+}
+
+/* Parse a decimal byte position, stopping at the first non digit */
+static bool httpd_range_pos(const char **str, const char *end, size_t *val)
+{
+    const char *p = *str;
+    size_t v = 0;
+
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        size_t digit = *p - '0';
+        if (v > (SIZE_MAX - digit) / 10) {
+            return false;
+        }
+        v = v * 10 + digit;
+        p++;
     }
+    *str = p;
+    *val = v;
+    return true;
+}
 
-    if (httpd_req_get_hdr_value_str(req, "Cookie", cookie_str, hdr_len_cookie + 1) != ESP_OK) {
-        LOGW(TAG, "Cookie not found in header uri:[%s]", req->uri);
-        free(cookie_str);
-        return ESP_ERR_NOT_FOUND;
+/* Resolve a "bytes=" range set against the length of the representation.
+ * A set which does not parse is ignored, as if no Range was sent */
+static esp_err_t httpd_parse_ranges(const char *str, size_t total_len, httpd_range_t *ranges, size_t *count)
+{
+    size_t n = 0;
+    bool valid = false;
+
+    if (strncasecmp(str, "bytes=", strlen("bytes=")) != 0) {
+        return ESP_OK;
     }
+    str += strlen("bytes=");
+
+    while (true) {
+        const char *spec_end = str + strcspn(str, ",");
+        const char *p = str + strspn(str, " \t");
+        const char *end = spec_end;
+        while (end > p && (end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
 
-    ret = httpd_cookie_key_value(cookie_str, cookie_name, val, val_size);
-    free(cookie_str);
-    return ret;
+        /* Empty list elements are allowed */
+        if (p != end) {
+            size_t first, last;
+            if (*p == '-') {
+                /* Suffix range, the last bytes of the representation */
+                p++;
+                if (!httpd_range_pos(&p, end, &last) || p != end) {
+                    return ESP_OK;
+                }
+                first = (last < total_len) ? total_len - last : 0;
+                last  = SIZE_MAX;
+            } else {
+                if (!httpd_range_pos(&p, end, &first) || p == end || *p != '-') {
+                    return ESP_OK;
+                }
+                p++;
+                if (p == end) {
+                    last = SIZE_MAX;
+                } else if (!httpd_range_pos(&p, end, &last) || p != end || last < first) {
+                    return ESP_OK;
+                }
+            }
+            valid = true;
+
+            /* Ranges starting past the end cannot be satisfied */
+            if (first < total_len) {
+                if (n == HTTPD_MAX_RANGES) {
+                    LOGD(TAG, LOG_FMT("more than %d ranges, sending everything"), HTTPD_MAX_RANGES);
+                    *count = 0;
+                    return ESP_OK;
+                }
+                ranges[n].start = first;
+                ranges[n].len   = MIN(last, total_len - 1) - first + 1;
+                n++;
+            }
+        }
+
+        if (*spec_end == '\0') {
+            break;
+        }
+        str = spec_end + 1;
+    }
+
+    if (!valid) {
+        return ESP_OK;
+    }
+    if (n == 0) {
+        return ESP_ERR_HTTPD_RANGE;
+    }
+    *count = n;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_get_ranges(httpd_req_t *r, size_t total_len, const char *validator,
+                               httpd_range_t *ranges, size_t *count)
+{
+    if (r == NULL || ranges == NULL || count == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    *count = 0;
+    const char *range;
+    size_t range_len = 0;
+    if (httpd_req_get_hdr_view(r, "Range", &range, &range_len) != ESP_OK || range_len == 0) {
+        return ESP_OK;
+    }
+
+    /* A range of a representation that changed since the client
+     * got the rest of it is useless, send all of it instead */
+    const char *if_range;
+    size_t if_range_len = 0;
+    if (httpd_req_get_hdr_view(r, "If-Range", &if_range, &if_range_len) == ESP_OK && if_range_len) {
+        if (validator == NULL || strcmp(if_range, validator) != 0) {
+            LOGD(TAG, LOG_FMT("If-Range does not match, ignoring Range"));
+            return ESP_OK;
+        }
+    }
 
+    return httpd_parse_ranges(range, total_len, ranges, count);
 }
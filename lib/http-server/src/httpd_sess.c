@@ -12,6 +12,7 @@
 
 #ifndef _WIN32
 #include <fcntl.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/types.h>
@@ -25,6 +26,8 @@
 #include <http_server.h>
 #endif
 
+#include <stddef.h>
+
 #include "esp_httpd_priv.h"
 #include <log.h>
 
@@ -36,41 +39,60 @@ typedef enum {
     HTTPD_TASK_NONE = 0,
     HTTPD_TASK_INIT,            // Init session
     HTTPD_TASK_GET_ACTIVE,      // Get active session (fd!=-1)
-    HTTPD_TASK_GET_FREE,        // Get free session slot (fd<0)
-    HTTPD_TASK_FIND_FD,         // Find session with specific fd
-    HTTPD_TASK_SET_DESCRIPTOR,  // Set descriptor
     HTTPD_TASK_DELETE_INVALID,  // Delete invalid session
-    HTTPD_TASK_FIND_LOWEST_LRU, // Find session with lowest lru
     HTTPD_TASK_CLOSE            // Close session
 } task_t;
 
 typedef struct {
     task_t task;
     int fd;
-    fd_set *fdset;
-    int max_fd;
     struct httpd_data *hd;
-    uint64_t lru_counter;
     struct sock_db    *session;
 } enum_context_t;
 
 void httpd_sess_enum(struct httpd_data *hd, httpd_session_enum_function enum_function, void *context)
 {
-    if ((!hd) || (!hd->hd_sd) || (!hd->config.max_open_sockets)) {
+    if ((!hd) || (!hd->hd_sd) || (!hd->hd_sd_capacity)) {
         return;
     }
 
-    struct sock_db *current = hd->hd_sd;
-    struct sock_db *end = hd->hd_sd + hd->config.max_open_sockets - 1;
+    for (int i = 0; i < hd->hd_sd_capacity; i += HTTPD_SESS_CHUNK_SLOTS) {
+        struct sock_db *current = hd->hd_sd[i / HTTPD_SESS_CHUNK_SLOTS];
+        struct sock_db *end = current + MIN(HTTPD_SESS_CHUNK_SLOTS, hd->hd_sd_capacity - i);
 
-    while (current <= end) {
-        if (enum_function && (!enum_function(current, context))) {
-            break;
+        while (current < end) {
+            if (enum_function && (!enum_function(current, context))) {
+                return;
+            }
+            current++;
         }
-        current++;
     }
 }
 
+/* Allocate the next chunk of the socket database. Chunks are never moved
+ * or released while the server runs, so pointers to sessions stay valid. */
+static struct sock_db *httpd_sess_grow(struct httpd_data *hd)
+{
+    int slots = MIN(HTTPD_SESS_CHUNK_SLOTS, hd->config.max_open_sockets - hd->hd_sd_capacity);
+    if (slots <= 0) {
+        return NULL;
+    }
+    struct sock_db *chunk = calloc(slots, sizeof(struct sock_db));
+    if (!chunk) {
+        LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP session data"));
+        return NULL;
+    }
+    for (int i = slots - 1; i >= 0; i--) {
+        chunk[i].fd = -1;
+        chunk[i].free_next = hd->hd_sd_free;
+        hd->hd_sd_free = &chunk[i];
+    }
+    hd->hd_sd[hd->hd_sd_capacity / HTTPD_SESS_CHUNK_SLOTS] = chunk;
+    hd->hd_sd_capacity += slots;
+    LOGD(TAG, LOG_FMT("session slots: %d"), hd->hd_sd_capacity);
+    return chunk;
+}
+
 // Check if a FD is valid
 static int fd_is_valid(int fd)
 {
@@ -120,32 +142,13 @@ static int enum_function(struct sock_db *session, void *context)
         session->fd = -1;
         session->ctx = NULL;
         session->for_async_req = false;
+        session->free_next = ctx->hd->hd_sd_free;
+        ctx->hd->hd_sd_free = session;
         break;
     // Get active session
     case HTTPD_TASK_GET_ACTIVE:
         found = (session->fd != -1);
         break;
-    // Get free slot
-    case HTTPD_TASK_GET_FREE:
-        found = (session->fd < 0);
-        break;
-    // Find fd
-    case HTTPD_TASK_FIND_FD:
-        if (ctx->fd < 0) { // If searching for an invalid FD, don't find anything
-            found = 0;
-        } else {
-            found = (session->fd == ctx->fd);
-        }
-        break;
-    // Set descriptor
-    case HTTPD_TASK_SET_DESCRIPTOR:
-        if (session->fd != -1 && !session->for_async_req) {
-            FD_SET(session->fd, ctx->fdset);
-            if (session->fd > ctx->max_fd) {
-                ctx->max_fd = session->fd;
-            }
-        }
-        break;
     // Delete invalid session - FIXED: Only check sockets that were previously valid (>= 0)
     case HTTPD_TASK_DELETE_INVALID:
         if (session->fd >= 0 && !fd_is_valid(session->fd)) {
@@ -153,21 +156,6 @@ static int enum_function(struct sock_db *session, void *context)
             httpd_sess_delete(ctx->hd, session);
         }
         break;
-    // Find lowest lru
-    case HTTPD_TASK_FIND_LOWEST_LRU:
-        // Found free slot - no need to check other sessions
-        if (session->fd == -1) {
-            return 0;
-        }
-        // Only close sockets that are not in use
-        if (session->for_async_req == false) {
-            // Check/update lowest lru
-            if (session->lru_counter < ctx->lru_counter) {
-                ctx->lru_counter = session->lru_counter;
-                ctx->session = session;
-            }
-        }
-        break;
     case HTTPD_TASK_CLOSE:
         if (session->fd != -1) {
             LOGD(TAG, LOG_FMT("cleaning up socket %d"), session->fd);
@@ -191,25 +179,23 @@ static void httpd_sess_close(void *arg)
         return;
     }
 
-    if (!sock_db->lru_counter && !sock_db->lru_socket) {
+    if (!sock_db->lru_counter) {
         LOGD(TAG, "Skipping session close for %d as it seems to be a race condition", sock_db->fd);
         return;
     }
-    sock_db->lru_socket = false;
     struct httpd_data *hd = (struct httpd_data *) sock_db->handle;
     httpd_sess_delete(hd, sock_db);
 }
 
 struct sock_db *httpd_sess_get_free(struct httpd_data *hd)
 {
-    if ((!hd) || (hd->hd_sd_active_count == hd->config.max_open_sockets)) {
+    if ((!hd) || (httpd_os_atomic_load(&hd->primary->sess_open) >= hd->config.max_open_sockets)) {
         return NULL;
     }
-    enum_context_t context = {
-        .task = HTTPD_TASK_GET_FREE
-    };
-    httpd_sess_enum(hd, enum_function, &context);
-    return context.session;
+    if (!hd->hd_sd_free) {
+        return httpd_sess_grow(hd);
+    }
+    return hd->hd_sd_free;
 }
 
 bool httpd_is_sess_available(struct httpd_data *hd)
@@ -217,50 +203,270 @@ bool httpd_is_sess_available(struct httpd_data *hd)
     return httpd_sess_get_free(hd) ? true : false;
 }
 
-struct sock_db *httpd_sess_get(struct httpd_data *hd, int sockfd)
+static void httpd_sess_lru_unlink(struct httpd_data *hd, struct sock_db *session)
+{
+    if (session->lru_prev) {
+        session->lru_prev->lru_next = session->lru_next;
+    } else if (hd->lru_head == session) {
+        hd->lru_head = session->lru_next;
+    } else {
+        return;
+    }
+    if (session->lru_next) {
+        session->lru_next->lru_prev = session->lru_prev;
+    } else {
+        hd->lru_tail = session->lru_prev;
+    }
+    session->lru_prev = session->lru_next = NULL;
+}
+
+/* Append the session to the tail of the LRU list, as most recently used */
+static void httpd_sess_lru_append(struct httpd_data *hd, struct sock_db *session)
 {
-    if ((!hd) || (!hd->hd_sd) || (!hd->config.max_open_sockets)) {
+    session->lru_prev = hd->lru_tail;
+    session->lru_next = NULL;
+    if (hd->lru_tail) {
+        hd->lru_tail->lru_next = session;
+    } else {
+        hd->lru_head = session;
+    }
+    hd->lru_tail = session;
+}
+
+static void httpd_sess_lru_touch(struct httpd_data *hd, struct sock_db *session)
+{
+    session->lru_counter = ++hd->lru_counter;
+    if (hd->lru_tail != session) {
+        httpd_sess_lru_unlink(hd, session);
+        httpd_sess_lru_append(hd, session);
+    }
+}
+
+void httpd_sess_enum_open(struct httpd_data *hd, httpd_session_enum_function enum_function, void *context)
+{
+    if ((!hd) || (!hd->hd_fd_map)) {
+        return;
+    }
+    httpd_os_mutex_lock(&hd->hd_fd_map_lock);
+    for (uint32_t i = 0; i < (1u << hd->hd_fd_map_bits); i++) {
+        if (hd->hd_fd_map[i] && !enum_function(hd->hd_fd_map[i], context)) {
+            break;
+        }
+    }
+    httpd_os_mutex_unlock(&hd->hd_fd_map_lock);
+}
+
+/* Give back a share of the capacity of the server. The worker loops stop
+ * listening while the server is full, the others are woken up to listen
+ * again when it no longer is */
+static void httpd_sess_put_slot(struct httpd_data *hd)
+{
+    struct httpd_data *primary = hd->primary;
+    if (httpd_os_atomic_add(&primary->sess_open, -1) != hd->config.max_open_sockets - 1 ||
+        !primary->workers) {
+        return;
+    }
+    for (int i = 0; i < primary->worker_count; i++) {
+        if (primary->workers[i] != hd) {
+            httpd_work_queue_notify(primary->workers[i]->work_queue);
+        }
+    }
+}
+
+/* Home entry of a descriptor in the session map (Fibonacci hashing) */
+static inline uint32_t httpd_sess_map_home(const struct httpd_data *hd, int fd)
+{
+    return ((uint32_t) fd * 0x9E3779B1u) >> (32 - hd->hd_fd_map_bits);
+}
+
+/* Only the loop changes its map, under the lock other threads take to
+ * look it up */
+static void httpd_sess_map_add(struct httpd_data *hd, struct sock_db *session)
+{
+    uint32_t mask = (1u << hd->hd_fd_map_bits) - 1;
+    uint32_t i = httpd_sess_map_home(hd, session->fd);
+    httpd_os_mutex_lock(&hd->hd_fd_map_lock);
+    while (hd->hd_fd_map[i]) {
+        i = (i + 1) & mask;
+    }
+    hd->hd_fd_map[i] = session;
+    httpd_os_mutex_unlock(&hd->hd_fd_map_lock);
+}
+
+static void httpd_sess_map_del(struct httpd_data *hd, struct sock_db *session)
+{
+    uint32_t mask = (1u << hd->hd_fd_map_bits) - 1;
+    uint32_t i = httpd_sess_map_home(hd, session->fd);
+    httpd_os_mutex_lock(&hd->hd_fd_map_lock);
+    while (hd->hd_fd_map[i] != session) {
+        if (!hd->hd_fd_map[i]) {
+            httpd_os_mutex_unlock(&hd->hd_fd_map_lock);
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    hd->hd_fd_map[i] = NULL;
+
+    // Pull back the entries of the probe run which can no longer be
+    // reached past the hole, so that no tombstones are needed
+    for (uint32_t j = (i + 1) & mask; hd->hd_fd_map[j]; j = (j + 1) & mask) {
+        uint32_t home = httpd_sess_map_home(hd, hd->hd_fd_map[j]->fd);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            hd->hd_fd_map[i] = hd->hd_fd_map[j];
+            hd->hd_fd_map[j] = NULL;
+            i = j;
+        }
+    }
+    httpd_os_mutex_unlock(&hd->hd_fd_map_lock);
+}
+
+/* Find a session in the table of a single worker loop. The loop itself
+ * reads its table as it is, other threads look it up under the lock */
+static struct sock_db *httpd_sess_find(struct httpd_data *hd, int sockfd)
+{
+    if ((!hd->hd_fd_map) || (sockfd < 0)) {
         return NULL;
     }
 
+    bool own = httpd_os_thread_handle() == hd->hd_td.handle;
     // Check if called inside a request handler, and the session sockfd in use is same as the parameter
     // => Just return the pointer to the sock_db corresponding to the request
-    if ((hd->hd_req_aux.sd) && (hd->hd_req_aux.sd->fd == sockfd)) {
+    if (own && (hd->hd_req_aux.sd) && (hd->hd_req_aux.sd->fd == sockfd)) {
         return hd->hd_req_aux.sd;
     }
 
-    enum_context_t context = {
-        .task = HTTPD_TASK_FIND_FD,
-        .fd = sockfd
-    };
-    httpd_sess_enum(hd, enum_function, &context);
-    return context.session;
+    struct sock_db *session = NULL;
+    uint32_t mask = (1u << hd->hd_fd_map_bits) - 1;
+    if (!own) {
+        httpd_os_mutex_lock(&hd->hd_fd_map_lock);
+    }
+    for (uint32_t i = httpd_sess_map_home(hd, sockfd); hd->hd_fd_map[i]; i = (i + 1) & mask) {
+        if (hd->hd_fd_map[i]->fd == sockfd) {
+            session = hd->hd_fd_map[i];
+            break;
+        }
+    }
+    if (!own) {
+        httpd_os_mutex_unlock(&hd->hd_fd_map_lock);
+    }
+    return session;
 }
 
-esp_err_t httpd_sess_new(struct httpd_data *hd, int newfd)
+struct sock_db *httpd_sess_get(struct httpd_data *hd, int sockfd)
 {
-    LOGD(TAG, LOG_FMT("fd = %d"), newfd);
+    if (!hd) {
+        return NULL;
+    }
+    struct sock_db *session = httpd_sess_find(hd, sockfd);
+    if (session || !hd->primary || !hd->primary->workers) {
+        return session;
+    }
 
-    if (httpd_sess_get(hd, newfd)) {
-        LOGE(TAG, LOG_FMT("session already exists with fd = %d"), newfd);
-        return ESP_FAIL;
+    // The socket may be served by another worker loop of the same server
+    struct httpd_data *primary = hd->primary;
+    for (int i = 0; i < primary->worker_count && !session; i++) {
+        if (primary->workers[i] != hd) {
+            session = httpd_sess_find(primary->workers[i], sockfd);
+        }
     }
+    return session;
+}
+
+httpd_handle_t httpd_sess_owner(httpd_handle_t handle, int sockfd)
+{
+    struct sock_db *session = httpd_sess_get(handle, sockfd);
+    return session ? session->handle : handle;
+}
 
+/* Arm the deadline of a session after it was processed. The header
+ * deadline runs from the first piece of a request, the idle deadline
+ * from the last request or piece received */
+static void httpd_sess_arm_timer(struct httpd_data *hd, struct sock_db *session)
+{
+    if (session->for_async_req) {
+        // The async handler decides when the connection is done
+        session->timer_header = false;
+        httpd_timer_cancel(&hd->timers, &session->timer);
+        return;
+    }
+    if (session->parse_state && hd->config.header_timeout) {
+        if (!session->timer_header) {
+            session->timer_header = true;
+            httpd_timer_arm(&hd->timers, &session->timer, hd->config.header_timeout * 1000);
+        }
+        return;
+    }
+    session->timer_header = false;
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    if (session->ws_handshake_done) {
+        // WebSocket connections stay open until either side closes them
+        httpd_timer_cancel(&hd->timers, &session->timer);
+        return;
+    }
+#endif
+    if (hd->config.idle_timeout) {
+        httpd_timer_arm(&hd->timers, &session->timer, hd->config.idle_timeout * 1000);
+    } else {
+        httpd_timer_cancel(&hd->timers, &session->timer);
+    }
+}
+
+struct sock_db *httpd_sess_attach(struct httpd_data *hd, int fd)
+{
     struct sock_db *session = httpd_sess_get_free(hd);
     if (!session) {
-        LOGD(TAG, LOG_FMT("unable to launch session for fd = %d"), newfd);
-        return ESP_FAIL;
+        return NULL;
     }
 
+    // Take a share of the capacity of the server, which the other
+    // worker loops may be taking at the same time
+    struct httpd_data *primary = hd->primary;
+    if (httpd_os_atomic_add(&primary->sess_open, 1) > hd->config.max_open_sockets) {
+        httpd_sess_put_slot(hd);
+        return NULL;
+    }
+
+    hd->hd_sd_free = session->free_next;
+
     // Clear session data
     memset(session, 0, sizeof (struct sock_db));
-    session->fd = newfd;
+    session->fd = fd;
     session->handle = (httpd_handle_t) hd;
     session->send_fn = httpd_default_send;
+    session->sendv_fn = httpd_default_sendv;
     session->recv_fn = httpd_default_recv;
+    httpd_sess_map_add(hd, session);
+    httpd_sess_lru_append(hd, session);
 
     // increment number of sessions
-    hd->hd_sd_active_count++;
+    httpd_os_atomic_add(&hd->hd_sd_active_count, 1);
+    return session;
+}
+
+esp_err_t httpd_sess_new(struct httpd_data *hd, int newfd)
+{
+    LOGD(TAG, LOG_FMT("fd = %d"), newfd);
+
+    // Only this loop's table matters, a sibling may still hold a stale
+    // entry for a descriptor it has just closed
+    if (httpd_sess_find(hd, newfd)) {
+        LOGE(TAG, LOG_FMT("session already exists with fd = %d"), newfd);
+        return ESP_FAIL;
+    }
+
+    // Refused before attaching, the caller closes the socket
+    if (hd->config.mem_budget &&
+        httpd_os_atomic_load_size(&hd->primary->mem_used) + sizeof(struct sock_db) > hd->config.mem_budget) {
+        LOGW(TAG, LOG_FMT("memory budget used up, refusing fd = %d"), newfd);
+        return ESP_ERR_HTTPD_MEM_BUDGET;
+    }
+
+    struct sock_db *session = httpd_sess_attach(hd, newfd);
+    if (!session) {
+        LOGD(TAG, LOG_FMT("unable to launch session for fd = %d"), newfd);
+        return ESP_FAIL;
+    }
+    httpd_sess_mem_charge(session, sizeof(struct sock_db), true);
 
     // Call user-defined session opening function
     if (hd->config.open_fn) {
@@ -272,8 +478,17 @@ esp_err_t httpd_sess_new(struct httpd_data *hd, int newfd)
         }
     }
 
+    // Start watching the socket. Data which arrived before this point
+    // is reported by the poller right away.
+    if (httpd_poll_add(hd->poller, newfd, HTTPD_POLL_IN | HTTPD_POLL_EDGE, session) != ESP_OK) {
+        LOGE(TAG, LOG_FMT("unable to watch fd = %d"), newfd);
+        httpd_sess_delete(hd, session);
+        return ESP_FAIL;
+    }
+    httpd_sess_arm_timer(hd, session);
 
-    LOGD(TAG, LOG_FMT("active sockets: %d"), hd->hd_sd_active_count);
+
+    LOGD(TAG, LOG_FMT("active sockets: %d"), httpd_os_atomic_load(&hd->hd_sd_active_count));
     return ESP_OK;
 }
 
@@ -319,7 +534,7 @@ void *httpd_sess_get_ctx(httpd_handle_t handle, int sockfd)
     // Check if the function has been called from inside a
     // request handler, in which case fetch the context from
     // the httpd_req_t structure
-    struct httpd_data *hd = (struct httpd_data *) handle;
+    struct httpd_data *hd = (struct httpd_data *) session->handle;
     if (hd->hd_req_aux.sd == session) {
         return hd->hd_req.sess_ctx;
     }
@@ -336,7 +551,7 @@ void httpd_sess_set_ctx(httpd_handle_t handle, int sockfd, void *ctx, httpd_free
     // Check if the function has been called from inside a
     // request handler, in which case set the context inside
     // the httpd_req_t structure
-    struct httpd_data *hd = (struct httpd_data *) handle;
+    struct httpd_data *hd = (struct httpd_data *) session->handle;
     if (hd->hd_req_aux.sd == session) {
         if (hd->hd_req.sess_ctx != ctx) {
             // Don't free previous context if it is in sockdb
@@ -380,17 +595,234 @@ void httpd_sess_set_transport_ctx(httpd_handle_t handle, int sockfd, void *ctx,
     session->free_transport_ctx = free_fn;
 }
 
-void httpd_sess_set_descriptors(struct httpd_data *hd, fd_set *fdset, int *maxfd)
+void httpd_sess_set_ready(struct httpd_data *hd, struct sock_db *session)
 {
-    enum_context_t context = {
-        .task = HTTPD_TASK_SET_DESCRIPTOR,
-        .max_fd = -1,
-        .fdset = fdset
-    };
-    httpd_sess_enum(hd, enum_function, &context);
-    if (maxfd) {
-        *maxfd = context.max_fd;
+    if ((!hd) || (!session) || session->ready) {
+        return;
+    }
+    session->ready = true;
+    session->ready_next = NULL;
+    session->ready_prev = hd->ready_tail;
+    if (hd->ready_tail) {
+        hd->ready_tail->ready_next = session;
+    } else {
+        hd->ready_head = session;
+    }
+    hd->ready_tail = session;
+    hd->ready_count++;
+}
+
+void httpd_sess_clear_ready(struct httpd_data *hd, struct sock_db *session)
+{
+    if ((!hd) || (!session) || !session->ready) {
+        return;
+    }
+    if (session->ready_prev) {
+        session->ready_prev->ready_next = session->ready_next;
+    } else {
+        hd->ready_head = session->ready_next;
+    }
+    if (session->ready_next) {
+        session->ready_next->ready_prev = session->ready_prev;
+    } else {
+        hd->ready_tail = session->ready_prev;
+    }
+    session->ready_prev = session->ready_next = NULL;
+    session->ready = false;
+    hd->ready_count--;
+}
+
+bool httpd_sess_can_recv(struct httpd_data *hd, struct sock_db *session)
+{
+    if ((!session) || (session->fd < 0)) {
+        return false;
+    }
+    if (httpd_sess_pending(hd, session)) {
+        return true;
+    }
+#if HTTPD_POLL_EPOLL
+    char c;
+    int ret = recv(session->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (ret >= 0) {
+        return true;
+    }
+    return (errno != EAGAIN) && (errno != EWOULDBLOCK);
+#else
+    // Without epoll descriptors stay below FD_SETSIZE
+    fd_set read_set;
+    FD_ZERO(&read_set);
+    FD_SET(session->fd, &read_set);
+    struct timeval timeout = { 0, 0 };
+    return select(session->fd + 1, &read_set, NULL, NULL, &timeout) != 0;
+#endif
+}
+
+bool httpd_sess_has_input(struct httpd_data *hd, struct sock_db *session)
+{
+#if HTTPD_POLL_EPOLL
+    // Session sockets are watched edge-triggered, so anything still queued
+    // in the kernel (or an orderly shutdown) has to be looked for here
+    return httpd_sess_can_recv(hd, session);
+#else
+    // select() reports the socket again on its own
+    return (session) && (session->fd >= 0) && httpd_sess_pending(hd, session);
+#endif
+}
+
+void httpd_sess_suspend(struct httpd_data *hd, struct sock_db *session)
+{
+    if ((!hd) || (!session) || (session->fd < 0)) {
+        return;
+    }
+    httpd_sess_clear_ready(hd, session);
+    httpd_poll_mod(hd->poller, session->fd, 0, session);
+}
+
+static void httpd_sess_timeout(httpd_timer_t *timer, void *arg)
+{
+    struct httpd_data *hd = (struct httpd_data *) arg;
+    struct sock_db *session = (struct sock_db *) ((char *) timer - offsetof(struct sock_db, timer));
+    if (session->timer_header && !session->tx_len) {
+        static const char resp[] = "HTTP/1.1 408 Request Timeout\r\n"
+                                   "Content-Length: 0\r\n"
+                                   "Connection: close\r\n\r\n";
+        LOGW(TAG, LOG_FMT("request not received in time on fd %d"), session->fd);
+        // Never wait on a client which stopped reading, it would hold up the
+        // whole loop. A short or failed write is fine, the session goes anyway
+        session->send_fn(hd, session->fd, resp, sizeof(resp) - 1, HTTPD_SEND_NOWAIT);
+    } else {
+        LOGD(TAG, LOG_FMT("closing idle fd %d"), session->fd);
+    }
+    httpd_sess_delete(hd, session);
+}
+
+void httpd_sess_watch(struct httpd_data *hd, struct sock_db *session)
+{
+    uint32_t events = HTTPD_POLL_EDGE;
+    if (!session->tx_close) {
+        events |= HTTPD_POLL_IN;
     }
+    if (session->tx_len) {
+        events |= HTTPD_POLL_OUT;
+    }
+    httpd_poll_mod(hd->poller, session->fd, events, session);
+}
+
+/* Free the send queue once it is written, so that
+ * idle connections do not hold one */
+static void httpd_sess_tx_release(struct sock_db *session)
+{
+    httpd_sess_mem_release(session, session->tx_size);
+    free(session->tx_buf);
+    session->tx_buf = NULL;
+    session->tx_size = session->tx_start = session->tx_len = 0;
+}
+
+esp_err_t httpd_sess_flush(struct httpd_data *hd, struct sock_db *session)
+{
+    size_t queued = session->tx_len;
+    while (session->tx_len) {
+        int ret = session->send_fn(hd, session->fd, session->tx_buf + session->tx_start, session->tx_len,
+                                   HTTPD_SEND_NOWAIT);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            break;
+        }
+        if (ret < 0) {
+            LOGD(TAG, LOG_FMT("error writing queued output on fd %d"), session->fd);
+            return ESP_FAIL;
+        }
+        session->tx_start += ret;
+        session->tx_len -= ret;
+    }
+    if (session->tx_len == queued) {
+        return ESP_OK;
+    }
+
+    // Writing is progress, the deadline runs from the last write
+    if (session->tx_close) {
+        httpd_timer_arm(&hd->timers, &session->timer, hd->config.send_wait_timeout * 1000);
+    } else {
+        httpd_sess_arm_timer(hd, session);
+    }
+    if (session->tx_len) {
+        return ESP_OK;
+    }
+
+    LOGD(TAG, LOG_FMT("queued output written on fd %d"), session->fd);
+    httpd_sess_tx_release(session);
+    if (session->tx_close) {
+        // The response before the close went out in full
+        return ESP_FAIL;
+    }
+    httpd_sess_watch(hd, session);
+    if (hd->config.drain_fn) {
+        hd->config.drain_fn(hd, session->fd);
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_drain(struct httpd_data *hd, struct sock_db *session)
+{
+    if (!session->tx_len) {
+        return ESP_OK;
+    }
+    while (session->tx_len) {
+        // Waits for the client up to send_wait_timeout
+        int ret = session->send_fn(hd, session->fd, session->tx_buf + session->tx_start, session->tx_len, 0);
+        if (ret < 0) {
+            LOGD(TAG, LOG_FMT("error writing queued output on fd %d"), session->fd);
+            return ESP_FAIL;
+        }
+        session->tx_start += ret;
+        session->tx_len -= ret;
+    }
+    httpd_sess_tx_release(session);
+    httpd_sess_watch(hd, session);
+    return ESP_OK;
+}
+
+bool httpd_sess_linger(struct httpd_data *hd, struct sock_db *session)
+{
+    if ((session->fd < 0) || !session->tx_len) {
+        return false;
+    }
+    LOGD(TAG, LOG_FMT("closing fd %d once %"NEWLIB_NANO_COMPAT_FORMAT" queued bytes are written"),
+         session->fd, NEWLIB_NANO_COMPAT_CAST(session->tx_len));
+    session->tx_close = true;
+    session->timer_header = false;
+    httpd_sess_clear_ready(hd, session);
+    httpd_sess_watch(hd, session);
+    httpd_timer_arm(&hd->timers, &session->timer, hd->config.send_wait_timeout * 1000);
+    return true;
+}
+
+void httpd_sess_expire(struct httpd_data *hd)
+{
+    httpd_timer_wheel_advance(&hd->timers, httpd_os_time_ms(), httpd_sess_timeout, hd);
+}
+
+static void httpd_sess_resume_work(void *arg)
+{
+    struct sock_db *session = (struct sock_db *) arg;
+    struct httpd_data *hd = (struct httpd_data *) session->handle;
+    if ((session->fd < 0) || session->for_async_req) {
+        return;
+    }
+    LOGD(TAG, LOG_FMT("fd = %d"), session->fd);
+    // Re-enabling interest reports data which arrived meanwhile
+    httpd_poll_mod(hd->poller, session->fd, HTTPD_POLL_IN | HTTPD_POLL_EDGE, session);
+    httpd_sess_arm_timer(hd, session);
+    if (httpd_sess_pending(hd, session)) {
+        httpd_sess_set_ready(hd, session);
+    }
+}
+
+esp_err_t httpd_sess_resume(struct sock_db *session)
+{
+    if (!session) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return httpd_queue_work(session->handle, httpd_sess_resume_work, session);
 }
 
 void httpd_sess_delete_invalid(struct httpd_data *hd)
@@ -419,6 +851,10 @@ void httpd_sess_delete(struct httpd_data *hd, struct sock_db *session)
         }
     }
 
+    // Stop watching the socket before it gets closed
+    httpd_sess_clear_ready(hd, session);
+    httpd_poll_del(hd->poller, session->fd);
+
     // Call close function if defined
     if (hd->config.close_fn) {
         hd->config.close_fn(hd, session->fd);
@@ -430,22 +866,42 @@ void httpd_sess_delete(struct httpd_data *hd, struct sock_db *session)
     // clear all contexts
     httpd_sess_clear_ctx(session);
 
+    // drop a partially received request and received data
+    free(session->parse_state);
+    session->parse_state = NULL;
+    free(session->rx_buf);
+    session->rx_buf = NULL;
+    session->rx_size = session->rx_start = session->pending_len = 0;
+    httpd_sess_tx_release(session);
+    session->tx_close = false;
+    // including what the application charged
+    httpd_sess_mem_release(session, session->mem_used);
+
     // mark session slot as available
+    httpd_sess_map_del(hd, session);
+    httpd_sess_lru_unlink(hd, session);
+    httpd_timer_cancel(&hd->timers, &session->timer);
     session->fd = -1;
+    session->free_next = hd->hd_sd_free;
+    hd->hd_sd_free = session;
 
     // decrement number of sessions
-    hd->hd_sd_active_count--;
-    LOGD(TAG, LOG_FMT("active sockets: %d"), hd->hd_sd_active_count);
-    if (!hd->hd_sd_active_count) {
+    int active = httpd_os_atomic_add(&hd->hd_sd_active_count, -1);
+    LOGD(TAG, LOG_FMT("active sockets: %d"), active);
+    if (!active) {
         hd->lru_counter = 0;
     }
+    httpd_sess_put_slot(hd);
 }
 
 void httpd_sess_init(struct httpd_data *hd)
 {
     enum_context_t context = {
-        .task = HTTPD_TASK_INIT
+        .task = HTTPD_TASK_INIT,
+        .hd = hd
     };
+    hd->hd_sd_free = NULL;
+    hd->lru_head = hd->lru_tail = NULL;
     httpd_sess_enum(hd, enum_function, &context);
 }
 
@@ -464,6 +920,27 @@ bool httpd_sess_pending(struct httpd_data *hd, struct sock_db *session)
     return (session->pending_len != 0);
 }
 
+/* Release the receive buffer once everything received has been consumed,
+ * so that idle connections do not hold one */
+static void httpd_sess_rx_release(struct sock_db *session)
+{
+    if (session->rx_buf && !session->pending_len) {
+        httpd_sess_mem_release(session, session->rx_size);
+        free(session->rx_buf);
+        session->rx_buf = NULL;
+        session->rx_size = session->rx_start = 0;
+    }
+}
+
+static inline bool httpd_sess_is_ws(struct sock_db *session)
+{
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    return session->ws_handshake_done;
+#else
+    return false;
+#endif
+}
+
 /* This MUST return ESP_OK on successful execution. If any other
  * value is returned, everything related to this socket will be
  * cleaned up and the socket will be closed.
@@ -478,49 +955,209 @@ esp_err_t httpd_sess_process(struct httpd_data *hd, struct sock_db *session)
     if (httpd_req_new(hd, session) != ESP_OK) {
         return ESP_FAIL;
     }
+    if (session->parse_state) {
+        // Request not received completely yet, parsing continues when
+        // the socket becomes readable again
+        LOGD(TAG, LOG_FMT("request incomplete"));
+        httpd_sess_rx_release(session);
+        httpd_sess_arm_timer(hd, session);
+        return ESP_OK;
+    }
     LOGD(TAG, LOG_FMT("httpd_req_delete"));
     if (httpd_req_delete(hd) != ESP_OK) {
         return ESP_FAIL;
     }
+    if (hd->hd_req_aux.close_conn && !session->for_async_req && !httpd_sess_is_ws(session)) {
+        // Connection: close went out with the response
+        LOGD(TAG, LOG_FMT("closing fd %d after %u requests"), session->fd, session->requests);
+        return ESP_FAIL;
+    }
     LOGD(TAG, LOG_FMT("success"));
-    session->lru_counter = ++hd->lru_counter;
+    httpd_sess_rx_release(session);
+    httpd_sess_lru_touch(hd, session);
+    httpd_sess_arm_timer(hd, session);
     return ESP_OK;
 }
 
+static void httpd_sess_lru_touch_work(void *arg)
+{
+    struct sock_db *session = (struct sock_db *) arg;
+    // The session may have been closed while the work was queued
+    if (session->fd != -1) {
+        httpd_sess_lru_touch((struct httpd_data *) session->handle, session);
+    }
+}
+
 esp_err_t httpd_sess_update_lru_counter(httpd_handle_t handle, int sockfd)
 {
     if (handle == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    struct httpd_data *hd = (struct httpd_data *) handle;
-
-    enum_context_t context = {
-        .task = HTTPD_TASK_FIND_FD,
-        .fd = sockfd
-    };
-    httpd_sess_enum(hd, enum_function, &context);
-    if (context.session) {
-        context.session->lru_counter = ++hd->lru_counter;
+    struct sock_db *session = httpd_sess_get(handle, sockfd);
+    if (!session) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    struct httpd_data *hd = (struct httpd_data *) session->handle;
+    if (httpd_os_thread_handle() == hd->hd_td.handle) {
+        httpd_sess_lru_touch(hd, session);
         return ESP_OK;
     }
-    return ESP_ERR_NOT_FOUND;
+    // The LRU list belongs to the loop serving the session
+    return httpd_queue_work(hd, httpd_sess_lru_touch_work, session);
+}
+
+esp_err_t httpd_sess_get_tx_pending(httpd_handle_t handle, int sockfd, size_t *pending)
+{
+    if (handle == NULL || pending == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct sock_db *session = httpd_sess_get(handle, sockfd);
+    if (!session) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *pending = session->tx_len;
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_mem_charge(struct sock_db *session, size_t bytes, bool force)
+{
+    struct httpd_data *hd = (struct httpd_data *) session->handle;
+    size_t used = httpd_os_atomic_add_size(&hd->primary->mem_used, bytes);
+    if (!force && hd->config.mem_budget && used > hd->config.mem_budget) {
+        httpd_os_atomic_add_size(&hd->primary->mem_used, -(ssize_t) bytes);
+        LOGD(TAG, LOG_FMT("%"NEWLIB_NANO_COMPAT_FORMAT" bytes for fd %d over the memory budget"),
+             NEWLIB_NANO_COMPAT_CAST(bytes), session->fd);
+        return ESP_ERR_HTTPD_MEM_BUDGET;
+    }
+    httpd_os_atomic_add_size(&session->mem_used, bytes);
+    return ESP_OK;
+}
+
+void httpd_sess_mem_release(struct sock_db *session, size_t bytes)
+{
+    struct httpd_data *hd = (struct httpd_data *) session->handle;
+    bytes = MIN(bytes, httpd_os_atomic_load_size(&session->mem_used));
+    httpd_os_atomic_add_size(&session->mem_used, -(ssize_t) bytes);
+    httpd_os_atomic_add_size(&hd->primary->mem_used, -(ssize_t) bytes);
+}
+
+bool httpd_mem_exhausted(struct httpd_data *hd)
+{
+    return hd->config.mem_budget &&
+           httpd_os_atomic_load_size(&hd->primary->mem_used) >= hd->config.mem_budget;
+}
+
+esp_err_t httpd_mem_charge(struct httpd_data *hd, size_t bytes)
+{
+    size_t used = httpd_os_atomic_add_size(&hd->primary->mem_used, bytes);
+    if (hd->config.mem_budget && used > hd->config.mem_budget) {
+        httpd_os_atomic_add_size(&hd->primary->mem_used, -(ssize_t) bytes);
+        LOGD(TAG, LOG_FMT("%"NEWLIB_NANO_COMPAT_FORMAT" bytes over the memory budget"),
+             NEWLIB_NANO_COMPAT_CAST(bytes));
+        return ESP_ERR_HTTPD_MEM_BUDGET;
+    }
+    return ESP_OK;
+}
+
+void httpd_mem_release(struct httpd_data *hd, size_t bytes)
+{
+    httpd_os_atomic_add_size(&hd->primary->mem_used, -(ssize_t) bytes);
+}
+
+esp_err_t httpd_sess_get_mem_usage(httpd_handle_t handle, int sockfd, size_t *used)
+{
+    if (handle == NULL || used == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct sock_db *session = httpd_sess_get(handle, sockfd);
+    if (!session) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *used = httpd_os_atomic_load_size(&session->mem_used);
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_charge_mem(httpd_handle_t handle, int sockfd, size_t bytes)
+{
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct sock_db *session = httpd_sess_get(handle, sockfd);
+    if (!session) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return httpd_sess_mem_charge(session, bytes, false);
+}
+
+esp_err_t httpd_sess_release_mem(httpd_handle_t handle, int sockfd, size_t bytes)
+{
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct sock_db *session = httpd_sess_get(handle, sockfd);
+    if (!session) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    httpd_sess_mem_release(session, bytes);
+    return ESP_OK;
+}
+
+esp_err_t httpd_get_mem_usage(httpd_handle_t handle, size_t *used, size_t *budget)
+{
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct httpd_data *hd = (struct httpd_data *) handle;
+    if (used) {
+        *used = httpd_os_atomic_load_size(&hd->primary->mem_used);
+    }
+    if (budget) {
+        *budget = hd->config.mem_budget;
+    }
+    return ESP_OK;
 }
 
 esp_err_t httpd_sess_close_lru(struct httpd_data *hd)
 {
-    enum_context_t context = {
-        .task = HTTPD_TASK_FIND_LOWEST_LRU,
-        .lru_counter = UINT64_MAX,
-        .fd = -1
-    };
-    httpd_sess_enum(hd, enum_function, &context);
-    if (!context.session) {
-        return ESP_OK;
+    // Sessions held by async requests are not closed
+    struct sock_db *session = hd->lru_head;
+    while (session && session->for_async_req) {
+        session = session->lru_next;
+    }
+    if (!session) {
+        return ESP_FAIL;
+    }
+    LOGD(TAG, LOG_FMT("Closing session with fd %d"), session->fd);
+    httpd_sess_delete(hd, session);
+    return ESP_OK;
+}
+
+/* Queued by httpd_sess_close_lru_elsewhere(), runs on the loop asked */
+static void httpd_sess_close_lru_work(void *arg)
+{
+    struct httpd_data *hd = (struct httpd_data *) arg;
+    if (httpd_sess_close_lru(hd) != ESP_OK) {
+        LOGD(TAG, LOG_FMT("no session to close for another loop"));
+    }
+}
+
+esp_err_t httpd_sess_close_lru_elsewhere(struct httpd_data *hd)
+{
+    struct httpd_data *primary = hd->primary;
+    if (!primary->workers || primary->worker_count < 2) {
+        return ESP_FAIL;
+    }
+    hd->lru_peer = (hd->lru_peer + 1) % primary->worker_count;
+    if (primary->workers[hd->lru_peer] == hd) {
+        hd->lru_peer = (hd->lru_peer + 1) % primary->worker_count;
     }
-    LOGD(TAG, LOG_FMT("Closing session with fd %d"), context.session->fd);
-    context.session->lru_socket = true;
-    return httpd_sess_trigger_close_(hd, context.session);
+    return httpd_queue_work(primary->workers[hd->lru_peer], httpd_sess_close_lru_work, primary->workers[hd->lru_peer]);
 }
 
 esp_err_t httpd_sess_trigger_close_(httpd_handle_t handle, struct sock_db *session)
@@ -528,7 +1165,9 @@ esp_err_t httpd_sess_trigger_close_(httpd_handle_t handle, struct sock_db *sessi
     if (!session) {
         return ESP_ERR_NOT_FOUND;
     }
-    return httpd_queue_work(handle, httpd_sess_close, session);
+    // Closing must happen on the loop serving the session, not on the one of handle
+    (void) handle;
+    return httpd_queue_work(session->handle, httpd_sess_close, session);
 }
 
 esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
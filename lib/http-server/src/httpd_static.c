@@ -0,0 +1,280 @@
+/*
+ * SPDX-FileCopyrightText: 2018-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <log.h>
+#include "esp_httpd_priv.h"
+#include "http_server.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifndef S_ISREG
+#define S_ISREG(m) (((m) & S_IFMT) == S_IFREG)
+#endif
+
+static const char *TAG = "httpd_static";
+
+/* "Sun, 06 Nov 1994 08:49:37 GMT" */
+#define HTTPD_STATIC_DATE_LEN  32
+
+/* Quoted hex size and modification time */
+#define HTTPD_STATIC_ETAG_LEN  40
+
+/* Longest If-None-Match / If-Modified-Since value looked at */
+#define HTTPD_STATIC_HDR_LEN   128
+
+static const struct {
+    const char *ext;
+    const char *type;
+} httpd_static_types[] = {
+    { "html", "text/html" },
+    { "htm",  "text/html" },
+    { "css",  "text/css" },
+    { "js",   "application/javascript" },
+    { "mjs",  "application/javascript" },
+    { "json", "application/json" },
+    { "txt",  "text/plain" },
+    { "xml",  "application/xml" },
+    { "svg",  "image/svg+xml" },
+    { "png",  "image/png" },
+    { "jpg",  "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif",  "image/gif" },
+    { "ico",  "image/x-icon" },
+    { "webp", "image/webp" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "wasm", "application/wasm" },
+    { "pdf",  "application/pdf" },
+};
+
+static const char *const httpd_static_months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static const char *httpd_static_content_type(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    if (dot && !strchr(dot, '/')) {
+        for (size_t i = 0; i < sizeof(httpd_static_types) / sizeof(httpd_static_types[0]); i++) {
+            if (strcasecmp(dot + 1, httpd_static_types[i].ext) == 0) {
+                return httpd_static_types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+/* Map the URI of the request to a path under base_path. Fails
+ * for URIs leaving the directory or not fitting the buffer */
+static bool httpd_static_path(const httpd_static_config_t *cfg, const char *uri, char *path, size_t path_len)
+{
+    size_t uri_len = strcspn(uri, "?#");
+    if (cfg->uri_prefix) {
+        size_t prefix_len = strlen(cfg->uri_prefix);
+        if (uri_len < prefix_len || strncmp(uri, cfg->uri_prefix, prefix_len) != 0) {
+            return false;
+        }
+        uri += prefix_len;
+        uri_len -= prefix_len;
+    }
+
+    /* Reject ".." segments, anything else stays below base_path. Backslashes
+     * separate path segments on Windows, they are refused altogether */
+    if (memchr(uri, '\\', uri_len)) {
+        return false;
+    }
+    for (size_t i = 0; i < uri_len; i++) {
+        if ((i == 0 || uri[i - 1] == '/') && i + 1 < uri_len &&
+            uri[i] == '.' && uri[i + 1] == '.' && (i + 2 == uri_len || uri[i + 2] == '/')) {
+            return false;
+        }
+    }
+
+    bool dir = (uri_len == 0 || uri[uri_len - 1] == '/');
+    if (dir && !cfg->index_file) {
+        return false;
+    }
+    int len = snprintf(path, path_len, "%s%s%.*s%s", cfg->base_path,
+                       (uri_len && uri[0] == '/') ? "" : "/",
+                       (int) uri_len, uri, dir ? cfg->index_file : "");
+    return len > 0 && (size_t) len < path_len;
+}
+
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static long httpd_static_days(int y, int m, int d)
+{
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void httpd_static_format_date(time_t t, char *buf, size_t len)
+{
+    struct tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/* Parse an IMF-fixdate, the only date format servers generate */
+static bool httpd_static_parse_date(const char *str, time_t *t)
+{
+    char mon[4];
+    int d, y, hh, mm, ss;
+    if (sscanf(str, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &d, mon, &y, &hh, &mm, &ss) != 6) {
+        return false;
+    }
+    for (int m = 0; m < 12; m++) {
+        if (strcmp(mon, httpd_static_months[m]) == 0) {
+            *t = (time_t) httpd_static_days(y, m + 1, d) * 86400 + hh * 3600 + mm * 60 + ss;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* If-None-Match holds "*" or a list of entity tags. The weak
+ * comparison applies, a W/ prefix does not prevent a match */
+static bool httpd_static_etag_match(const char *list, const char *etag)
+{
+    size_t etag_len = strlen(etag);
+    const char *p = list;
+    while (*p) {
+        p += strspn(p, " \t,");
+        if (*p == '*') {
+            return true;
+        }
+        if (strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        size_t len = strcspn(p, ",");
+        while (len && (p[len - 1] == ' ' || p[len - 1] == '\t')) {
+            len--;
+        }
+        if (len == etag_len && strncmp(p, etag, len) == 0) {
+            return true;
+        }
+        p += strcspn(p, ",");
+    }
+    return false;
+}
+
+/* Tell whether the validators of the request still match the file */
+static bool httpd_static_not_modified(httpd_req_t *req, const char *etag, time_t mtime)
+{
+    char hdr[HTTPD_STATIC_HDR_LEN];
+
+    /* If-Modified-Since is ignored when If-None-Match is present.
+     * A list too long to look at is taken as not matching */
+    esp_err_t ret = httpd_req_get_hdr_value_str(req, "If-None-Match", hdr, sizeof(hdr));
+    if (ret == ESP_OK) {
+        return httpd_static_etag_match(hdr, etag);
+    } else if (ret == ESP_ERR_HTTPD_RESULT_TRUNC) {
+        return false;
+    }
+    time_t since;
+    if (httpd_req_get_hdr_value_str(req, "If-Modified-Since", hdr, sizeof(hdr)) == ESP_OK &&
+        httpd_static_parse_date(hdr, &since)) {
+        return mtime <= since;
+    }
+    return false;
+}
+
+/* Validators and caching policy, sent with both 200 and 304. The
+ * values must stay valid until the response is sent */
+static void httpd_static_set_hdrs(httpd_req_t *req, const httpd_static_config_t *cfg,
+                                  const char *etag, const char *last_modified)
+{
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Last-Modified", last_modified);
+    if (cfg->cache_control) {
+        httpd_resp_set_hdr(req, "Cache-Control", cfg->cache_control);
+    }
+}
+
+static esp_err_t httpd_static_serve(httpd_req_t *req, const httpd_static_config_t *cfg,
+                                    char *path, size_t path_len)
+{
+    struct stat st;
+    if (!httpd_static_path(cfg, req->uri, path, path_len) ||
+        stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        LOGD(TAG, LOG_FMT("no file for %s"), req->uri);
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+    }
+
+    char etag[HTTPD_STATIC_ETAG_LEN];
+    char last_modified[HTTPD_STATIC_DATE_LEN];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx\"",
+             (unsigned long long) st.st_size, (unsigned long long) st.st_mtime);
+    httpd_static_format_date(st.st_mtime, last_modified, sizeof(last_modified));
+
+    /* The 304 is answered without opening the file */
+    if (httpd_static_not_modified(req, etag, st.st_mtime)) {
+        LOGD(TAG, LOG_FMT("%s not modified"), path);
+        httpd_static_set_hdrs(req, cfg, etag, last_modified);
+        httpd_resp_set_status(req, HTTPD_304);
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        LOGW(TAG, LOG_FMT("failed to open %s"), path);
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+    }
+
+    httpd_static_set_hdrs(req, cfg, etag, last_modified);
+    httpd_resp_set_type(req, httpd_static_content_type(path));
+    esp_err_t ret = httpd_resp_send_file_range(req, fd, st.st_size, etag);
+    close(fd);
+    if (ret != ESP_OK) {
+        LOGW(TAG, LOG_FMT("failed to send %s"), path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_static_handler(httpd_req_t *req)
+{
+    const httpd_static_config_t *cfg = req->user_ctx;
+    if (!cfg || !cfg->base_path) {
+        LOGE(TAG, LOG_FMT("no static configuration for %s"), req->uri);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    }
+
+    /* The URI is only bounded by the runtime max_uri_len, so the path is
+     * sized for this request: base path, separator, URI and index file */
+    size_t path_len = strlen(cfg->base_path) + 1 + strlen(req->uri) +
+                      (cfg->index_file ? strlen(cfg->index_file) : 0) + 1;
+    char *path = malloc(path_len);
+    if (!path) {
+        LOGE(TAG, LOG_FMT("Failed to allocate memory for path of %s"), req->uri);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    }
+    esp_err_t ret = httpd_static_serve(req, cfg, path, path_len);
+    free(path);
+    return ret;
+}
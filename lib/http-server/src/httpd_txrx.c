@@ -5,10 +5,23 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 
 #ifndef _WIN32
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#else
+#include <errno.h>
+#include <io.h>
+#endif
+
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+#include <sys/sendfile.h>
+#define HTTPD_SENDFILE 1
+#else
+#define HTTPD_SENDFILE 0
 #endif
 
 #ifdef ESP_PLATFORM
@@ -30,6 +43,20 @@ esp_err_t httpd_sess_set_send_override(httpd_handle_t hd, int sockfd, httpd_send
         return ESP_ERR_INVALID_ARG;
     }
     sess->send_fn = send_func;
+    /* A vectored send bypassing the new send function would defeat
+     * the override, pieces go through send_func until a matching
+     * vectored send function is set */
+    sess->sendv_fn = NULL;
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_set_sendv_override(httpd_handle_t hd, int sockfd, httpd_sendv_func_t sendv_func)
+{
+    struct sock_db *sess = httpd_sess_get(hd, sockfd);
+    if (!sess) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sess->sendv_fn = sendv_func;
     return ESP_OK;
 }
 
@@ -64,7 +91,8 @@ int httpd_send(httpd_req_t *r, const char *buf, size_t buf_len)
     }
 
     struct httpd_req_aux *ra = r->aux;
-    int ret = ra->sd->send_fn(ra->sd->handle, ra->sd->fd, buf, buf_len, 0);
+    httpd_iovec_t iov = { .base = buf, .len = buf_len };
+    int ret = (httpd_sess_sendv(ra->sd, &iov, 1, 0) == ESP_OK) ? (int) buf_len : HTTPD_SOCK_ERR_FAIL;
     if (ret < 0) {
         // log_write(4, TAG,  
         //     "D (%u) %s: %s:%d [%s] %s: error in send_fn\033[0m\n", 
@@ -81,37 +109,239 @@ int httpd_send(httpd_req_t *r, const char *buf, size_t buf_len)
     return ret;
 }
 
-static esp_err_t httpd_send_all(httpd_req_t *r, const char *buf, size_t buf_len)
+/* Pieces of a response gathered for a single vectored send */
+struct httpd_resp_iov {
+    httpd_iovec_t iov[HTTPD_SENDV_MAX_IOV];
+    int           cnt;
+};
+
+static size_t httpd_iov_len(const httpd_iovec_t *iov, int iovcnt)
 {
-    struct httpd_req_aux *ra = r->aux;
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].len;
+    }
+    return len;
+}
+
+/* One send of as many pieces as the session send functions take */
+static int httpd_sess_send_once(struct sock_db *sd, const httpd_iovec_t *iov, int iovcnt, int flags)
+{
+    if (sd->sendv_fn) {
+        return sd->sendv_fn(sd->handle, sd->fd, iov, iovcnt, flags);
+    }
+    return sd->send_fn(sd->handle, sd->fd, iov->base, iov->len, flags);
+}
+
+/* Queue the pieces after the output already queued on the session */
+static esp_err_t httpd_tx_queue(struct sock_db *sd, const httpd_iovec_t *iov, int iovcnt)
+{
+    size_t len = httpd_iov_len(iov, iovcnt);
+    if (sd->tx_start + sd->tx_len + len > sd->tx_size) {
+        if (sd->tx_start) {
+            memmove(sd->tx_buf, sd->tx_buf + sd->tx_start, sd->tx_len);
+            sd->tx_start = 0;
+        }
+        if (sd->tx_len + len > sd->tx_size) {
+            size_t size = MAX(sd->tx_size, CONFIG_HTTPD_RX_BUF_LEN);
+            while (size < sd->tx_len + len) {
+                size *= 2;
+            }
+            if (httpd_sess_mem_charge(sd, size - sd->tx_size, false) != ESP_OK) {
+                return ESP_ERR_HTTPD_MEM_BUDGET;
+            }
+            char *tx_buf = realloc(sd->tx_buf, size);
+            if (!tx_buf) {
+                LOGE(TAG, LOG_FMT("Failed to allocate memory for send queue"));
+                httpd_sess_mem_release(sd, size - sd->tx_size);
+                return ESP_ERR_NO_MEM;
+            }
+            sd->tx_buf  = tx_buf;
+            sd->tx_size = size;
+        }
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(sd->tx_buf + sd->tx_start + sd->tx_len, iov[i].base, iov[i].len);
+        sd->tx_len += iov[i].len;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_sendv(struct sock_db *sd, httpd_iovec_t *iov, int iovcnt, int flags)
+{
+    struct httpd_data *hd = (struct httpd_data *) sd->handle;
+    size_t limit = hd->config.tx_queue_limit;
+    /* Only the server thread queues, it alone writes the queue out */
+    bool queueing = HTTPD_TX_QUEUE && limit && !sd->for_async_req &&
+                    httpd_os_thread_handle() == hd->hd_td.handle;
     int ret;
 
-    while (buf_len > 0) {
-        ret = ra->sd->send_fn(ra->sd->handle, ra->sd->fd, buf, buf_len, 0);
+    if (queueing && sd->tx_len) {
+        if (sd->tx_len + httpd_iov_len(iov, iovcnt) <= limit &&
+            httpd_tx_queue(sd, iov, iovcnt) == ESP_OK) {
+            // Goes out after what is queued already
+            return ESP_OK;
+        }
+        // Too much for the queue or the memory budget, wait for the client
+        if (httpd_sess_drain(hd, sd) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+
+    while (iovcnt > 0) {
+        ret = httpd_sess_send_once(sd, iov, iovcnt, queueing ? flags | HTTPD_SEND_NOWAIT : flags);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT && queueing) {
+            if (httpd_iov_len(iov, iovcnt) <= limit && httpd_tx_queue(sd, iov, iovcnt) == ESP_OK) {
+                // The socket is full, the rest goes out when it is writable
+                LOGD(TAG, LOG_FMT("queued %"NEWLIB_NANO_COMPAT_FORMAT" bytes on fd %d"),
+                     NEWLIB_NANO_COMPAT_CAST(sd->tx_len), sd->fd);
+                httpd_sess_watch(hd, sd);
+                return ESP_OK;
+            }
+            ret = httpd_sess_send_once(sd, iov, iovcnt, flags);
+        }
         if (ret < 0) {
             LOGD(TAG, LOG_FMT("error in send_fn"));
             return ESP_FAIL;
         }
         LOGD(TAG, LOG_FMT("sent = %d"), ret);
-        buf     += ret;
-        buf_len -= ret;
+
+        /* Skip the pieces that went out, the send
+         * may have stopped in the middle of one */
+        size_t sent = ret;
+        while (iovcnt > 0 && sent >= iov->len) {
+            sent -= iov->len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->base = (const char *) iov->base + sent;
+            iov->len -= sent;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t httpd_resp_iov_flush(httpd_req_t *r, struct httpd_resp_iov *v)
+{
+    struct httpd_req_aux *ra = r->aux;
+    esp_err_t ret = httpd_sess_sendv(ra->sd, v->iov, v->cnt, 0);
+    v->cnt = 0;
+    return ret;
+}
+
+static esp_err_t httpd_resp_iov_add(httpd_req_t *r, struct httpd_resp_iov *v, const void *base, size_t len)
+{
+    if (!len) {
+        return ESP_OK;
+    }
+    if (v->cnt == HTTPD_SENDV_MAX_IOV && httpd_resp_iov_flush(r, v) != ESP_OK) {
+        return ESP_FAIL;
     }
+    v->iov[v->cnt].base = base;
+    v->iov[v->cnt].len  = len;
+    v->cnt++;
     return ESP_OK;
 }
 
+/* Gather the headers set with httpd_resp_set_hdr() followed by
+ * the empty line ending the header section */
+static esp_err_t httpd_resp_iov_add_hdrs(httpd_req_t *r, struct httpd_resp_iov *v)
+{
+    struct httpd_req_aux *ra = r->aux;
+    const char *colon_separator = ": ";
+    const char *cr_lf_separator = "\r\n";
+
+    for (unsigned i = 0; i < ra->resp_hdrs_count; i++) {
+        if (httpd_resp_iov_add(r, v, ra->resp_hdrs[i].field, strlen(ra->resp_hdrs[i].field)) != ESP_OK ||
+            httpd_resp_iov_add(r, v, colon_separator, strlen(colon_separator)) != ESP_OK ||
+            httpd_resp_iov_add(r, v, ra->resp_hdrs[i].value, strlen(ra->resp_hdrs[i].value)) != ESP_OK ||
+            httpd_resp_iov_add(r, v, cr_lf_separator, strlen(cr_lf_separator)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    if (ra->expect_continue) {
+        /* Responding before the body was asked for with 100 Continue,
+         * which the client may send anyway or not at all. It is not
+         * read and the connection cannot be used any more */
+        ra->expect_continue = false;
+        ra->remaining_len = 0;
+        ra->close_conn = true;
+    }
+    if (ra->close_conn) {
+        const char *close_hdr = "Connection: close\r\n";
+        if (httpd_resp_iov_add(r, v, close_hdr, strlen(close_hdr)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    return httpd_resp_iov_add(r, v, cr_lf_separator, strlen(cr_lf_separator));
+}
+
 static size_t httpd_recv_pending(httpd_req_t *r, char *buf, size_t buf_len)
 {
     struct httpd_req_aux *ra = r->aux;
-    size_t offset = sizeof(ra->sd->pending_data) - ra->sd->pending_len;
 
     /* buf_len must not be greater than remaining_len */
     buf_len = MIN(ra->sd->pending_len, buf_len);
-    memcpy(buf, ra->sd->pending_data + offset, buf_len);
+    memcpy(buf, ra->sd->rx_buf + ra->sd->rx_start, buf_len);
 
+    ra->sd->rx_start    += buf_len;
     ra->sd->pending_len -= buf_len;
+    if (!ra->sd->pending_len) {
+        ra->sd->rx_start = 0;
+    }
     return buf_len;
 }
 
+/* Make room in the session receive buffer for len more bytes
+ * after the pending data */
+static esp_err_t httpd_rx_reserve(struct sock_db *sd, size_t len)
+{
+    if (sd->rx_start + sd->pending_len + len <= sd->rx_size) {
+        return ESP_OK;
+    }
+    if (sd->rx_start) {
+        memmove(sd->rx_buf, sd->rx_buf + sd->rx_start, sd->pending_len);
+        sd->rx_start = 0;
+    }
+    if (sd->pending_len + len <= sd->rx_size) {
+        return ESP_OK;
+    }
+    size_t size = MAX(sd->rx_size, CONFIG_HTTPD_RX_BUF_LEN);
+    while (size < sd->pending_len + len) {
+        size *= 2;
+    }
+    /* The first buffer is always granted, so that a request can be read
+     * and answered with 503 when the budget is used up */
+    if (httpd_sess_mem_charge(sd, size - sd->rx_size, size == CONFIG_HTTPD_RX_BUF_LEN) != ESP_OK) {
+        LOGW(TAG, LOG_FMT("memory budget used up, no receive buffer for fd %d"), sd->fd);
+        return ESP_ERR_HTTPD_MEM_BUDGET;
+    }
+    char *rx_buf = realloc(sd->rx_buf, size);
+    if (!rx_buf) {
+        LOGE(TAG, LOG_FMT("Failed to allocate memory for receive buffer"));
+        httpd_sess_mem_release(sd, size - sd->rx_size);
+        return ESP_ERR_NO_MEM;
+    }
+    sd->rx_buf  = rx_buf;
+    sd->rx_size = size;
+    return ESP_OK;
+}
+
+/* Receive as much as the socket holds into the session receive buffer */
+static int httpd_rx_fill(struct sock_db *sd)
+{
+    if (httpd_rx_reserve(sd, CONFIG_HTTPD_RX_BUF_LEN) != ESP_OK) {
+        return HTTPD_SOCK_ERR_FAIL;
+    }
+    size_t offset = sd->rx_start + sd->pending_len;
+    int ret = sd->recv_fn(sd->handle, sd->fd, sd->rx_buf + offset, sd->rx_size - offset, 0);
+    if (ret > 0) {
+        sd->pending_len += ret;
+    }
+    return ret;
+}
+
 int httpd_recv_with_opt(httpd_req_t *r, char *buf, size_t buf_len, bool halt_after_pending)
 {
     LOGD(TAG, LOG_FMT("requested length = %"NEWLIB_NANO_COMPAT_FORMAT), NEWLIB_NANO_COMPAT_CAST(buf_len));
@@ -134,8 +364,18 @@ int httpd_recv_with_opt(httpd_req_t *r, char *buf, size_t buf_len, bool halt_aft
         }
     }
 
-    /* Receive data of remaining length */
-    int ret = ra->sd->recv_fn(ra->sd->handle, ra->sd->fd, buf, buf_len, 0);
+    int ret;
+    if (buf_len < CONFIG_HTTPD_RX_BUF_LEN) {
+        /* Fetch whatever the socket holds with one call and keep
+         * what is not needed now pending */
+        ret = httpd_rx_fill(ra->sd);
+        if (ret > 0) {
+            ret = httpd_recv_pending(r, buf, buf_len);
+        }
+    } else {
+        /* Receive data of remaining length */
+        ret = ra->sd->recv_fn(ra->sd->handle, ra->sd->fd, buf, buf_len, 0);
+    }
     if (ret < 0) {
         LOGD(TAG, LOG_FMT("error in recv_fn"));
         if ((ret == HTTPD_SOCK_ERR_TIMEOUT) && (pending_len != 0)) {
@@ -162,15 +402,26 @@ int httpd_recv(httpd_req_t *r, char *buf, size_t buf_len)
 size_t httpd_unrecv(struct httpd_req *r, const char *buf, size_t buf_len)
 {
     struct httpd_req_aux *ra = r->aux;
-    /* Truncate if external buf_len is greater than pending_data buffer size */
-    ra->sd->pending_len = MIN(sizeof(ra->sd->pending_data), buf_len);
-
-    /* Copy data into internal pending_data buffer with the exact offset
-     * such that it is right aligned inside the buffer */
-    size_t offset = sizeof(ra->sd->pending_data) - ra->sd->pending_len;
-    memcpy(ra->sd->pending_data + offset, buf, ra->sd->pending_len);
-    LOGD(TAG, LOG_FMT("length = %"NEWLIB_NANO_COMPAT_FORMAT), NEWLIB_NANO_COMPAT_CAST(ra->sd->pending_len));
-    return ra->sd->pending_len;
+    struct sock_db *sd = ra->sd;
+
+    /* Data usually goes back where it was just taken from, otherwise
+     * the pending data is moved up to make room in front of it */
+    if (sd->rx_start < buf_len) {
+        if (httpd_rx_reserve(sd, buf_len) != ESP_OK) {
+            /* Truncate to what the buffer can take */
+            buf_len = sd->rx_size - sd->rx_start - sd->pending_len;
+            if (!buf_len) {
+                return 0;
+            }
+        }
+        memmove(sd->rx_buf + buf_len, sd->rx_buf + sd->rx_start, sd->pending_len);
+        sd->rx_start = buf_len;
+    }
+    sd->rx_start    -= buf_len;
+    sd->pending_len += buf_len;
+    memcpy(sd->rx_buf + sd->rx_start, buf, buf_len);
+    LOGD(TAG, LOG_FMT("length = %"NEWLIB_NANO_COMPAT_FORMAT), NEWLIB_NANO_COMPAT_CAST(buf_len));
+    return buf_len;
 }
 
 /**
@@ -254,8 +505,7 @@ esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
 
     struct httpd_req_aux *ra = r->aux;
     const char *httpd_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zd\r\n";
-    const char *colon_separator = ": ";
-    const char *cr_lf_separator = "\r\n";
+    const char *httpd_no_body_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\n";
 
     if (buf_len == HTTPD_RESP_USE_STRLEN) {
         buf_len = strlen(buf);
@@ -264,49 +514,29 @@ esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
     /* Request headers are no longer available */
     ra->req_hdrs_count = 0;
 
-    /* Size of essential headers is limited by scratch buffer size */
-    if (snprintf(ra->scratch, sizeof(ra->scratch), httpd_hdr_str,
-                 ra->status, ra->content_type, buf_len) >= sizeof(ra->scratch)) {
-        return ESP_ERR_HTTPD_RESP_HDR;
-    }
-
-    /* Sending essential headers */
-    if (httpd_send_all(r, ra->scratch, strlen(ra->scratch)) != ESP_OK) {
-        return ESP_ERR_HTTPD_RESP_SEND;
+    /* A 304 never carries a body, a Content-Length would describe
+     * the representation the client already has, not this message */
+    if (strncmp(ra->status, "304", 3) == 0) {
+        httpd_hdr_str = httpd_no_body_hdr_str;
+        buf_len = 0;
     }
 
-    /* Sending additional headers based on set_header */
-    for (unsigned i = 0; i < ra->resp_hdrs_count; i++) {
-        /* Send header field */
-        if (httpd_send_all(r, ra->resp_hdrs[i].field, strlen(ra->resp_hdrs[i].field)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-        /* Send ': ' */
-        if (httpd_send_all(r, colon_separator, strlen(colon_separator)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-        /* Send header value */
-        if (httpd_send_all(r, ra->resp_hdrs[i].value, strlen(ra->resp_hdrs[i].value)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-        /* Send CR + LF */
-        if (httpd_send_all(r, cr_lf_separator, strlen(cr_lf_separator)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
+    /* Size of essential headers is limited by scratch buffer size */
+    if (snprintf(ra->scratch, ra->scratch_size + 1, httpd_hdr_str,
+                 ra->status, ra->content_type, buf_len) >= ra->scratch_size + 1) {
+        return ESP_ERR_HTTPD_RESP_HDR;
     }
 
-    /* End header section */
-    if (httpd_send_all(r, cr_lf_separator, strlen(cr_lf_separator)) != ESP_OK) {
+    /* Status line, headers and content go out with one vectored send */
+    struct httpd_resp_iov v = { .cnt = 0 };
+    if (httpd_resp_iov_add(r, &v, ra->scratch, strlen(ra->scratch)) != ESP_OK ||
+        httpd_resp_iov_add_hdrs(r, &v) != ESP_OK ||
+        (buf && httpd_resp_iov_add(r, &v, buf, buf_len) != ESP_OK) ||
+        httpd_resp_iov_flush(r, &v) != ESP_OK) {
         return ESP_ERR_HTTPD_RESP_SEND;
     }
     esp_http_server_dispatch_event(HTTP_SERVER_EVENT_HEADERS_SENT, &(ra->sd->fd), sizeof(int));
 
-    /* Sending content */
-    if (buf && buf_len) {
-        if (httpd_send_all(r, buf, buf_len) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-    }
     esp_http_server_event_data evt_data = {
         .fd = ra->sd->fd,
         .data_len = buf_len,
@@ -331,77 +561,348 @@ esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len
 
     struct httpd_req_aux *ra = r->aux;
     const char *httpd_chunked_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\n";
-    const char *colon_separator = ": ";
-    const char *cr_lf_separator = "\r\n";
 
     /* Request headers are no longer available */
     ra->req_hdrs_count = 0;
 
+    struct httpd_resp_iov v = { .cnt = 0 };
+
     if (!ra->first_chunk_sent) {
         /* Size of essential headers is limited by scratch buffer size */
-        if (snprintf(ra->scratch, sizeof(ra->scratch), httpd_chunked_hdr_str,
-                     ra->status, ra->content_type) >= sizeof(ra->scratch)) {
+        if (snprintf(ra->scratch, ra->scratch_size + 1, httpd_chunked_hdr_str,
+                     ra->status, ra->content_type) >= ra->scratch_size + 1) {
             return ESP_ERR_HTTPD_RESP_HDR;
         }
 
         /* Sending essential headers */
-        if (httpd_send_all(r, ra->scratch, strlen(ra->scratch)) != ESP_OK) {
+        if (httpd_resp_iov_add(r, &v, ra->scratch, strlen(ra->scratch)) != ESP_OK ||
+            httpd_resp_iov_add_hdrs(r, &v) != ESP_OK) {
             return ESP_ERR_HTTPD_RESP_SEND;
         }
+        ra->first_chunk_sent = true;
+    }
 
-        /* Sending additional headers based on set_header */
-        for (unsigned i = 0; i < ra->resp_hdrs_count; i++) {
-            /* Send header field */
-            if (httpd_send_all(r, ra->resp_hdrs[i].field, strlen(ra->resp_hdrs[i].field)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-            /* Send ': ' */
-            if (httpd_send_all(r, colon_separator, strlen(colon_separator)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-            /* Send header value */
-            if (httpd_send_all(r, ra->resp_hdrs[i].value, strlen(ra->resp_hdrs[i].value)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-            /* Send CR + LF */
-            if (httpd_send_all(r, cr_lf_separator, strlen(cr_lf_separator)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
+    /* Chunk size, chunk data and chunk end go out together
+     * with the headers (if any) in one vectored send */
+    char len_str[10];
+    snprintf(len_str, sizeof(len_str), "%lx\r\n", (long)buf_len);
+    if (httpd_resp_iov_add(r, &v, len_str, strlen(len_str)) != ESP_OK ||
+        (buf && httpd_resp_iov_add(r, &v, buf, (size_t) buf_len) != ESP_OK) ||
+        httpd_resp_iov_add(r, &v, "\r\n", strlen("\r\n")) != ESP_OK ||
+        httpd_resp_iov_flush(r, &v) != ESP_OK) {
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    esp_http_server_event_data evt_data = {
+        .fd = ra->sd->fd,
+        .data_len = buf_len,
+    };
+    esp_http_server_dispatch_event(HTTP_SERVER_EVENT_SENT_DATA, &evt_data, sizeof(esp_http_server_event_data));
+
+    return ESP_OK;
+}
+
+/* Read up to len bytes of a file, retrying on interrupts */
+static int httpd_file_read(int fd, char *buf, size_t len)
+{
+    int ret;
+    do {
+#ifdef _WIN32
+        ret = _read(fd, buf, (unsigned int) len);
+#else
+        ret = read(fd, buf, len);
+#endif
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+#if HTTPD_SENDFILE
+/* Hand the file range to the kernel, the socket being a plain one */
+static esp_err_t httpd_sendfile_all(httpd_req_t *r, int fd, off_t offset, size_t len)
+{
+    struct httpd_req_aux *ra = r->aux;
+
+    while (len > 0) {
+        ssize_t ret = sendfile(ra->sd->fd, fd, &offset, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            LOGW(TAG, LOG_FMT("error in sendfile : %d"), errno);
+            return ESP_FAIL;
         }
-
-        /* End header section */
-        if (httpd_send_all(r, cr_lf_separator, strlen(cr_lf_separator)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
+        if (ret == 0) {
+            LOGW(TAG, LOG_FMT("file ended %zu bytes early"), len);
+            return ESP_FAIL;
         }
-        ra->first_chunk_sent = true;
+        LOGD(TAG, LOG_FMT("sent = %zd"), ret);
+        len -= ret;
     }
+    return ESP_OK;
+}
+#endif
 
-    /* Sending chunked content */
-    char len_str[10];
-    snprintf(len_str, sizeof(len_str), "%lx\r\n", (long)buf_len);
-    if (httpd_send_all(r, len_str, strlen(len_str)) != ESP_OK) {
+/* Gather the status line and the headers of a response
+ * with a body of content_len bytes */
+static esp_err_t httpd_resp_iov_add_head(httpd_req_t *r, struct httpd_resp_iov *v, size_t content_len)
+{
+    struct httpd_req_aux *ra = r->aux;
+    const char *httpd_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n";
+
+    /* Request headers are no longer available */
+    ra->req_hdrs_count = 0;
+
+    /* Size of essential headers is limited by scratch buffer size */
+    if (snprintf(ra->scratch, ra->scratch_size + 1, httpd_hdr_str,
+                 ra->status, ra->content_type, content_len) >= ra->scratch_size + 1) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+
+    if (httpd_resp_iov_add(r, v, ra->scratch, strlen(ra->scratch)) != ESP_OK ||
+        httpd_resp_iov_add_hdrs(r, v) != ESP_OK) {
         return ESP_ERR_HTTPD_RESP_SEND;
     }
+    return ESP_OK;
+}
 
-    if (buf) {
-        if (httpd_send_all(r, buf, (size_t) buf_len) != ESP_OK) {
+/* Send what is gathered in v, followed by len bytes of the file at offset */
+static esp_err_t httpd_resp_iov_flush_file(httpd_req_t *r, struct httpd_resp_iov *v, int fd, off_t offset, size_t len)
+{
+#if HTTPD_SENDFILE
+    struct httpd_req_aux *ra = r->aux;
+
+    /* sendfile() writes to the socket directly, which is only
+     * right as long as nobody overrides how the session sends */
+    if (ra->sd->send_fn == httpd_default_send && ra->sd->sendv_fn == httpd_default_sendv) {
+        /* Let the gathered data wait for the first segment of the file,
+         * which must not overtake output queued on the session */
+        esp_err_t ret = httpd_sess_sendv(ra->sd, v->iov, v->cnt, len ? MSG_MORE : 0);
+        v->cnt = 0;
+        if (ret != ESP_OK || httpd_sess_drain(r->handle, ra->sd) != ESP_OK ||
+            httpd_sendfile_all(r, fd, offset, len) != ESP_OK) {
             return ESP_ERR_HTTPD_RESP_SEND;
         }
+        return ESP_OK;
     }
+#endif
 
-    /* Indicate end of chunk */
-    if (httpd_send_all(r, "\r\n", strlen("\r\n")) != ESP_OK) {
+#ifdef _WIN32
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) {
+#else
+    if (lseek(fd, offset, SEEK_SET) < 0) {
+#endif
+        LOGW(TAG, LOG_FMT("error in lseek : %d"), errno);
         return ESP_ERR_HTTPD_RESP_SEND;
     }
+
+    size_t buf_len = MIN(len, CONFIG_HTTPD_FILE_BUF_LEN);
+    char *buf = NULL;
+    if (buf_len) {
+        buf = malloc(buf_len);
+        if (!buf) {
+            LOGE(TAG, LOG_FMT("failed to allocate %zu bytes for the file buffer"), buf_len);
+            return ESP_ERR_HTTPD_ALLOC_MEM;
+        }
+    }
+
+    /* The first block of the file goes out with the gathered data */
+    esp_err_t ret = ESP_OK;
+    size_t remaining = len;
+    do {
+        int n = 0;
+        if (remaining) {
+            n = httpd_file_read(fd, buf, MIN(remaining, buf_len));
+            if (n <= 0) {
+                LOGW(TAG, LOG_FMT("file ended %zu bytes early"), remaining);
+                ret = ESP_ERR_HTTPD_RESP_SEND;
+                break;
+            }
+            remaining -= n;
+        }
+        if (httpd_resp_iov_add(r, v, buf, n) != ESP_OK ||
+            httpd_resp_iov_flush(r, v) != ESP_OK) {
+            ret = ESP_ERR_HTTPD_RESP_SEND;
+            break;
+        }
+    } while (remaining > 0);
+    free(buf);
+    return ret;
+}
+
+esp_err_t httpd_resp_send_file(httpd_req_t *r, int fd, off_t offset, size_t len)
+{
+    if (r == NULL || fd < 0 || offset < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    struct httpd_req_aux *ra = r->aux;
+    struct httpd_resp_iov v = { .cnt = 0 };
+    esp_err_t ret = httpd_resp_iov_add_head(r, &v, len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = httpd_resp_iov_flush_file(r, &v, fd, offset, len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    esp_http_server_dispatch_event(HTTP_SERVER_EVENT_HEADERS_SENT, &(ra->sd->fd), sizeof(int));
+
     esp_http_server_event_data evt_data = {
         .fd = ra->sd->fd,
-        .data_len = buf_len,
+        .data_len = len,
     };
     esp_http_server_dispatch_event(HTTP_SERVER_EVENT_SENT_DATA, &evt_data, sizeof(esp_http_server_event_data));
+    return ESP_OK;
+}
+
+/* Separates the parts of a multipart/byteranges body. It must not occur in
+ * the data sent, which is as unlikely for it as for any other fixed string */
+#define HTTPD_RANGE_BOUNDARY "3d6b6a416f9b5c2e"
+
+/* Length of the headers of a part of a multipart/byteranges body */
+#define HTTPD_RANGE_PART_HDR_LEN 192
+
+/* Where the data of a ranged response is taken from, buf or fd */
+struct httpd_range_src {
+    const char *buf;
+    int         fd;
+};
+
+/* Send what is gathered in v, followed by len bytes of src at start */
+static esp_err_t httpd_resp_iov_flush_src(httpd_req_t *r, struct httpd_resp_iov *v,
+                                          const struct httpd_range_src *src, size_t start, size_t len)
+{
+    if (src->buf == NULL) {
+        return httpd_resp_iov_flush_file(r, v, src->fd, (off_t) start, len);
+    }
+    if (httpd_resp_iov_add(r, v, src->buf + start, len) != ESP_OK ||
+        httpd_resp_iov_flush(r, v) != ESP_OK) {
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    return ESP_OK;
+}
+
+static int httpd_range_part_hdr(char *buf, size_t buf_len, const char *type,
+                                const httpd_range_t *range, size_t total_len)
+{
+    return snprintf(buf, buf_len, "\r\n--" HTTPD_RANGE_BOUNDARY "\r\nContent-Type: %s\r\n"
+                    "Content-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                    type, range->start, range->start + range->len - 1, total_len);
+}
+
+static esp_err_t httpd_resp_send_ranged(httpd_req_t *r, const struct httpd_range_src *src,
+                                        size_t total_len, const char *validator)
+{
+    struct httpd_req_aux *ra = r->aux;
+    httpd_range_t ranges[HTTPD_MAX_RANGES];
+    size_t count;
+    char content_range[64];
+
+    esp_err_t ret = httpd_req_get_ranges(r, total_len, validator, ranges, &count);
+    if (ret == ESP_ERR_HTTPD_RANGE) {
+        snprintf(content_range, sizeof(content_range), "bytes */%zu", total_len);
+        httpd_resp_set_status(r, HTTPD_416);
+        httpd_resp_set_hdr(r, "Content-Range", content_range);
+        return httpd_resp_send(r, NULL, 0);
+    } else if (ret != ESP_OK) {
+        return ret;
+    }
+    httpd_resp_set_hdr(r, "Accept-Ranges", "bytes");
+
+    struct httpd_resp_iov v = { .cnt = 0 };
+    size_t body_len;
+    if (count <= 1) {
+        /* The whole representation, or a single range of it */
+        httpd_range_t all = { .start = 0, .len = total_len };
+        const httpd_range_t *range = count ? &ranges[0] : &all;
+        if (count) {
+            snprintf(content_range, sizeof(content_range), "bytes %zu-%zu/%zu",
+                     range->start, range->start + range->len - 1, total_len);
+            httpd_resp_set_status(r, HTTPD_206);
+            httpd_resp_set_hdr(r, "Content-Range", content_range);
+        }
+        body_len = range->len;
+        ret = httpd_resp_iov_add_head(r, &v, body_len);
+        if (ret == ESP_OK) {
+            ret = httpd_resp_iov_flush_src(r, &v, src, range->start, range->len);
+        }
+    } else {
+        /* Each range in its own part, typed like the whole representation */
+        const char *part_type = ra->content_type;
+        const char *closing = "\r\n--" HTTPD_RANGE_BOUNDARY "--\r\n";
+        char part_hdr[HTTPD_RANGE_PART_HDR_LEN];
+
+        body_len = strlen(closing);
+        for (size_t i = 0; i < count; i++) {
+            int len = httpd_range_part_hdr(NULL, 0, part_type, &ranges[i], total_len);
+            if (len < 0 || len >= sizeof(part_hdr)) {
+                return ESP_ERR_HTTPD_RESP_HDR;
+            }
+            body_len += len + ranges[i].len;
+        }
+
+        httpd_resp_set_status(r, HTTPD_206);
+        httpd_resp_set_type(r, "multipart/byteranges; boundary=" HTTPD_RANGE_BOUNDARY);
+        ret = httpd_resp_iov_add_head(r, &v, body_len);
+        for (size_t i = 0; i < count && ret == ESP_OK; i++) {
+            /* Flushing the part releases part_hdr for the next one */
+            int len = httpd_range_part_hdr(part_hdr, sizeof(part_hdr), part_type, &ranges[i], total_len);
+            if (httpd_resp_iov_add(r, &v, part_hdr, len) != ESP_OK) {
+                ret = ESP_ERR_HTTPD_RESP_SEND;
+                break;
+            }
+            ret = httpd_resp_iov_flush_src(r, &v, src, ranges[i].start, ranges[i].len);
+        }
+        if (ret == ESP_OK &&
+            (httpd_resp_iov_add(r, &v, closing, strlen(closing)) != ESP_OK ||
+             httpd_resp_iov_flush(r, &v) != ESP_OK)) {
+            ret = ESP_ERR_HTTPD_RESP_SEND;
+        }
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    esp_http_server_dispatch_event(HTTP_SERVER_EVENT_HEADERS_SENT, &(ra->sd->fd), sizeof(int));
 
+    esp_http_server_event_data evt_data = {
+        .fd = ra->sd->fd,
+        .data_len = body_len,
+    };
+    esp_http_server_dispatch_event(HTTP_SERVER_EVENT_SENT_DATA, &evt_data, sizeof(esp_http_server_event_data));
     return ESP_OK;
 }
 
+esp_err_t httpd_resp_send_range(httpd_req_t *r, const char *buf, size_t buf_len, const char *validator)
+{
+    if (r == NULL || (buf == NULL && buf_len)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    struct httpd_range_src src = { .buf = buf ? buf : "", .fd = -1 };
+    return httpd_resp_send_ranged(r, &src, buf_len, validator);
+}
+
+esp_err_t httpd_resp_send_file_range(httpd_req_t *r, int fd, size_t file_len, const char *validator)
+{
+    if (r == NULL || fd < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    struct httpd_range_src src = { .buf = NULL, .fd = fd };
+    return httpd_resp_send_ranged(r, &src, file_len, validator);
+}
+
 esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *usr_msg)
 {
     esp_err_t ret;
@@ -457,6 +958,10 @@ esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const ch
         status = "431 Request Header Fields Too Large";
         msg    = "Header fields are too long";
         break;
+    case HTTPD_503_SERVICE_UNAVAILABLE:
+        status = "503 Service Unavailable";
+        msg    = "Server is busy, try again later";
+        break;
     case HTTPD_500_INTERNAL_SERVER_ERROR:
     default:
         status = "500 Internal Server Error";
@@ -599,6 +1104,23 @@ int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
         return buf_len;
     }
 
+    /* Not a timeout, handlers retry on those */
+    if (ra->body_deadline && httpd_os_time_ms() >= ra->body_deadline) {
+        LOGW(TAG, LOG_FMT("body not received in time"));
+        return HTTPD_SOCK_ERR_FAIL;
+    }
+
+    if (ra->expect_continue) {
+        /* The client waits for this before sending the body */
+        static const char continue_str[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        int continue_len = sizeof(continue_str) - 1;
+        ra->expect_continue = false;
+        if (httpd_send(r, continue_str, continue_len) != continue_len) {
+            LOGW(TAG, LOG_FMT("failed to send 100 Continue"));
+            return HTTPD_SOCK_ERR_FAIL;
+        }
+    }
+
     int ret = httpd_recv(r, buf, buf_len);
     if (ret < 0) {
         LOGD(TAG, LOG_FMT("error in httpd_recv (%d)"), ret);
@@ -614,15 +1136,49 @@ int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
     return ret;
 }
 
+/* Bytes allocated for an async copy of a request */
+static size_t httpd_req_async_size(struct httpd_data *hd, size_t scratch_size, size_t uri_size)
+{
+    return sizeof(httpd_req_t) + sizeof(struct httpd_req_aux) +
+           hd->config.max_resp_headers * sizeof(struct resp_hdr) +
+           scratch_size + 1 + uri_size + 1;
+}
+
+/* Free an async copy of a request */
+static void httpd_req_async_free(httpd_req_t *async)
+{
+    struct httpd_req_aux *async_aux = (struct httpd_req_aux *) async->aux;
+    free(async_aux->resp_hdrs);
+    free(async_aux->scratch);
+    free(async_aux->uri);
+    free(async_aux);
+    free(async);
+}
+
 esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out)
 {
     if (r == NULL || out == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
 
+    // The handler writes to the socket directly, after what is queued
+    struct httpd_req_aux *ra = (struct httpd_req_aux *) r->aux;
+    if (httpd_sess_drain((struct httpd_data *) r->handle, ra->sd) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    // The copies count against the memory budget until completion
+    struct httpd_data *hd = (struct httpd_data *) r->handle;
+    size_t uri_len = strlen(r->uri);
+    size_t async_size = httpd_req_async_size(hd, ra->scratch_size, uri_len);
+    if (httpd_sess_mem_charge(ra->sd, async_size, false) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+
     // alloc async req
     httpd_req_t *async = malloc(sizeof(httpd_req_t));
     if (async == NULL) {
+        httpd_sess_mem_release(ra->sd, async_size);
         return ESP_ERR_NO_MEM;
     }
     memcpy(async, r, sizeof(httpd_req_t));
@@ -631,22 +1187,30 @@ esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out)
     async->aux = malloc(sizeof(struct httpd_req_aux));
     if (async->aux == NULL) {
         free(async);
+        httpd_sess_mem_release(ra->sd, async_size);
         return ESP_ERR_NO_MEM;
     }
     memcpy(async->aux, r->aux, sizeof(struct httpd_req_aux));
 
-    // Copy response header block
-    struct httpd_data *hd = (struct httpd_data *) r->handle;
+    // Copy response header block and request buffers, the ones of the
+    // server loop serve the next requests
     struct httpd_req_aux *async_aux = (struct httpd_req_aux *) async->aux;
     struct httpd_req_aux *r_aux = (struct httpd_req_aux *) r->aux;
 
     async_aux->resp_hdrs = calloc(hd->config.max_resp_headers, sizeof(struct resp_hdr));
-    if (async_aux->resp_hdrs == NULL) {
-        free(async_aux);
-        free(async);
+    async_aux->scratch = malloc(r_aux->scratch_size + 1);
+    async_aux->uri = malloc(uri_len + 1);
+    if (async_aux->resp_hdrs == NULL || async_aux->scratch == NULL || async_aux->uri == NULL) {
+        httpd_req_async_free(async);
+        httpd_sess_mem_release(ra->sd, async_size);
         return ESP_ERR_NO_MEM;
     }
     memcpy(async_aux->resp_hdrs, r_aux->resp_hdrs, hd->config.max_resp_headers * sizeof(struct resp_hdr));
+    memcpy(async_aux->scratch, r_aux->scratch, r_aux->scratch_size + 1);
+    httpd_req_rebase_hdrs(async_aux, r_aux->scratch);
+    memcpy(async_aux->uri, r->uri, uri_len + 1);
+    async_aux->uri_size = uri_len;
+    async->uri = async_aux->uri;
 
     // Prevent the main thread from reading the rest of the request after the handler returns.
     r_aux->remaining_len = 0;
@@ -668,9 +1232,14 @@ esp_err_t httpd_req_async_handler_complete(httpd_req_t *r)
     struct httpd_req_aux *ra = r->aux;
     ra->sd->for_async_req = false;
 
-    free(ra->resp_hdrs);
-    free(r->aux);
-    free(r);
+    // Let the server task watch the socket again
+    if (httpd_sess_resume(ra->sd) != ESP_OK) {
+        LOGW(TAG, LOG_FMT("failed to resume session"));
+    }
+
+    httpd_sess_mem_release(ra->sd, httpd_req_async_size((struct httpd_data *) r->handle,
+                                                         ra->scratch_size, ra->uri_size));
+    httpd_req_async_free(r);
 
     return ESP_OK;
 }
@@ -747,11 +1316,66 @@ int httpd_default_send(httpd_handle_t hd, int sockfd, const char *buf, size_t bu
     ret = send(sockfd, buf, buf_len, flags | MSG_NOSIGNAL);
 #endif
     if (ret < 0) {
+#if HTTPD_TX_QUEUE
+        if ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // The socket is full, the caller queues the data
+            return HTTPD_SOCK_ERR_TIMEOUT;
+        }
+#endif
         return httpd_sock_err("send", sockfd);
     }
     return ret;
 }
 
+#ifndef _WIN32
+/* The pieces of a vectored send are handed to sendmsg() as they are */
+_Static_assert(sizeof(httpd_iovec_t) == sizeof(struct iovec) &&
+               offsetof(httpd_iovec_t, base) == offsetof(struct iovec, iov_base) &&
+               offsetof(httpd_iovec_t, len) == offsetof(struct iovec, iov_len),
+               "httpd_iovec_t must have the layout of struct iovec");
+#endif
+
+int httpd_default_sendv(httpd_handle_t hd, int sockfd, const httpd_iovec_t *iov, int iovcnt, int flags)
+{
+    (void)hd;
+    if (iov == NULL || iovcnt <= 0) {
+        return HTTPD_SOCK_ERR_INVALID;
+    }
+    if (iovcnt > HTTPD_SENDV_MAX_IOV) {
+        iovcnt = HTTPD_SENDV_MAX_IOV;
+    }
+
+    int ret;
+#ifdef _WIN32
+    WSABUF bufs[HTTPD_SENDV_MAX_IOV];
+    DWORD sent = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        bufs[i].buf = (CHAR *) iov[i].base;
+        bufs[i].len = (ULONG) iov[i].len;
+    }
+    if (WSASend(sockfd, bufs, iovcnt, &sent, flags, NULL, NULL) != 0) {
+        return httpd_sock_err("sendv", sockfd);
+    }
+    ret = (int) sent;
+#else
+    struct msghdr msg = {
+        .msg_iov    = (struct iovec *) iov,
+        .msg_iovlen = iovcnt,
+    };
+    ret = sendmsg(sockfd, &msg, flags | MSG_NOSIGNAL);
+#endif
+    if (ret < 0) {
+#if HTTPD_TX_QUEUE
+        if ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // The socket is full, the caller queues the data
+            return HTTPD_SOCK_ERR_TIMEOUT;
+        }
+#endif
+        return httpd_sock_err("sendv", sockfd);
+    }
+    return ret;
+}
+
 int httpd_default_recv(httpd_handle_t hd, int sockfd, char *buf, size_t buf_len, int flags)
 {
     (void)hd;
@@ -775,6 +1399,13 @@ int httpd_socket_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf
     if (!sess->send_fn) {
         return HTTPD_SOCK_ERR_INVALID;
     }
+#if HTTPD_TX_QUEUE
+    if (httpd_os_thread_handle() == ((struct httpd_data *) sess->handle)->hd_td.handle) {
+        // Keep the order with the output queued on the session
+        httpd_iovec_t iov = { .base = buf, .len = buf_len };
+        return (httpd_sess_sendv(sess, &iov, 1, flags) == ESP_OK) ? (int) buf_len : HTTPD_SOCK_ERR_FAIL;
+    }
+#endif
     return sess->send_fn(hd, sockfd, buf, buf_len, flags);
 }
 
@@ -419,20 +419,16 @@ esp_err_t httpd_ws_send_frame_async(httpd_handle_t hd, int fd, httpd_ws_frame_t
         return ESP_ERR_INVALID_ARG;
     }
 
-    /* Send off header */
-    if (sess->send_fn(hd, fd, (const char *)header_buf, tx_len, 0) < 0) {
-        LOGW(TAG, LOG_FMT("Failed to send WS header"));
+    /* Send off header and payload, in order with the output queued on the session */
+    httpd_iovec_t iov[2] = {
+        { .base = header_buf, .len = tx_len },
+        { .base = frame->payload, .len = (frame->payload != NULL) ? frame->len : 0 },
+    };
+    if (httpd_sess_sendv(sess, iov, iov[1].len ? 2 : 1, 0) != ESP_OK) {
+        LOGW(TAG, LOG_FMT("Failed to send WS frame"));
         return ESP_FAIL;
     }
 
-    /* Send off payload */
-    if(frame->len > 0 && frame->payload != NULL) {
-        if (sess->send_fn(hd, fd, (const char *)frame->payload, frame->len, 0) < 0) {
-            LOGW(TAG, LOG_FMT("Failed to send WS payload"));
-            return ESP_FAIL;
-        }
-    }
-
     return ESP_OK;
 }
 
@@ -560,12 +556,13 @@ esp_err_t httpd_ws_send_data(httpd_handle_t handle, int socket, httpd_ws_frame_t
     }
 
     transfer->blocking = true;
-    transfer->handle = handle;
+    /* Send from the worker loop serving the socket */
+    transfer->handle = httpd_sess_owner(handle, socket);
     transfer->socket = socket;
     transfer->transfer_done = transfer_done;
     memcpy(&transfer->frame, frame, sizeof(httpd_ws_frame_t));
 
-    esp_err_t err = httpd_queue_work(handle, httpd_ws_send_cb, transfer);
+    esp_err_t err = httpd_queue_work(transfer->handle, httpd_ws_send_cb, transfer);
     if (err != ESP_OK) {
         event_group_delete(transfer_done);
         free(transfer);
@@ -590,11 +587,12 @@ esp_err_t httpd_ws_send_data_async(httpd_handle_t handle, int socket, httpd_ws_f
 
     transfer->arg = arg;
     transfer->callback = callback;
-    transfer->handle = handle;
+    /* Send from the worker loop serving the socket */
+    transfer->handle = httpd_sess_owner(handle, socket);
     transfer->socket = socket;
     memcpy(&transfer->frame, frame, sizeof(httpd_ws_frame_t));
 
-    esp_err_t err = httpd_queue_work(handle, httpd_ws_send_cb, transfer);
+    esp_err_t err = httpd_queue_work(transfer->handle, httpd_ws_send_cb, transfer);
 
     if (err) {
         free(transfer);
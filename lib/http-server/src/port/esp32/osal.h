@@ -9,6 +9,7 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <esp_timer.h>
@@ -50,6 +51,60 @@ static inline othread_t httpd_os_thread_handle(void)
     return xTaskGetCurrentTaskHandle();
 }
 
+/* Session counters are read by other loops than the one updating them */
+static inline int httpd_os_atomic_add(int *value, int delta)
+{
+    return __atomic_add_fetch(value, delta, __ATOMIC_RELAXED);
+}
+
+static inline int httpd_os_atomic_load(const int *value)
+{
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static inline size_t httpd_os_atomic_add_size(size_t *value, ssize_t delta)
+{
+    return __atomic_add_fetch(value, (size_t) delta, __ATOMIC_RELAXED);
+}
+
+static inline size_t httpd_os_atomic_load_size(const size_t *value)
+{
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+/* Guards the session table of a loop against lookups from other threads */
+typedef SemaphoreHandle_t httpd_os_mutex_t;
+
+static inline int httpd_os_mutex_init(httpd_os_mutex_t *mutex)
+{
+    *mutex = xSemaphoreCreateMutex();
+    return *mutex ? OS_SUCCESS : OS_FAIL;
+}
+
+static inline void httpd_os_mutex_delete(httpd_os_mutex_t *mutex)
+{
+    if (*mutex) {
+        vSemaphoreDelete(*mutex);
+        *mutex = NULL;
+    }
+}
+
+static inline void httpd_os_mutex_lock(httpd_os_mutex_t *mutex)
+{
+    xSemaphoreTake(*mutex, portMAX_DELAY);
+}
+
+static inline void httpd_os_mutex_unlock(httpd_os_mutex_t *mutex)
+{
+    xSemaphoreGive(*mutex);
+}
+
+/* Monotonic time in milliseconds, for the deadlines of the server loop */
+static inline uint64_t httpd_os_time_ms(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
 #ifdef __cplusplus
 }
 #endif
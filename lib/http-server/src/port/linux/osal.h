@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -53,6 +54,58 @@ static inline othread_t httpd_os_thread_handle(void)
     return (othread_t)pthread_self();
 }
 
+/* Session counters are read by other loops than the one updating them */
+static inline int httpd_os_atomic_add(int *value, int delta)
+{
+    return __atomic_add_fetch(value, delta, __ATOMIC_RELAXED);
+}
+
+static inline int httpd_os_atomic_load(const int *value)
+{
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static inline size_t httpd_os_atomic_add_size(size_t *value, ssize_t delta)
+{
+    return __atomic_add_fetch(value, (size_t) delta, __ATOMIC_RELAXED);
+}
+
+static inline size_t httpd_os_atomic_load_size(const size_t *value)
+{
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+/* Guards the session table of a loop against lookups from other threads */
+typedef pthread_mutex_t httpd_os_mutex_t;
+
+static inline int httpd_os_mutex_init(httpd_os_mutex_t *mutex)
+{
+    return pthread_mutex_init(mutex, NULL) == 0 ? OS_SUCCESS : OS_FAIL;
+}
+
+static inline void httpd_os_mutex_delete(httpd_os_mutex_t *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+static inline void httpd_os_mutex_lock(httpd_os_mutex_t *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static inline void httpd_os_mutex_unlock(httpd_os_mutex_t *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+/* Monotonic time in milliseconds, for the deadlines of the server loop */
+static inline uint64_t httpd_os_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 #ifdef __cplusplus
 }
 #endif
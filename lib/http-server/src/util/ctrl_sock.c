@@ -8,6 +8,11 @@
 #include <unistd.h>
 #include <errno.h>
 #include "log.h"
+#include "work_queue.h"
+
+/* Only the work queue doorbell of the targets without eventfd uses a
+ * control socket */
+#if !HTTPD_WORK_QUEUE_EVENTFD
 
 #include "../port/win/network.h"
 
@@ -118,3 +123,5 @@ int cs_recv_from_ctrl_sock(int fd, void *data, unsigned int data_len)
     }
     return ret;
 }
+
+#endif /* !HTTPD_WORK_QUEUE_EVENTFD */
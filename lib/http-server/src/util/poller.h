@@ -0,0 +1,141 @@
+/*
+ * SPDX-FileCopyrightText: 2018-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * \file poller.h
+ * \brief Readiness notification backend for the server loop
+ *
+ * The server loop registers the listening socket, the control socket and
+ * every session socket with a poller and only ever looks at the
+ * descriptors reported back by httpd_poll_wait(). On Linux host builds
+ * the poller is backed by epoll and session sockets are registered
+ * edge-triggered, so the cost of a wakeup does not depend on the number
+ * of idle connections. Everywhere else (Windows, lwIP) a select() based
+ * fallback with the same interface is used.
+ */
+#ifndef _HTTPD_POLLER_H_
+#define _HTTPD_POLLER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_err.h>
+#else
+#include "../port/events.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+#define HTTPD_POLL_EPOLL 1
+#else
+#define HTTPD_POLL_EPOLL 0
+#endif
+
+/* Interest / event flags */
+#define HTTPD_POLL_IN       (1u << 0)   /*!< Descriptor is readable (or hung up) */
+#define HTTPD_POLL_OUT      (1u << 1)   /*!< Descriptor is writable */
+#define HTTPD_POLL_ERR      (1u << 2)   /*!< Error or hang-up condition */
+
+/* Registration flag: only report transitions to the ready state. Ignored by
+ * level-triggered backends. A user of this flag must keep reading until the
+ * descriptor is drained (or remember that it is still ready), as no further
+ * notification will arrive for data that is already queued. */
+#define HTTPD_POLL_EDGE     (1u << 8)
+
+typedef struct httpd_poller httpd_poller_t;
+
+/**
+ * @brief A readiness event reported by httpd_poll_wait()
+ */
+typedef struct {
+    void     *data;     /*!< Pointer passed when the descriptor was registered */
+    uint32_t  events;   /*!< HTTPD_POLL_IN / HTTPD_POLL_OUT / HTTPD_POLL_ERR */
+} httpd_poll_event_t;
+
+/**
+ * @brief Create a poller
+ *
+ * @param[out] poller   Created poller
+ * @param[in]  max_fds  Maximum number of descriptors that will be registered
+ *                      at the same time (a hint for the epoll backend)
+ *
+ * @return
+ *  - ESP_OK              : poller created
+ *  - ESP_ERR_NO_MEM      : out of memory
+ *  - ESP_FAIL            : backend could not be created
+ */
+esp_err_t httpd_poll_create(httpd_poller_t **poller, int max_fds);
+
+/**
+ * @brief Destroy a poller. Registered descriptors are not closed.
+ *
+ * @param[in] poller Poller to destroy, may be NULL
+ */
+void httpd_poll_destroy(httpd_poller_t *poller);
+
+/**
+ * @brief Register a descriptor
+ *
+ * @param[in] poller Poller
+ * @param[in] fd     Descriptor
+ * @param[in] events Interest flags, optionally OR-ed with HTTPD_POLL_EDGE
+ * @param[in] data   Opaque pointer reported back with every event for fd
+ *
+ * @return
+ *  - ESP_OK              : registered
+ *  - ESP_ERR_INVALID_ARG : null poller or negative descriptor
+ *  - ESP_ERR_NO_MEM      : out of memory
+ *  - ESP_FAIL            : backend error, or no room left for the descriptor
+ */
+esp_err_t httpd_poll_add(httpd_poller_t *poller, int fd, uint32_t events, void *data);
+
+/**
+ * @brief Change the interest set of a registered descriptor
+ *
+ * Passing 0 as events keeps the descriptor registered but stops reporting
+ * it. With the epoll backend, re-enabling interest reports the descriptor
+ * immediately if it is already ready, even when registered edge-triggered.
+ *
+ * @return
+ *  - ESP_OK              : updated
+ *  - ESP_ERR_INVALID_ARG : null poller or negative descriptor
+ *  - ESP_FAIL            : descriptor not registered or backend error
+ */
+esp_err_t httpd_poll_mod(httpd_poller_t *poller, int fd, uint32_t events, void *data);
+
+/**
+ * @brief Unregister a descriptor. Must be called before the descriptor is closed.
+ *
+ * @return
+ *  - ESP_OK              : removed
+ *  - ESP_ERR_INVALID_ARG : null poller or negative descriptor
+ *  - ESP_FAIL            : descriptor not registered or backend error
+ */
+esp_err_t httpd_poll_del(httpd_poller_t *poller, int fd);
+
+/**
+ * @brief Wait for events
+ *
+ * @param[in]  poller     Poller
+ * @param[out] events     Array receiving the events
+ * @param[in]  max_events Size of events array
+ * @param[in]  timeout_ms Maximum time to wait, 0 to return immediately
+ *
+ * @return
+ *  - number of events stored in events (0 on timeout)
+ *  - negative value on error, errno holds the cause
+ */
+int httpd_poll_wait(httpd_poller_t *poller, httpd_poll_event_t *events, int max_events, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! _HTTPD_POLLER_H_ */
@@ -0,0 +1,143 @@
+/*
+ * SPDX-FileCopyrightText: 2018-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "poller.h"
+
+#if HTTPD_POLL_EPOLL
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <log.h>
+
+static const char *TAG = "httpd_poll";
+
+/* Upper bound of the kernel event buffer used by a single wait */
+#define EPOLL_MAX_EVENTS 256
+
+struct httpd_poller {
+    int epfd;
+    int max_events;
+    struct epoll_event *ev_buf;
+};
+
+static uint32_t to_epoll(uint32_t events)
+{
+    uint32_t ep = 0;
+    if (events & HTTPD_POLL_IN) {
+        ep |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & HTTPD_POLL_OUT) {
+        ep |= EPOLLOUT;
+    }
+    if (events & HTTPD_POLL_EDGE) {
+        ep |= EPOLLET;
+    }
+    return ep;
+}
+
+static uint32_t from_epoll(uint32_t ep)
+{
+    uint32_t events = 0;
+    if (ep & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        events |= HTTPD_POLL_IN;
+    }
+    if (ep & EPOLLOUT) {
+        events |= HTTPD_POLL_OUT;
+    }
+    if (ep & (EPOLLERR | EPOLLHUP)) {
+        events |= HTTPD_POLL_ERR;
+    }
+    return events;
+}
+
+esp_err_t httpd_poll_create(httpd_poller_t **poller, int max_fds)
+{
+    if (!poller) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct httpd_poller *p = calloc(1, sizeof(struct httpd_poller));
+    if (!p) {
+        return ESP_ERR_NO_MEM;
+    }
+    p->max_events = (max_fds > 0 && max_fds < EPOLL_MAX_EVENTS) ? max_fds : EPOLL_MAX_EVENTS;
+    p->ev_buf = calloc(p->max_events, sizeof(struct epoll_event));
+    if (!p->ev_buf) {
+        free(p);
+        return ESP_ERR_NO_MEM;
+    }
+    p->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (p->epfd < 0) {
+        LOGE(TAG, "error in epoll_create1 (%d)", errno);
+        free(p->ev_buf);
+        free(p);
+        return ESP_FAIL;
+    }
+    *poller = p;
+    return ESP_OK;
+}
+
+void httpd_poll_destroy(httpd_poller_t *poller)
+{
+    if (!poller) {
+        return;
+    }
+    close(poller->epfd);
+    free(poller->ev_buf);
+    free(poller);
+}
+
+static esp_err_t epoll_ctl_op(httpd_poller_t *poller, int op, int fd, uint32_t events, void *data)
+{
+    if (!poller || fd < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct epoll_event ev = {
+        .events = to_epoll(events),
+        .data.ptr = data
+    };
+    if (epoll_ctl(poller->epfd, op, fd, &ev) < 0) {
+        LOGD(TAG, "error in epoll_ctl op %d fd %d (%d)", op, fd, errno);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_poll_add(httpd_poller_t *poller, int fd, uint32_t events, void *data)
+{
+    return epoll_ctl_op(poller, EPOLL_CTL_ADD, fd, events, data);
+}
+
+esp_err_t httpd_poll_mod(httpd_poller_t *poller, int fd, uint32_t events, void *data)
+{
+    return epoll_ctl_op(poller, EPOLL_CTL_MOD, fd, events, data);
+}
+
+esp_err_t httpd_poll_del(httpd_poller_t *poller, int fd)
+{
+    return epoll_ctl_op(poller, EPOLL_CTL_DEL, fd, 0, NULL);
+}
+
+int httpd_poll_wait(httpd_poller_t *poller, httpd_poll_event_t *events, int max_events, int timeout_ms)
+{
+    if (!poller || !events || max_events <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (max_events > poller->max_events) {
+        max_events = poller->max_events;
+    }
+    int n = epoll_wait(poller->epfd, poller->ev_buf, max_events, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        events[i].data = poller->ev_buf[i].data.ptr;
+        events[i].events = from_epoll(poller->ev_buf[i].events);
+    }
+    return n;
+}
+
+#endif /* HTTPD_POLL_EPOLL */
@@ -0,0 +1,195 @@
+/*
+ * SPDX-FileCopyrightText: 2018-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "poller.h"
+
+#if !HTTPD_POLL_EPOLL
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef ESP_PLATFORM
+#include <sys/select.h>
+#else
+#include "../port/win/network.h"
+#ifndef _WIN32
+#include <sys/select.h>
+#endif
+#endif
+
+#include <log.h>
+
+static const char *TAG = "httpd_poll";
+
+struct poll_entry {
+    int fd;
+    uint32_t events;
+    void *data;
+};
+
+struct httpd_poller {
+    struct poll_entry *entries;
+    int count;
+    int capacity;
+};
+
+esp_err_t httpd_poll_create(httpd_poller_t **poller, int max_fds)
+{
+    if (!poller) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct httpd_poller *p = calloc(1, sizeof(struct httpd_poller));
+    if (!p) {
+        return ESP_ERR_NO_MEM;
+    }
+    p->capacity = max_fds > 0 ? max_fds : 8;
+    p->entries = calloc(p->capacity, sizeof(struct poll_entry));
+    if (!p->entries) {
+        free(p);
+        return ESP_ERR_NO_MEM;
+    }
+    *poller = p;
+    return ESP_OK;
+}
+
+void httpd_poll_destroy(httpd_poller_t *poller)
+{
+    if (!poller) {
+        return;
+    }
+    free(poller->entries);
+    free(poller);
+}
+
+static struct poll_entry *find_entry(httpd_poller_t *poller, int fd)
+{
+    for (int i = 0; i < poller->count; i++) {
+        if (poller->entries[i].fd == fd) {
+            return &poller->entries[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t httpd_poll_add(httpd_poller_t *poller, int fd, uint32_t events, void *data)
+{
+    if (!poller || fd < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (find_entry(poller, fd)) {
+        LOGD(TAG, "fd %d already registered", fd);
+        return ESP_FAIL;
+    }
+#ifdef _WIN32
+    /* A winsock fd_set is a list of up to FD_SETSIZE sockets */
+    if (poller->count >= FD_SETSIZE) {
+#else
+    /* An fd_set is a bitmap of the descriptors below FD_SETSIZE */
+    if (fd >= FD_SETSIZE) {
+#endif
+        LOGW(TAG, "fd %d does not fit in an fd_set", fd);
+        return ESP_FAIL;
+    }
+    if (poller->count == poller->capacity) {
+        int capacity = poller->capacity * 2;
+        struct poll_entry *entries = realloc(poller->entries, capacity * sizeof(struct poll_entry));
+        if (!entries) {
+            return ESP_ERR_NO_MEM;
+        }
+        poller->entries = entries;
+        poller->capacity = capacity;
+    }
+    struct poll_entry *e = &poller->entries[poller->count++];
+    e->fd = fd;
+    e->events = events;
+    e->data = data;
+    return ESP_OK;
+}
+
+esp_err_t httpd_poll_mod(httpd_poller_t *poller, int fd, uint32_t events, void *data)
+{
+    if (!poller || fd < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct poll_entry *e = find_entry(poller, fd);
+    if (!e) {
+        return ESP_FAIL;
+    }
+    e->events = events;
+    e->data = data;
+    return ESP_OK;
+}
+
+esp_err_t httpd_poll_del(httpd_poller_t *poller, int fd)
+{
+    if (!poller || fd < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct poll_entry *e = find_entry(poller, fd);
+    if (!e) {
+        return ESP_FAIL;
+    }
+    /* Order of entries is irrelevant, fill the hole with the last one */
+    *e = poller->entries[--poller->count];
+    return ESP_OK;
+}
+
+int httpd_poll_wait(httpd_poller_t *poller, httpd_poll_event_t *events, int max_events, int timeout_ms)
+{
+    if (!poller || !events || max_events <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fd_set read_set, write_set;
+    FD_ZERO(&read_set);
+    FD_ZERO(&write_set);
+    int maxfd = -1;
+    for (int i = 0; i < poller->count; i++) {
+        struct poll_entry *e = &poller->entries[i];
+        if (e->events & HTTPD_POLL_IN) {
+            FD_SET(e->fd, &read_set);
+        }
+        if (e->events & HTTPD_POLL_OUT) {
+            FD_SET(e->fd, &write_set);
+        }
+        if ((e->events & (HTTPD_POLL_IN | HTTPD_POLL_OUT)) && e->fd > maxfd) {
+            maxfd = e->fd;
+        }
+    }
+
+    struct timeval timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000
+    };
+    LOGD(TAG, "doing select maxfd+1 = %d", maxfd + 1);
+    int active_cnt = select(maxfd + 1, &read_set, &write_set, NULL, timeout_ms < 0 ? NULL : &timeout);
+    if (active_cnt <= 0) {
+        return active_cnt;
+    }
+
+    /* Level triggered: descriptors which do not fit are reported on the next call */
+    int n = 0;
+    for (int i = 0; i < poller->count && n < max_events; i++) {
+        struct poll_entry *e = &poller->entries[i];
+        uint32_t ev = 0;
+        if ((e->events & HTTPD_POLL_IN) && FD_ISSET(e->fd, &read_set)) {
+            ev |= HTTPD_POLL_IN;
+        }
+        if ((e->events & HTTPD_POLL_OUT) && FD_ISSET(e->fd, &write_set)) {
+            ev |= HTTPD_POLL_OUT;
+        }
+        if (ev) {
+            events[n].data = e->data;
+            events[n].events = ev;
+            n++;
+        }
+    }
+    return n;
+}
+
+#endif /* !HTTPD_POLL_EPOLL */
@@ -0,0 +1,123 @@
+/*
+ * SPDX-FileCopyrightText: 2018-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define HTTPD_TIMER_MASK   (HTTPD_TIMER_SLOTS - 1)
+#define HTTPD_TIMER_RANGE  ((uint64_t) 1 << (HTTPD_TIMER_LEVELS * HTTPD_TIMER_BITS))
+
+static void httpd_timer_link(httpd_timer_t **slot, httpd_timer_t *timer)
+{
+    timer->next = *slot;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+static void httpd_timer_unlink(httpd_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/* Link a timer into the slot matching its distance from the next tick.
+ * A slot of level n is moved down when the ticks of the levels below
+ * wrap around to it, which is never before the timers in it are due */
+static void httpd_timer_place(httpd_timer_wheel_t *wheel, httpd_timer_t *timer)
+{
+    if (timer->expires < wheel->now) {
+        // Overdue, it expires with the next tick
+        timer->expires = wheel->now;
+    } else if (timer->expires - wheel->now >= HTTPD_TIMER_RANGE) {
+        timer->expires = wheel->now + HTTPD_TIMER_RANGE - 1;
+    }
+    uint64_t delta = timer->expires - wheel->now;
+    int level = 0;
+    while (level < HTTPD_TIMER_LEVELS - 1 &&
+           delta >= ((uint64_t) 1 << ((level + 1) * HTTPD_TIMER_BITS))) {
+        level++;
+    }
+    int index = (timer->expires >> (level * HTTPD_TIMER_BITS)) & HTTPD_TIMER_MASK;
+    httpd_timer_link(&wheel->slots[level][index], timer);
+}
+
+/* Move the timers of a slot to the levels below */
+static void httpd_timer_cascade(httpd_timer_wheel_t *wheel, int level, int index)
+{
+    httpd_timer_t *timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (timer) {
+        httpd_timer_t *next = timer->next;
+        timer->next = NULL;
+        timer->pprev = NULL;
+        httpd_timer_place(wheel, timer);
+        timer = next;
+    }
+}
+
+void httpd_timer_wheel_init(httpd_timer_wheel_t *wheel, uint64_t now_ms)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now_ms / HTTPD_TIMER_TICK_MS;
+}
+
+void httpd_timer_arm(httpd_timer_wheel_t *wheel, httpd_timer_t *timer, uint32_t timeout_ms)
+{
+    if (httpd_timer_armed(timer)) {
+        httpd_timer_unlink(timer);
+    } else {
+        wheel->armed++;
+    }
+    timer->expires = wheel->now + (timeout_ms + HTTPD_TIMER_TICK_MS - 1) / HTTPD_TIMER_TICK_MS;
+    httpd_timer_place(wheel, timer);
+}
+
+void httpd_timer_cancel(httpd_timer_wheel_t *wheel, httpd_timer_t *timer)
+{
+    if (httpd_timer_armed(timer)) {
+        httpd_timer_unlink(timer);
+        wheel->armed--;
+    }
+}
+
+void httpd_timer_wheel_advance(httpd_timer_wheel_t *wheel, uint64_t now_ms,
+                               httpd_timer_fn_t fn, void *arg)
+{
+    uint64_t target = now_ms / HTTPD_TIMER_TICK_MS;
+    while (wheel->now <= target) {
+        if (!wheel->armed) {
+            // Nothing to expire, skip the remaining ticks
+            wheel->now = target + 1;
+            break;
+        }
+        int index = wheel->now & HTTPD_TIMER_MASK;
+        if (!index) {
+            for (int level = 1; level < HTTPD_TIMER_LEVELS; level++) {
+                int level_index = (wheel->now >> (level * HTTPD_TIMER_BITS)) & HTTPD_TIMER_MASK;
+                httpd_timer_cascade(wheel, level, level_index);
+                if (level_index) {
+                    break;
+                }
+            }
+        }
+        httpd_timer_t **slot = &wheel->slots[0][index];
+        while (*slot) {
+            httpd_timer_t *timer = *slot;
+            httpd_timer_unlink(timer);
+            wheel->armed--;
+            fn(timer, arg);
+        }
+        wheel->now++;
+    }
+}
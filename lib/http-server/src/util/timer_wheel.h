@@ -0,0 +1,103 @@
+/*
+ * SPDX-FileCopyrightText: 2018-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * \file timer_wheel.h
+ * \brief Hierarchical timer wheel for the deadlines of a server loop
+ *
+ * Timers are intrusive nodes kept in one of HTTPD_TIMER_LEVELS wheels of
+ * HTTPD_TIMER_SLOTS slots. The first wheel holds the timers due within
+ * HTTPD_TIMER_SLOTS ticks, each further wheel covers HTTPD_TIMER_SLOTS
+ * times the range of the previous one, and its slots are moved down a
+ * level as time reaches them. Arming and cancelling a timer is O(1), and
+ * advancing the wheel costs one step per elapsed tick plus the timers
+ * expiring. Deadlines beyond the range of the last wheel are clamped.
+ *
+ * A wheel is not thread safe, it belongs to the loop advancing it.
+ */
+#ifndef _HTTPD_TIMER_WHEEL_H_
+#define _HTTPD_TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTTPD_TIMER_TICK_MS   10  /*!< Resolution of the wheel */
+#define HTTPD_TIMER_BITS      6
+#define HTTPD_TIMER_SLOTS     (1 << HTTPD_TIMER_BITS)
+#define HTTPD_TIMER_LEVELS    4   /*!< Deadlines up to ~46 hours ahead */
+
+/**
+ * @brief A timer, embedded in the structure it times out
+ */
+typedef struct httpd_timer {
+    struct httpd_timer *next;   /*!< Next timer of the slot */
+    struct httpd_timer **pprev; /*!< Link pointing at this timer, NULL while not armed */
+    uint64_t expires;           /*!< Tick at which the timer expires */
+} httpd_timer_t;
+
+typedef struct {
+    uint64_t now;               /*!< Next tick to be processed */
+    int armed;                  /*!< Number of armed timers */
+    httpd_timer_t *slots[HTTPD_TIMER_LEVELS][HTTPD_TIMER_SLOTS];
+} httpd_timer_wheel_t;
+
+/**
+ * @brief Callback for an expired timer, which is no longer armed when called
+ *        and may be armed again
+ */
+typedef void (*httpd_timer_fn_t)(httpd_timer_t *timer, void *arg);
+
+/**
+ * @brief Initialize an empty wheel
+ *
+ * @param[in] wheel   Wheel to initialize
+ * @param[in] now_ms  Current time, in milliseconds
+ */
+void httpd_timer_wheel_init(httpd_timer_wheel_t *wheel, uint64_t now_ms);
+
+/**
+ * @brief Arm a timer, or move it if it is armed already
+ *
+ * @param[in] wheel       Wheel to arm the timer in
+ * @param[in] timer       Timer
+ * @param[in] timeout_ms  Time from the last tick processed until expiry
+ */
+void httpd_timer_arm(httpd_timer_wheel_t *wheel, httpd_timer_t *timer, uint32_t timeout_ms);
+
+/**
+ * @brief Cancel a timer. Nothing is done if it is not armed
+ *
+ * @param[in] wheel   Wheel the timer is armed in
+ * @param[in] timer   Timer
+ */
+void httpd_timer_cancel(httpd_timer_wheel_t *wheel, httpd_timer_t *timer);
+
+static inline bool httpd_timer_armed(const httpd_timer_t *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/**
+ * @brief Process the ticks elapsed until now_ms, calling fn for each
+ *        timer expiring
+ *
+ * @param[in] wheel   Wheel to advance
+ * @param[in] now_ms  Current time, in milliseconds
+ * @param[in] fn      Callback for expired timers
+ * @param[in] arg     Argument for fn
+ */
+void httpd_timer_wheel_advance(httpd_timer_wheel_t *wheel, uint64_t now_ms,
+                               httpd_timer_fn_t fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! _HTTPD_TIMER_WHEEL_H_ */
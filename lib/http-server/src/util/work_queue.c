@@ -0,0 +1,244 @@
+/*
+ * SPDX-FileCopyrightText: 2018-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "work_queue.h"
+
+#if HTTPD_WORK_QUEUE_EVENTFD
+#include <unistd.h>
+#include <sys/eventfd.h>
+#else
+#ifdef ESP_PLATFORM
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#else
+#include "../port/win/network.h"
+#endif
+#include "ctrl_sock.h"
+#endif
+
+#include <log.h>
+
+static const char *TAG = "httpd_work";
+
+/* A slot of the ring. seq tells who owns it: the producer which will
+ * fill position pos when seq == pos, the consumer when seq == pos + 1 */
+struct work_cell {
+    size_t seq;
+    httpd_work_queue_fn_t fn;
+    void *arg;
+};
+
+struct httpd_work_queue {
+    struct work_cell *cells;
+    size_t mask;
+    size_t capacity;            /*!< Maximum number of pending items */
+    size_t enqueue_pos;         /*!< Next position to fill, shared by the producers */
+    size_t dequeue_pos;         /*!< Next position to run, only moved by the loop */
+    int signalled;              /*!< The doorbell was rung and the loop did not run yet */
+    int rx_fd;                  /*!< Doorbell watched by the loop */
+#if !HTTPD_WORK_QUEUE_EVENTFD
+    int tx_fd;                  /*!< Socket ringing the doorbell */
+    int port;
+#endif
+};
+
+static esp_err_t httpd_work_queue_ring(httpd_work_queue_t *queue)
+{
+#if HTTPD_WORK_QUEUE_EVENTFD
+    uint64_t one = 1;
+    if (write(queue->rx_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+        return ESP_FAIL;
+    }
+#else
+    char one = 1;
+    if (cs_send_to_ctrl_sock(queue->tx_fd, queue->port, &one, sizeof(one)) < 0) {
+        return ESP_FAIL;
+    }
+#endif
+    return ESP_OK;
+}
+
+static void httpd_work_queue_answer(httpd_work_queue_t *queue)
+{
+#if HTTPD_WORK_QUEUE_EVENTFD
+    uint64_t count;
+    if (read(queue->rx_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        LOGW(TAG, "error in read (%d)", errno);
+    }
+#else
+    /* Only one datagram is sent per wakeup */
+    char buf[8];
+    if (cs_recv_from_ctrl_sock(queue->rx_fd, buf, sizeof(buf)) < 0) {
+        LOGW(TAG, "error in recv (%d)", errno);
+    }
+#endif
+}
+
+esp_err_t httpd_work_queue_create(httpd_work_queue_t **queue, unsigned capacity, int port)
+{
+    size_t cells = 2;
+    while (cells < capacity) {
+        cells <<= 1;
+    }
+    httpd_work_queue_t *q = calloc(1, sizeof(*q));
+    if (!q || !(q->cells = calloc(cells, sizeof(struct work_cell)))) {
+        free(q);
+        return ESP_ERR_NO_MEM;
+    }
+    q->mask = cells - 1;
+    q->capacity = capacity ? capacity : 1;
+    for (size_t i = 0; i < cells; i++) {
+        q->cells[i].seq = i;
+    }
+
+#if HTTPD_WORK_QUEUE_EVENTFD
+    (void) port;
+    q->rx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->rx_fd < 0) {
+        LOGE(TAG, "error in eventfd (%d)", errno);
+        free(q->cells);
+        free(q);
+        return ESP_FAIL;
+    }
+#else
+    q->port = port;
+    q->rx_fd = cs_create_ctrl_sock(port);
+    if (q->rx_fd < 0) {
+        LOGE(TAG, "error in creating ctrl socket (%d) for port %d", errno, port);
+        free(q->cells);
+        free(q);
+        return ESP_FAIL;
+    }
+    q->tx_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (q->tx_fd < 0) {
+        LOGE(TAG, "error in creating msg socket (%d)", errno);
+        cs_free_ctrl_sock(q->rx_fd);
+        free(q->cells);
+        free(q);
+        return ESP_FAIL;
+    }
+#endif
+    *queue = q;
+    return ESP_OK;
+}
+
+void httpd_work_queue_destroy(httpd_work_queue_t *queue)
+{
+    if (!queue) {
+        return;
+    }
+#if HTTPD_WORK_QUEUE_EVENTFD
+    close(queue->rx_fd);
+#else
+    cs_free_ctrl_sock(queue->rx_fd);
+    close(queue->tx_fd);
+#endif
+    free(queue->cells);
+    free(queue);
+}
+
+int httpd_work_queue_fd(const httpd_work_queue_t *queue)
+{
+    return queue->rx_fd;
+}
+
+esp_err_t httpd_work_queue_enqueue(httpd_work_queue_t *queue, httpd_work_queue_fn_t fn, void *arg)
+{
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    struct work_cell *cell;
+    for (;;) {
+        if (pos - __atomic_load_n(&queue->dequeue_pos, __ATOMIC_ACQUIRE) >= queue->capacity) {
+            return ESP_ERR_NO_MEM;
+        }
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The loop did not run the item a full ring ago yet
+            return ESP_ERR_NO_MEM;
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    cell->fn = fn;
+    cell->arg = arg;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+esp_err_t httpd_work_queue_notify(httpd_work_queue_t *queue)
+{
+    if (__atomic_exchange_n(&queue->signalled, 1, __ATOMIC_SEQ_CST) == 0 &&
+        httpd_work_queue_ring(queue) != ESP_OK) {
+        /* The items stay queued, let the next producer ring again */
+        __atomic_store_n(&queue->signalled, 0, __ATOMIC_SEQ_CST);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_work_queue_push(httpd_work_queue_t *queue, httpd_work_queue_fn_t fn, void *arg)
+{
+    esp_err_t ret = httpd_work_queue_enqueue(queue, fn, arg);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    /* The item is queued either way, it runs once the doorbell is rung
+     * again, by the next item queued */
+    if (httpd_work_queue_notify(queue) != ESP_OK) {
+        LOGW(TAG, "failed to ring the doorbell");
+    }
+    return ESP_OK;
+}
+
+size_t httpd_work_queue_depth(const httpd_work_queue_t *queue)
+{
+    size_t dequeue_pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED) - dequeue_pos;
+}
+
+size_t httpd_work_queue_capacity(const httpd_work_queue_t *queue)
+{
+    return queue->capacity;
+}
+
+int httpd_work_queue_run(httpd_work_queue_t *queue)
+{
+    httpd_work_queue_answer(queue);
+    /* Items queued from here on ring the doorbell again */
+    __atomic_store_n(&queue->signalled, 0, __ATOMIC_SEQ_CST);
+
+    int run = 0;
+    while (run < (int) queue->capacity) {
+        struct work_cell *cell = &queue->cells[queue->dequeue_pos & queue->mask];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != queue->dequeue_pos + 1) {
+            return run;
+        }
+        httpd_work_queue_fn_t fn = cell->fn;
+        void *arg = cell->arg;
+        __atomic_store_n(&cell->seq, queue->dequeue_pos + queue->mask + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&queue->dequeue_pos, queue->dequeue_pos + 1, __ATOMIC_RELEASE);
+        fn(arg);
+        run++;
+    }
+
+    /* Leave the rest for the next iteration of the loop */
+    if (__atomic_exchange_n(&queue->signalled, 1, __ATOMIC_SEQ_CST) == 0 &&
+        httpd_work_queue_ring(queue) != ESP_OK) {
+        LOGW(TAG, "failed to ring the doorbell");
+    }
+    return run;
+}
@@ -0,0 +1,130 @@
+/*
+ * SPDX-FileCopyrightText: 2018-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * \file work_queue.h
+ * \brief Work queue waking up a server loop
+ *
+ * Any thread may push work items, only the loop owning the queue runs
+ * them. Items are kept in a bounded lock-free ring, and the loop is woken
+ * up through a doorbell descriptor it watches with its poller: an eventfd
+ * on Linux hosts, a loopback UDP socket elsewhere (lwIP and Windows can
+ * only select() on sockets). The doorbell is only rung when the loop is
+ * not signalled already, so a burst of items costs one wakeup and the loop
+ * runs all of them at once.
+ */
+#ifndef _HTTPD_WORK_QUEUE_H_
+#define _HTTPD_WORK_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_err.h>
+#else
+#include "../port/events.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+#define HTTPD_WORK_QUEUE_EVENTFD 1
+#else
+#define HTTPD_WORK_QUEUE_EVENTFD 0
+#endif
+
+typedef struct httpd_work_queue httpd_work_queue_t;
+
+typedef void (*httpd_work_queue_fn_t)(void *arg);
+
+/**
+ * @brief Create a work queue
+ *
+ * @param[out] queue     Created queue
+ * @param[in]  capacity  Maximum number of pending items
+ * @param[in]  port      Loopback port of the doorbell, where no eventfd is available
+ *
+ * @return
+ *  - ESP_OK          : queue created
+ *  - ESP_ERR_NO_MEM  : out of memory
+ *  - ESP_FAIL        : doorbell could not be created
+ */
+esp_err_t httpd_work_queue_create(httpd_work_queue_t **queue, unsigned capacity, int port);
+
+/**
+ * @brief Destroy a work queue, pending items are dropped
+ *
+ * @param[in] queue Queue to destroy, may be NULL
+ */
+void httpd_work_queue_destroy(httpd_work_queue_t *queue);
+
+/**
+ * @brief Descriptor becoming readable when items are pending
+ */
+int httpd_work_queue_fd(const httpd_work_queue_t *queue);
+
+/**
+ * @brief Queue an item, from any thread
+ *
+ * If the doorbell cannot be rung, the item stays queued and the next
+ * item queued rings it again.
+ *
+ * @return
+ *  - ESP_OK              : item queued
+ *  - ESP_ERR_NO_MEM      : the queue is full
+ */
+esp_err_t httpd_work_queue_push(httpd_work_queue_t *queue, httpd_work_queue_fn_t fn, void *arg);
+
+/**
+ * @brief Queue an item without ringing the doorbell, from any thread
+ *
+ * Used to queue several items at once, httpd_work_queue_notify() must be
+ * called afterwards for the loop to run them.
+ *
+ * @return
+ *  - ESP_OK              : item queued
+ *  - ESP_ERR_NO_MEM      : the queue is full
+ */
+esp_err_t httpd_work_queue_enqueue(httpd_work_queue_t *queue, httpd_work_queue_fn_t fn, void *arg);
+
+/**
+ * @brief Wake up the loop for the items queued, unless it is signalled already
+ *
+ * @return
+ *  - ESP_OK              : the loop will run the items
+ *  - ESP_FAIL            : the doorbell could not be rung
+ */
+esp_err_t httpd_work_queue_notify(httpd_work_queue_t *queue);
+
+/**
+ * @brief Number of items queued and not run yet. Only a snapshot when
+ *        other threads are queueing
+ */
+size_t httpd_work_queue_depth(const httpd_work_queue_t *queue);
+
+/**
+ * @brief Maximum number of pending items
+ */
+size_t httpd_work_queue_capacity(const httpd_work_queue_t *queue);
+
+/**
+ * @brief Run the pending items, from the loop owning the queue
+ *
+ * At most the capacity of the queue is run, the doorbell is rung again if
+ * more items were queued meanwhile, so producers cannot starve the loop.
+ *
+ * @return Number of items run
+ */
+int httpd_work_queue_run(httpd_work_queue_t *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! _HTTPD_WORK_QUEUE_H_ */
@@ -296,10 +296,11 @@ http_test_client_err_t http_test_client_send_request(http_test_client_handle_t *
         request_len += strlen(content_length_hdr);
     }
 
-    // Conditionally add Connection: close
+    // Conditionally add Connection: close, or keep-alive when the client asks for it
     bool is_websocket_upgrade = (headers_str != NULL && strstr(headers_str, "Upgrade: websocket") != NULL);
+    const char *connection_hdr = client_handle->keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
     if (!is_websocket_upgrade) {
-        request_len += strlen("Connection: close\r\n");
+        request_len += strlen(connection_hdr);
     }
     request_len += strlen("\r\n"); // End of headers
 
@@ -319,7 +320,7 @@ http_test_client_err_t http_test_client_send_request(http_test_client_handle_t *
         strcat(full_request, content_length_hdr);
     }
     if (!is_websocket_upgrade) {
-        strcat(full_request, "Connection: close\r\n");
+        strcat(full_request, connection_hdr);
     }
     strcat(full_request, "\r\n"); // End of headers
 
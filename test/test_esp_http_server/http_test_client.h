@@ -26,6 +26,7 @@ typedef enum {
 
 typedef struct {
     int sockfd;
+    bool keep_alive; // Ask for Connection: keep-alive instead of close, never on upgrade requests
     // Add any other client-specific state here, e.g., connection status
 } http_test_client_handle_t;
 
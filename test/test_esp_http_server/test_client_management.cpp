@@ -303,12 +303,1074 @@ void given_server_with_multiple_clients_when_rapid_connections_then_server_handl
     httpd_stop(handle);
 }
 
+
+/**
+ * Test: given_idle_keep_alive_clients_when_another_client_sends_requests_then_it_is_served
+ *
+ * Purpose: Verify that the server loop serves an active client promptly while other
+ *          keep-alive connections stay open and idle.
+ * Expected: Every request of the active client on its persistent connection gets a 200 OK.
+ */
+void given_idle_keep_alive_clients_when_another_client_sends_requests_then_it_is_served(void)
+{
+    // Given: A running server with several idle keep-alive connections
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9021; // Use a unique port
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t test_uri = {
+        .uri      = "/active",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+
+    const int num_idle = 4;
+    http_test_client_handle_t *idle_clients[num_idle];
+    for (int i = 0; i < num_idle; ++i) {
+        idle_clients[i] = http_test_client_init();
+        TEST_ASSERT_NOT_NULL(idle_clients[i]);
+        idle_clients[i]->keep_alive = true;
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(idle_clients[i], "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    }
+
+    // When: Another client sends several requests over one connection
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    client->keep_alive = true;
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+
+    // Then: Every request is answered
+    for (int i = 0; i < 5; ++i) {
+        http_test_response_t response = {0};
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/active", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+        TEST_ASSERT_EQUAL(200, response.status_code);
+        http_test_client_free_response(&response);
+    }
+
+    // And all the connections are still open
+    size_t fds = config.max_open_sockets;
+    int client_fds[10];
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_client_list(handle, &fds, client_fds));
+    TEST_ASSERT_EQUAL(num_idle + 1, fds);
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    for (int i = 0; i < num_idle; ++i) {
+        http_test_client_disconnect(idle_clients[i]);
+    }
+    httpd_stop(handle);
+}
+
+static void async_complete_task(void *arg)
+{
+    httpd_req_t *req = (httpd_req_t *)arg;
+    httpd_os_thread_sleep(50);
+    httpd_resp_send(req, "ASYNC", HTTPD_RESP_USE_STRLEN);
+    httpd_req_async_handler_complete(req);
+    httpd_os_thread_delete();
+}
+
+/**
+ * Test: given_async_handler_when_request_is_completed_from_another_task_then_connection_serves_next_request
+ *
+ * Purpose: Verify that a connection handed over to an asynchronous handler is watched again by the
+ *          server once httpd_req_async_handler_complete() is called.
+ * Expected: Both requests sent over the same connection are answered by the asynchronous handler.
+ */
+void given_async_handler_when_request_is_completed_from_another_task_then_connection_serves_next_request(void)
+{
+    // Given: A running server with a handler completing requests from another task
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9022; // Use a unique port
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t async_uri = {
+        .uri      = "/async",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            httpd_req_t *copy = NULL;
+            if (httpd_req_async_handler_begin(req, &copy) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            othread_t task;
+            if (httpd_os_thread_create(&task, "async", 16384, 5, async_complete_task, copy, 0, 0) != OS_SUCCESS) {
+                httpd_req_async_handler_complete(copy);
+                return ESP_FAIL;
+            }
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &async_uri));
+
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+
+    // When: Two requests are sent one after the other on the same connection
+    // Then: Both are answered
+    for (int i = 0; i < 2; ++i) {
+        http_test_response_t response = {0};
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/async", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+        TEST_ASSERT_EQUAL(200, response.status_code);
+        TEST_ASSERT_EQUAL_STRING_LEN("ASYNC", response.body, 5);
+        http_test_client_free_response(&response);
+    }
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+
+/**
+ * Test: given_max_open_sockets_above_lwip_default_when_many_clients_connect_then_all_are_served
+ *
+ * Purpose: Verify that on hosts max_open_sockets is not capped by the LwIP default of 15 sockets
+ *          and that the session table grows as clients connect.
+ * Expected: Server starts, every client gets a response and all connections are listed.
+ */
+void given_max_open_sockets_above_lwip_default_when_many_clients_connect_then_all_are_served(void)
+{
+    // Given: A running server allowing more clients than the LwIP default
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9023; // Use a unique port
+    config.max_open_sockets = 64;
+    config.backlog_conn = 64;
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t test_uri = {
+        .uri      = "/many",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+
+    // When: More clients than one chunk of session slots connect and send a request
+    const int num_clients = 40;
+    http_test_client_handle_t *clients[num_clients];
+    for (int i = 0; i < num_clients; ++i) {
+        clients[i] = http_test_client_init();
+        TEST_ASSERT_NOT_NULL(clients[i]);
+        clients[i]->keep_alive = true;
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(clients[i], "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    }
+
+    // Then: Every client is served
+    for (int i = 0; i < num_clients; ++i) {
+        http_test_response_t response = {0};
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(clients[i], HTTP_METHOD_GET, "/many", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+        TEST_ASSERT_EQUAL(200, response.status_code);
+        http_test_client_free_response(&response);
+    }
+
+    // And all of them are tracked by the server
+    size_t fds = config.max_open_sockets;
+    int *client_fds = (int*)malloc(sizeof(int) * fds);
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_client_list(handle, &fds, client_fds));
+    TEST_ASSERT_EQUAL(num_clients, fds);
+    free(client_fds);
+
+    // Cleanup
+    for (int i = 0; i < num_clients; ++i) {
+        http_test_client_disconnect(clients[i]);
+    }
+    httpd_stop(handle);
+}
+
+
+/**
+ * Test: given_worker_threads_when_many_clients_connect_then_connections_are_spread_across_loops
+ *
+ * Purpose: Verify that with several worker loops every client is served, that the connections
+ *          are shared between the loops and that the server handle reaches all of them.
+ *          The server has room for exactly as many clients as connect, so a loop the kernel
+ *          hands more than its even share to still serves them.
+ * Expected: Every client gets a response, more than one loop serves requests, all connections
+ *           are listed and can be closed through the handle returned by httpd_start().
+ */
+void given_worker_threads_when_many_clients_connect_then_connections_are_spread_across_loops(void)
+{
+    // Given: A running server with 4 worker loops and room for all the clients
+    const int num_clients = 16;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9024; // Use a unique port
+    config.max_open_sockets = num_clients;
+    config.backlog_conn = num_clients;
+    config.worker_threads = 4;
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t test_uri = {
+        .uri      = "/worker",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            // Reply with the loop serving the request
+            char body[32];
+            snprintf(body, sizeof(body), "%p", req->handle);
+            httpd_resp_send(req, body, HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+
+    // When: Several clients connect and send a request
+    http_test_client_handle_t *clients[num_clients];
+    for (int i = 0; i < num_clients; ++i) {
+        clients[i] = http_test_client_init();
+        TEST_ASSERT_NOT_NULL(clients[i]);
+        clients[i]->keep_alive = true;
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(clients[i], "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    }
+
+    // Then: Every client is served, by more than one loop
+    char loops[num_clients][32] = {{0}};
+    int loop_count = 0;
+    for (int i = 0; i < num_clients; ++i) {
+        http_test_response_t response = {0};
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(clients[i], HTTP_METHOD_GET, "/worker", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+        TEST_ASSERT_EQUAL(200, response.status_code);
+        TEST_ASSERT_TRUE(response.body_len < sizeof(loops[0]));
+        int j = 0;
+        while (j < loop_count && (strlen(loops[j]) != response.body_len ||
+                                  strncmp(loops[j], response.body, response.body_len) != 0)) {
+            ++j;
+        }
+        if (j == loop_count) {
+            memcpy(loops[loop_count++], response.body, response.body_len);
+        }
+        http_test_client_free_response(&response);
+    }
+    TEST_ASSERT_TRUE(loop_count > 1);
+
+    // And the connections of all the loops are visible through the server handle
+    size_t fds = config.max_open_sockets;
+    int *client_fds = (int*)malloc(sizeof(int) * fds);
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_client_list(handle, &fds, client_fds));
+    TEST_ASSERT_EQUAL(num_clients, fds);
+    for (size_t i = 0; i < fds; ++i) {
+        TEST_ASSERT_EQUAL(ESP_OK, httpd_sess_trigger_close(handle, client_fds[i]));
+    }
+    free(client_fds);
+
+    // Cleanup
+    for (int i = 0; i < num_clients; ++i) {
+        http_test_client_disconnect(clients[i]);
+    }
+    httpd_stop(handle);
+}
+
+
+/**
+ * Test: given_client_sending_request_in_pieces_when_another_client_sends_request_then_both_are_served
+ *
+ * Purpose: Verify that a client sending its request slowly does not hold up the server thread,
+ *          and that parsing of its request continues where it stopped when more data arrives.
+ * Expected: The second client is answered while the first request is incomplete, then the first
+ *           request is answered with the header value it carried.
+ */
+void given_client_sending_request_in_pieces_when_another_client_sends_request_then_both_are_served(void)
+{
+    // Given: A running server with a receive timeout far above the client timeout
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9025; // Use a unique port
+    config.recv_wait_timeout = 30;
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t test_uri = {
+        .uri      = "/slow",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            // Reply with the Host header, which arrives in a later piece
+            char host[32] = {0};
+            httpd_req_get_hdr_value_str(req, "Host", host, sizeof(host));
+            httpd_resp_send(req, host, HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+
+    // And a client which sent the start of its request only
+    http_test_client_handle_t *slow_client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(slow_client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(slow_client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    const char *pieces[] = { "GET /sl", "ow HTTP/1.1\r\nHo", "st: slowhost\r\nX-Test: 1\r\n\r\n" };
+    TEST_ASSERT_EQUAL(strlen(pieces[0]), send(slow_client->sockfd, pieces[0], strlen(pieces[0]), 0));
+    httpd_os_thread_sleep(50);
+    TEST_ASSERT_EQUAL(strlen(pieces[1]), send(slow_client->sockfd, pieces[1], strlen(pieces[1]), 0));
+    httpd_os_thread_sleep(50);
+
+    // When: Another client sends a complete request
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+
+    // Then: It is answered within the client timeout
+    http_test_response_t response = {0};
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/slow", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    http_test_client_free_response(&response);
+
+    // And the slow request is answered once its last piece arrives
+    TEST_ASSERT_EQUAL(strlen(pieces[2]), send(slow_client->sockfd, pieces[2], strlen(pieces[2]), 0));
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(slow_client->sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    char buffer[512] = {0};
+    int total = 0;
+    while (total < (int)sizeof(buffer) - 1 && strstr(buffer, "slowhost") == NULL) {
+        int ret = recv(slow_client->sockfd, buffer + total, sizeof(buffer) - 1 - total, 0);
+        if (ret <= 0) {
+            break;
+        }
+        total += ret;
+    }
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 200 OK"));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "slowhost"));
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    http_test_client_disconnect(slow_client);
+    httpd_stop(handle);
+}
+
+
+/**
+ * Test: given_many_sessions_when_some_close_then_remaining_sessions_are_found_by_descriptor
+ *
+ * Purpose: Verify that sessions are still found by their descriptor after other sessions of
+ *          the same loop came and went, as used by httpd_socket_send() outside of a request.
+ * Expected: Data sent with httpd_socket_send() reaches each remaining client, and the
+ *           descriptors of the closed sessions are no longer accepted.
+ */
+void given_many_sessions_when_some_close_then_remaining_sessions_are_found_by_descriptor(void)
+{
+    // Given: A running server
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9037; // Use a unique port
+    config.max_open_sockets = 24;
+    config.backlog_conn = 24;
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t test_uri = {
+        .uri      = "/fd",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            // Reply with the descriptor of the session on the server side
+            char body[16];
+            snprintf(body, sizeof(body), "%d", httpd_req_to_sockfd(req));
+            httpd_resp_send(req, body, HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+
+    // And many clients, each knowing its session descriptor
+    const int num_clients = 20;
+    http_test_client_handle_t *clients[num_clients];
+    int session_fds[num_clients];
+    for (int i = 0; i < num_clients; ++i) {
+        clients[i] = http_test_client_init();
+        TEST_ASSERT_NOT_NULL(clients[i]);
+        clients[i]->keep_alive = true;
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(clients[i], "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+        http_test_response_t response = {0};
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(clients[i], HTTP_METHOD_GET, "/fd", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+        TEST_ASSERT_EQUAL(200, response.status_code);
+        char body[16] = {0};
+        memcpy(body, response.body, response.body_len < sizeof(body) - 1 ? response.body_len : sizeof(body) - 1);
+        session_fds[i] = atoi(body);
+        http_test_client_free_response(&response);
+    }
+
+    // When: Every other client disconnects
+    for (int i = 0; i < num_clients; i += 2) {
+        http_test_client_disconnect(clients[i]);
+    }
+    httpd_os_thread_sleep(200);
+
+    // Then: The closed sessions are gone and the others are still found
+    for (int i = 0; i < num_clients; ++i) {
+        int ret = httpd_socket_send(handle, session_fds[i], "ping", 4, 0);
+        if (i % 2 == 0) {
+            TEST_ASSERT_EQUAL(HTTPD_SOCK_ERR_INVALID, ret);
+            continue;
+        }
+        TEST_ASSERT_EQUAL(4, ret);
+        char buffer[8] = {0};
+        TEST_ASSERT_EQUAL(4, recv(clients[i]->sockfd, buffer, sizeof(buffer) - 1, 0));
+        TEST_ASSERT_EQUAL_STRING("ping", buffer);
+    }
+
+    // Cleanup
+    for (int i = 1; i < num_clients; i += 2) {
+        http_test_client_disconnect(clients[i]);
+    }
+    httpd_stop(handle);
+}
+
+
+/**
+ * Test: given_all_session_slots_used_when_clients_reconnect_then_freed_slots_are_reused
+ *
+ * Purpose: Verify that the slots of closed sessions are handed out again, so that a full
+ *          server keeps accepting clients across several rounds of connections.
+ * Expected: Each round of max_open_sockets clients is served, and no more sessions than
+ *           max_open_sockets are ever listed.
+ */
+void given_all_session_slots_used_when_clients_reconnect_then_freed_slots_are_reused(void)
+{
+    // Given: A running server without LRU purge
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9038; // Use a unique port
+    config.max_open_sockets = 12;
+    config.backlog_conn = 12;
+    config.lru_purge_enable = false;
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t test_uri = {
+        .uri      = "/slot",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+
+    const int num_clients = 12;
+    http_test_client_handle_t *clients[num_clients];
+    for (int round = 0; round < 3; ++round) {
+        // When: As many clients as slots connect and send a request
+        for (int i = 0; i < num_clients; ++i) {
+            clients[i] = http_test_client_init();
+            TEST_ASSERT_NOT_NULL(clients[i]);
+            clients[i]->keep_alive = true;
+            TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(clients[i], "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+            http_test_response_t response = {0};
+            TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(clients[i], HTTP_METHOD_GET, "/slot", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+            TEST_ASSERT_EQUAL(200, response.status_code);
+            http_test_client_free_response(&response);
+        }
+
+        // Then: Every slot is in use
+        size_t fds = config.max_open_sockets;
+        int client_fds[12];
+        TEST_ASSERT_EQUAL(ESP_OK, httpd_get_client_list(handle, &fds, client_fds));
+        TEST_ASSERT_EQUAL(num_clients, fds);
+
+        // And the slots are released when the clients go away
+        for (int i = 0; i < num_clients; ++i) {
+            http_test_client_disconnect(clients[i]);
+        }
+        httpd_os_thread_sleep(200);
+        fds = config.max_open_sockets;
+        TEST_ASSERT_EQUAL(ESP_OK, httpd_get_client_list(handle, &fds, client_fds));
+        TEST_ASSERT_EQUAL(0, fds);
+    }
+
+    // Cleanup
+    httpd_stop(handle);
+}
+
+
+/**
+ * Test: given_lru_purge_when_a_client_is_used_again_then_next_least_recently_used_is_closed
+ *
+ * Purpose: Verify that a request moves its session away from eviction, so that LRU purge
+ *          closes the session which was idle for the longest, on the same accept.
+ * Expected: With clients A, B and C connected and A used again, a fourth client is served
+ *           and B is closed, while A and C are still served.
+ */
+void given_lru_purge_when_a_client_is_used_again_then_next_least_recently_used_is_closed(void)
+{
+    // Given: A running server with LRU purge and room for 3 sessions
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9039; // Use a unique port
+    config.max_open_sockets = 3;
+    config.lru_purge_enable = true;
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t test_uri = {
+        .uri      = "/lru",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+
+    // And clients A, B and C, served in that order, then A once more
+    const int order[] = { 0, 1, 2, 0 };
+    http_test_client_handle_t *clients[4];
+    for (int i = 0; i < 4; ++i) {
+        clients[i] = http_test_client_init();
+        TEST_ASSERT_NOT_NULL(clients[i]);
+        clients[i]->keep_alive = true;
+    }
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); ++i) {
+        http_test_client_handle_t *client = clients[order[i]];
+        if (i < 3) {
+            TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+        }
+        http_test_response_t response = {0};
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/lru", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+        TEST_ASSERT_EQUAL(200, response.status_code);
+        http_test_client_free_response(&response);
+    }
+
+    // When: A fourth client connects
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(clients[3], "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    http_test_response_t response = {0};
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(clients[3], HTTP_METHOD_GET, "/lru", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+
+    // Then: It is served
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    http_test_client_free_response(&response);
+
+    // And B was closed
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(clients[1]->sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    char buffer[32];
+    TEST_ASSERT_LESS_OR_EQUAL(0, recv(clients[1]->sockfd, buffer, sizeof(buffer), 0));
+
+    // And A and C are still served
+    for (int i = 0; i < 3; i += 2) {
+        http_test_response_t kept = {0};
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(clients[i], HTTP_METHOD_GET, "/lru", NULL, NULL, 0, &kept, TEST_TIMEOUT_MS));
+        TEST_ASSERT_EQUAL(200, kept.status_code);
+        http_test_client_free_response(&kept);
+    }
+
+    // Cleanup
+    for (int i = 0; i < 4; ++i) {
+        http_test_client_disconnect(clients[i]);
+    }
+    httpd_stop(handle);
+}
+
+
+static esp_err_t timeout_ok_handler(httpd_req_t *req)
+{
+    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+static httpd_handle_t start_timeout_server(httpd_config_t *config)
+{
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, config));
+    httpd_uri_t test_uri = {
+        .uri      = "/timeout",
+        .method   = HTTP_GET,
+        .handler  = timeout_ok_handler,
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+    return handle;
+}
+
+/* Read until the server closes the connection, returns what was received */
+static int recv_until_closed(int sockfd, char *buffer, size_t buffer_len, int timeout_sec)
+{
+    struct timeval tv;
+    tv.tv_sec = timeout_sec;
+    tv.tv_usec = 0;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    int total = 0;
+    while (total < (int)buffer_len - 1) {
+        int ret = recv(sockfd, buffer + total, buffer_len - 1 - total, 0);
+        if (ret == 0) {
+            buffer[total] = '\0';
+            return total;
+        }
+        if (ret < 0) {
+            return -1;
+        }
+        total += ret;
+    }
+    return -1;
+}
+
+/**
+ * Test: given_idle_timeout_when_connection_stays_idle_then_server_closes_it
+ *
+ * Purpose: Verify that a keep-alive connection without requests is closed once the idle
+ *          timeout runs out, without LRU purge.
+ * Expected: The connection is open right after a request and closed by the server
+ *           within a second past the timeout.
+ */
+void given_idle_timeout_when_connection_stays_idle_then_server_closes_it(void)
+{
+    // Given: A running server closing connections idle for a second
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9040; // Use a unique port
+    config.idle_timeout = 1;
+    httpd_handle_t handle = start_timeout_server(&config);
+
+    // And a client which was served
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    http_test_response_t response = {0};
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/timeout", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    http_test_client_free_response(&response);
+
+    // When: The connection stays idle
+    char buffer[256];
+    int ret = recv_until_closed(client->sockfd, buffer, sizeof(buffer), 3);
+
+    // Then: The server closed it without sending anything
+    TEST_ASSERT_EQUAL(0, ret);
+    size_t fds = config.max_open_sockets;
+    int client_fds[7];
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_client_list(handle, &fds, client_fds));
+    TEST_ASSERT_EQUAL(0, fds);
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+/**
+ * Test: given_header_timeout_when_request_is_not_completed_then_408_is_sent
+ *
+ * Purpose: Verify that a client sending part of a request header and then stalling is
+ *          answered with 408 and disconnected once the header deadline passes, even
+ *          though it keeps sending bytes.
+ * Expected: A 408 Request Timeout response followed by the connection being closed.
+ */
+void given_header_timeout_when_request_is_not_completed_then_408_is_sent(void)
+{
+    // Given: A running server giving clients a second for the request header
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9041; // Use a unique port
+    config.header_timeout = 1;
+    config.idle_timeout = 10;
+    httpd_handle_t handle = start_timeout_server(&config);
+
+    // When: A client sends its request header a byte at a time, too slowly
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    const char *piece = "GET /timeout HTTP/1.1\r\nX-Slow: ";
+    TEST_ASSERT_EQUAL(strlen(piece), send(client->sockfd, piece, strlen(piece), 0));
+    for (int i = 0; i < 6; ++i) {
+        httpd_os_thread_sleep(250);
+        send(client->sockfd, "a", 1, 0);
+    }
+
+    // Then: It gets a 408 and the connection is closed
+    char buffer[256];
+    TEST_ASSERT_GREATER_THAN(0, recv_until_closed(client->sockfd, buffer, sizeof(buffer), 3));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 408 Request Timeout"));
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+/**
+ * Test: given_max_keep_alive_requests_when_limit_is_reached_then_connection_is_closed
+ *
+ * Purpose: Verify that a connection is closed after the configured number of requests,
+ *          and that the last response announces it.
+ * Expected: The first response keeps the connection, the second carries
+ *           "Connection: close" and the server closes the connection after it.
+ */
+void given_max_keep_alive_requests_when_limit_is_reached_then_connection_is_closed(void)
+{
+    // Given: A running server serving 2 requests per connection
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9042; // Use a unique port
+    config.max_keep_alive_requests = 2;
+    httpd_handle_t handle = start_timeout_server(&config);
+
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    client->keep_alive = true;
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+
+    // When: The client sends a first request
+    http_test_response_t response = {0};
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/timeout", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+
+    // Then: The connection is kept
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    TEST_ASSERT_NULL(http_test_client_get_header(&response, "Connection"));
+    http_test_client_free_response(&response);
+
+    // When: The client sends a second request
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/timeout", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+
+    // Then: The response announces and the server performs the close
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    const char *connection = http_test_client_get_header(&response, "Connection");
+    TEST_ASSERT_NOT_NULL(connection);
+    TEST_ASSERT_EQUAL_STRING("close", connection);
+    free((void*)connection);
+    http_test_client_free_response(&response);
+    char buffer[64];
+    TEST_ASSERT_EQUAL(0, recv_until_closed(client->sockfd, buffer, sizeof(buffer), 1));
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+
+static void wait_for_mem_usage(httpd_handle_t handle, size_t expected)
+{
+    size_t used = expected + 1;
+    for (int i = 0; i < 100 && used != expected; ++i) {
+        httpd_os_thread_sleep(10);
+        TEST_ASSERT_EQUAL(ESP_OK, httpd_get_mem_usage(handle, &used, NULL));
+    }
+    TEST_ASSERT_EQUAL(expected, used);
+}
+
+/**
+ * Test: given_memory_budget_when_sessions_use_memory_then_usage_is_accounted
+ *
+ * Purpose: Verify that the memory of a session and what the application charges to it
+ *          are accounted to the session and to the server, and returned on close.
+ * Expected: An open session uses at least its slot, a charge adds to both the session
+ *           and the server, a release takes it back and closing returns everything.
+ */
+void given_memory_budget_when_sessions_use_memory_then_usage_is_accounted(void)
+{
+    // Given: A running server with a memory budget
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9047; // Use a unique port
+    config.mem_budget = 1024 * 1024;
+    httpd_handle_t handle = start_timeout_server(&config);
+    size_t used = 1, budget = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_mem_usage(handle, &used, &budget));
+    TEST_ASSERT_EQUAL(0, used);
+    TEST_ASSERT_EQUAL(config.mem_budget, budget);
+
+    // When: A client was served and keeps its connection
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    client->keep_alive = true;
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    http_test_response_t response = {0};
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/timeout", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    http_test_client_free_response(&response);
+
+    // Then: Its session uses at least its slot, as does the server
+    size_t fds = config.max_open_sockets;
+    int client_fds[7];
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_client_list(handle, &fds, client_fds));
+    TEST_ASSERT_EQUAL(1, fds);
+    size_t sess_used = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_sess_get_mem_usage(handle, client_fds[0], &sess_used));
+    TEST_ASSERT_GREATER_OR_EQUAL(sizeof(struct sock_db), sess_used);
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_mem_usage(handle, &used, NULL));
+    TEST_ASSERT_EQUAL(sess_used, used);
+
+    // And: Application charges add to both, and are released
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_sess_charge_mem(handle, client_fds[0], 1000));
+    size_t charged = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_sess_get_mem_usage(handle, client_fds[0], &charged));
+    TEST_ASSERT_EQUAL(sess_used + 1000, charged);
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_mem_usage(handle, &used, NULL));
+    TEST_ASSERT_EQUAL(sess_used + 1000, used);
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_sess_release_mem(handle, client_fds[0], 400));
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_mem_usage(handle, &used, NULL));
+    TEST_ASSERT_EQUAL(sess_used + 600, used);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, httpd_sess_charge_mem(handle, -1, 1));
+
+    // And: Closing the connection returns everything, the charge left included
+    http_test_client_disconnect(client);
+    wait_for_mem_usage(handle, 0);
+
+    // Cleanup
+    httpd_stop(handle);
+}
+
+/**
+ * Test: given_memory_budget_used_up_when_clients_connect_and_send_requests_then_they_are_shed
+ *
+ * Purpose: Verify that once the memory budget is used up new connections are closed and
+ *          new requests are answered with 503, and that clients are served again once
+ *          the memory is returned.
+ * Expected: A new connection is closed without a response, the next request of the
+ *           connection holding the budget gets 503 Service Unavailable, and a client
+ *           connecting after that connection is closed is served.
+ */
+void given_memory_budget_used_up_when_clients_connect_and_send_requests_then_they_are_shed(void)
+{
+    // Given: A running server whose budget a first client used up
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9048; // Use a unique port
+    config.mem_budget = 64 * 1024;
+    httpd_handle_t handle = start_timeout_server(&config);
+
+    http_test_client_handle_t *hog = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(hog);
+    hog->keep_alive = true;
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(hog, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    http_test_response_t response = {0};
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(hog, HTTP_METHOD_GET, "/timeout", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    http_test_client_free_response(&response);
+
+    // Once its receive buffer is released, the rest is charged to its session
+    httpd_os_thread_sleep(100);
+    size_t fds = config.max_open_sockets;
+    int client_fds[7];
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_client_list(handle, &fds, client_fds));
+    TEST_ASSERT_EQUAL(1, fds);
+    size_t used = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_mem_usage(handle, &used, NULL));
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_sess_charge_mem(handle, client_fds[0], config.mem_budget - used));
+    TEST_ASSERT_EQUAL(ESP_ERR_HTTPD_MEM_BUDGET, httpd_sess_charge_mem(handle, client_fds[0], 1));
+
+    // When: Another client connects
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+
+    // Then: Its connection is closed without a response
+    char buffer[256];
+    TEST_ASSERT_EQUAL(0, recv_until_closed(client->sockfd, buffer, sizeof(buffer), 3));
+    http_test_client_disconnect(client);
+
+    // When: The first client sends another request
+    const char *request = "GET /timeout HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    TEST_ASSERT_EQUAL(strlen(request), send(hog->sockfd, request, strlen(request), 0));
+
+    // Then: It is shed with 503 and the connection closed, returning its memory
+    TEST_ASSERT_GREATER_THAN(0, recv_until_closed(hog->sockfd, buffer, sizeof(buffer), 3));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 503 Service Unavailable"));
+    http_test_client_disconnect(hog);
+    wait_for_mem_usage(handle, 0);
+
+    // And: A new client is served again
+    client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/timeout", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    http_test_client_free_response(&response);
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+static int burst_opened = 0;
+static int burst_opts_ok = 0;
+
+/* Check the options an accepted socket got, set or inherited from the listening socket */
+static esp_err_t burst_open_fn(httpd_handle_t hd, int sockfd)
+{
+    struct timeval rcv = {0}, snd = {0};
+    socklen_t len = sizeof(rcv);
+    int keep_alive = 0;
+    socklen_t keep_alive_len = sizeof(keep_alive);
+    bool ok = getsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&rcv, &len) == 0 && rcv.tv_sec == 7;
+    len = sizeof(snd);
+    ok = ok && getsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (char *)&snd, &len) == 0 && snd.tv_sec == 9;
+    ok = ok && getsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, (char *)&keep_alive, &keep_alive_len) == 0 && keep_alive;
+#ifdef __linux__
+    ok = ok && (fcntl(sockfd, F_GETFD) & FD_CLOEXEC);
+#endif
+    burst_opened++;
+    burst_opts_ok += ok;
+    return ESP_OK;
+}
+
+/**
+ * Test: given_connection_burst_when_clients_connect_at_once_then_all_are_accepted_with_configured_options
+ *
+ * Purpose: Verify that a burst of connections waiting in the backlog is accepted, and
+ *          that every accepted socket has the configured timeouts and keep-alive, whether
+ *          set on it or inherited from the listening socket.
+ * Expected: All the clients are served, and open_fn sees the configured options on
+ *           every socket.
+ */
+void given_connection_burst_when_clients_connect_at_once_then_all_are_accepted_with_configured_options(void)
+{
+    // Given: A running server with non-default socket options
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9049; // Use a unique port
+    config.max_open_sockets = 16;
+    config.backlog_conn = 16;
+    config.recv_wait_timeout = 7;
+    config.send_wait_timeout = 9;
+    config.keep_alive_enable = true;
+    config.open_fn = burst_open_fn;
+    burst_opened = 0;
+    burst_opts_ok = 0;
+    httpd_handle_t handle = start_timeout_server(&config);
+
+    // When: Clients connect all at once, then send their requests
+    const int count = 12;
+    http_test_client_handle_t *clients[count];
+    for (int i = 0; i < count; ++i) {
+        clients[i] = http_test_client_init();
+        TEST_ASSERT_NOT_NULL(clients[i]);
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(clients[i], "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    }
+
+    // Then: Every client is served
+    for (int i = 0; i < count; ++i) {
+        http_test_response_t response = {0};
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(clients[i], HTTP_METHOD_GET, "/timeout", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+        TEST_ASSERT_EQUAL(200, response.status_code);
+        http_test_client_free_response(&response);
+    }
+
+    // And: Every accepted socket had the configured options
+    TEST_ASSERT_EQUAL(count, burst_opened);
+    TEST_ASSERT_EQUAL(count, burst_opts_ok);
+
+    // Cleanup
+    for (int i = 0; i < count; ++i) {
+        http_test_client_disconnect(clients[i]);
+    }
+    httpd_stop(handle);
+}
+
+/**
+ * Test: given_defer_accept_and_fastopen_when_client_sends_request_then_listen_stats_report_them
+ *
+ * Purpose: Verify that the listening socket options are applied, the backlog is sized from
+ *          max_open_sockets when not configured, and accepted connections are counted
+ *          and probed with listen_stats set.
+ * Expected: The stats report the options as set on Linux, a backlog of max_open_sockets,
+ *           and one connection accepted with its request already received.
+ */
+void given_defer_accept_and_fastopen_when_client_sends_request_then_listen_stats_report_them(void)
+{
+    // Given: A running server deferring accepts, with Fast Open and an auto-sized backlog
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9050; // Use a unique port
+    config.backlog_conn = 0;
+    config.defer_accept_timeout = 1;
+    config.fastopen_queue_len = 8;
+    config.listen_stats = true;
+    httpd_handle_t handle = start_timeout_server(&config);
+
+    // When: A client sends a request
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    http_test_response_t response = {0};
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/timeout", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    http_test_client_free_response(&response);
+
+    // Then: The stats report the settings and the connection
+    httpd_listen_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_get_listen_stats(handle, &stats));
+    TEST_ASSERT_EQUAL(config.max_open_sockets, stats.backlog);
+    TEST_ASSERT_EQUAL(1, stats.accepted);
+#ifdef __linux__
+    TEST_ASSERT_TRUE(stats.defer_accept);
+    TEST_ASSERT_TRUE(stats.fastopen);
+    // The connection was only handed over once its request arrived
+    TEST_ASSERT_EQUAL(1, stats.accepted_with_data);
+#endif
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, httpd_get_listen_stats(handle, NULL));
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+/**
+ * Test: given_worker_threads_and_lru_purge_when_server_is_full_then_each_new_client_is_served
+ *
+ * Purpose: Verify that with several worker loops sharing a single session, a client accepted by
+ *          a loop without sessions of its own is served by having another loop close its least
+ *          recently used one, rather than being left waiting.
+ * Expected: Every client connecting while the previous one keeps its connection gets a response.
+ */
+void given_worker_threads_and_lru_purge_when_server_is_full_then_each_new_client_is_served(void)
+{
+    // Given: A running server with 2 worker loops sharing a single session
+    const int num_clients = 8;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9056; // Use a unique port
+    config.max_open_sockets = 1;
+    config.lru_purge_enable = true;
+    config.worker_threads = 2;
+    httpd_handle_t handle = start_timeout_server(&config);
+
+    // When: Clients connect one after the other, each keeping its connection
+    http_test_client_handle_t *clients[num_clients];
+    for (int i = 0; i < num_clients; ++i) {
+        clients[i] = http_test_client_init();
+        TEST_ASSERT_NOT_NULL(clients[i]);
+        clients[i]->keep_alive = true;
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(clients[i], "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+
+        // Then: Each one is served, whichever loop accepted it
+        http_test_response_t response = {0};
+        TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(clients[i], HTTP_METHOD_GET, "/timeout", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+        TEST_ASSERT_EQUAL(200, response.status_code);
+        http_test_client_free_response(&response);
+    }
+
+    // Cleanup
+    for (int i = 0; i < num_clients; ++i) {
+        http_test_client_disconnect(clients[i]);
+    }
+    httpd_stop(handle);
+}
+
 int test_client_management(void) {
     // UNITY_BEGIN();
     RUN_TEST(given_valid_server_when_calling_httpd_get_client_list_then_returns_client_fds);
     RUN_TEST(given_server_with_lru_enabled_when_max_sockets_exceeded_then_oldest_session_is_closed);
     RUN_TEST(given_server_with_open_close_callbacks_when_client_connects_and_disconnects_then_callbacks_are_invoked);
     RUN_TEST(given_server_with_multiple_clients_when_rapid_connections_then_server_handles_gracefully);
+    RUN_TEST(given_idle_keep_alive_clients_when_another_client_sends_requests_then_it_is_served);
+    RUN_TEST(given_async_handler_when_request_is_completed_from_another_task_then_connection_serves_next_request);
+    RUN_TEST(given_max_open_sockets_above_lwip_default_when_many_clients_connect_then_all_are_served);
+    RUN_TEST(given_worker_threads_when_many_clients_connect_then_connections_are_spread_across_loops);
+    RUN_TEST(given_client_sending_request_in_pieces_when_another_client_sends_request_then_both_are_served);
+    RUN_TEST(given_many_sessions_when_some_close_then_remaining_sessions_are_found_by_descriptor);
+    RUN_TEST(given_all_session_slots_used_when_clients_reconnect_then_freed_slots_are_reused);
+    RUN_TEST(given_lru_purge_when_a_client_is_used_again_then_next_least_recently_used_is_closed);
+    RUN_TEST(given_idle_timeout_when_connection_stays_idle_then_server_closes_it);
+    RUN_TEST(given_header_timeout_when_request_is_not_completed_then_408_is_sent);
+    RUN_TEST(given_max_keep_alive_requests_when_limit_is_reached_then_connection_is_closed);
+    RUN_TEST(given_memory_budget_when_sessions_use_memory_then_usage_is_accounted);
+    RUN_TEST(given_memory_budget_used_up_when_clients_connect_and_send_requests_then_they_are_shed);
+    RUN_TEST(given_connection_burst_when_clients_connect_at_once_then_all_are_accepted_with_configured_options);
+    RUN_TEST(given_defer_accept_and_fastopen_when_client_sends_request_then_listen_stats_report_them);
+    RUN_TEST(given_worker_threads_and_lru_purge_when_server_is_full_then_each_new_client_is_served);
     // return UNITY_END();
     return 0;
 }
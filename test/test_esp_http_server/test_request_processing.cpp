@@ -4,6 +4,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h> // Required for setvbuf
+#include <string>
+#include <chrono>
 #include "esp_httpd_priv.h" // For httpd_data, sock_db, httpd_req_aux, http_parser_url
 #include "http_test_client.h" // Include for http_test_client
 
@@ -72,40 +74,44 @@ void given_various_url_queries_when_calling_httpd_req_get_url_query_len_then_ret
     mock_req->aux = mock_req_aux;
     mock_req->handle = NULL; // Not strictly needed for these functions
 
+    // The URI is kept in a buffer of the request, as the server does
+    char uri_buf[HTTPD_MAX_URI_LEN + 1] = {0};
+    mock_req->uri = uri_buf;
+
     // Test case 1: URL with a simple query string
     const char* uri1 = "/path?param1=value1&param2=value2";
-    strncpy((char*)mock_req->uri, uri1, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0'; // Explicitly null-terminate
+    strncpy((char*)mock_req->uri, uri1, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0'; // Explicitly null-terminate
     http_parser_url_init(&mock_req_aux->url_parse_res); /* Initialize for each test case */
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
     size_t len1 = httpd_req_get_url_query_len(mock_req);
     TEST_ASSERT_EQUAL(27, len1); // "param1=value1&param2=value2" is 25 chars (as per http-parser docs)
 
     // Test case 2: URL with no query string
-    memset((char*)mock_req->uri, 0, sizeof(mock_req->uri)); // Clear buffer
+    memset((char*)mock_req->uri, 0, sizeof(uri_buf)); // Clear buffer
     const char* uri2 = "/path";
-    strncpy((char*)mock_req->uri, uri2, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0';
+    strncpy((char*)mock_req->uri, uri2, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0';
     http_parser_url_init(&mock_req_aux->url_parse_res); /* Initialize for each test case */
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
     size_t len2 = httpd_req_get_url_query_len(mock_req);
     TEST_ASSERT_EQUAL(0, len2);
 
     // Test case 3: URL with an empty query string (just '?')
-    memset((char*)mock_req->uri, 0, sizeof(mock_req->uri)); // Clear buffer
+    memset((char*)mock_req->uri, 0, sizeof(uri_buf)); // Clear buffer
     const char* uri3 = "/path?";
-    strncpy((char*)mock_req->uri, uri3, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0';
+    strncpy((char*)mock_req->uri, uri3, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0';
     http_parser_url_init(&mock_req_aux->url_parse_res); /* Initialize for each test case */
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
     size_t len3 = httpd_req_get_url_query_len(mock_req);
     TEST_ASSERT_EQUAL(0, len3); // The API returns 0 for an empty query string
 
     // Test case 4: URL with query string containing special characters
-    memset((char*)mock_req->uri, 0, sizeof(mock_req->uri)); // Clear buffer
+    memset((char*)mock_req->uri, 0, sizeof(uri_buf)); // Clear buffer
     const char* uri4 = "/search?q=hello%20world&id=123";
-    strncpy((char*)mock_req->uri, uri4, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0';
+    strncpy((char*)mock_req->uri, uri4, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0';
     http_parser_url_init(&mock_req_aux->url_parse_res); /* Initialize for each test case */
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
     size_t len4 = httpd_req_get_url_query_len(mock_req);
@@ -244,15 +250,19 @@ void given_various_url_queries_when_calling_httpd_req_get_url_query_str_then_ret
     mock_req->aux = mock_req_aux;
     mock_req->handle = NULL; // Not strictly needed for these functions
 
+    // The URI is kept in a buffer of the request, as the server does
+    char uri_buf[HTTPD_MAX_URI_LEN + 1] = {0};
+    mock_req->uri = uri_buf;
+
     char query_buf[64];
     esp_err_t ret;
 
     // Test case 1: URL with a simple query string
     const char* uri1 = "/path?param1=value1&param2=value2";
     LOGD(TAG, "Test Case 1: URI = %s", uri1);
-    memset((char*)mock_req->uri, 0, sizeof(mock_req->uri)); // Clear buffer
-    strncpy((char*)mock_req->uri, uri1, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0';
+    memset((char*)mock_req->uri, 0, sizeof(uri_buf)); // Clear buffer
+    strncpy((char*)mock_req->uri, uri1, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0';
     LOGD(TAG, "mock_req->uri after strncpy: %s, strlen: %zu", mock_req->uri, strlen(mock_req->uri));
     http_parser_url_init(&mock_req_aux->url_parse_res); /* Initialize for each test case */
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
@@ -263,9 +273,9 @@ void given_various_url_queries_when_calling_httpd_req_get_url_query_str_then_ret
     // Test case 2: URL with no query string
     const char* uri2 = "/path";
     LOGD(TAG, "Test Case 2: URI = %s", uri2);
-    memset((char*)mock_req->uri, 0, sizeof(mock_req->uri)); // Clear buffer
-    strncpy((char*)mock_req->uri, uri2, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0';
+    memset((char*)mock_req->uri, 0, sizeof(uri_buf)); // Clear buffer
+    strncpy((char*)mock_req->uri, uri2, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0';
     LOGD(TAG, "mock_req->uri after strncpy: %s, strlen: %zu", mock_req->uri, strlen(mock_req->uri));
     http_parser_url_init(&mock_req_aux->url_parse_res); /* Initialize for each test case */
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
@@ -275,9 +285,9 @@ void given_various_url_queries_when_calling_httpd_req_get_url_query_str_then_ret
     // Test case 3: URL with an empty query string (just '?')
     const char* uri3 = "/path?";
     LOGD(TAG, "Test Case 3: URI = %s", uri3);
-    memset((char*)mock_req->uri, 0, sizeof(mock_req->uri)); // Clear buffer
-    strncpy((char*)mock_req->uri, uri3, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0';
+    memset((char*)mock_req->uri, 0, sizeof(uri_buf)); // Clear buffer
+    strncpy((char*)mock_req->uri, uri3, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0';
     LOGD(TAG, "mock_req->uri after strncpy: %s, strlen: %zu", mock_req->uri, strlen(mock_req->uri));
     http_parser_url_init(&mock_req_aux->url_parse_res); /* Initialize for each test case */
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
@@ -287,9 +297,9 @@ void given_various_url_queries_when_calling_httpd_req_get_url_query_str_then_ret
     // Test case 4: URL with query string containing special characters
     const char* uri4 = "/search?q=hello%20world&id=123";
     LOGD(TAG, "Test Case 4: URI = %s", uri4);
-    memset((char*)mock_req->uri, 0, sizeof(mock_req->uri)); // Clear buffer
-    strncpy((char*)mock_req->uri, uri4, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0';
+    memset((char*)mock_req->uri, 0, sizeof(uri_buf)); // Clear buffer
+    strncpy((char*)mock_req->uri, uri4, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0';
     LOGD(TAG, "mock_req->uri after strncpy: %s, strlen: %zu", mock_req->uri, strlen(mock_req->uri));
     http_parser_url_init(&mock_req_aux->url_parse_res); /* Initialize for each test case */
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
@@ -302,9 +312,9 @@ void given_various_url_queries_when_calling_httpd_req_get_url_query_str_then_ret
     memset(small_buf, 0, sizeof(small_buf)); // Clear small_buf
     const char* uri5 = "/path?longparam=longvalue";
     LOGD(TAG, "Test Case 5: URI = %s", uri5);
-    memset((char*)mock_req->uri, 0, sizeof(mock_req->uri)); // Clear buffer
-    strncpy((char*)mock_req->uri, uri5, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0';
+    memset((char*)mock_req->uri, 0, sizeof(uri_buf)); // Clear buffer
+    strncpy((char*)mock_req->uri, uri5, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0';
     LOGD(TAG, "mock_req->uri after strncpy: %s, strlen: %zu", mock_req->uri, strlen(mock_req->uri));
     http_parser_url_init(&mock_req_aux->url_parse_res); /* Initialize for each test case */
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
@@ -320,9 +330,9 @@ void given_various_url_queries_when_calling_httpd_req_get_url_query_str_then_ret
     // Test case 7: NULL buffer
     const char* uri7 = "/path?param=value";
     LOGD(TAG, "Test Case 7: URI = %s", uri7);
-    memset((char*)mock_req->uri, 0, sizeof(mock_req->uri)); // Clear buffer
-    strncpy((char*)mock_req->uri, uri7, sizeof(mock_req->uri) - 1);
-    ((char*)mock_req->uri)[sizeof(mock_req->uri) - 1] = '\0';
+    memset((char*)mock_req->uri, 0, sizeof(uri_buf)); // Clear buffer
+    strncpy((char*)mock_req->uri, uri7, sizeof(uri_buf) - 1);
+    ((char*)mock_req->uri)[sizeof(uri_buf) - 1] = '\0';
     LOGD(TAG, "mock_req->uri after strncpy: %s, strlen: %zu", mock_req->uri, strlen(mock_req->uri));
     http_parser_url_init(&mock_req_aux->url_parse_res);
     http_parser_parse_url(mock_req->uri, strlen(mock_req->uri), 0, &mock_req_aux->url_parse_res);
@@ -338,7 +348,9 @@ void given_various_url_queries_when_calling_httpd_req_get_url_query_str_then_ret
 // Test cases for httpd_req_get_cookie_val
 void test_httpd_req_get_cookie_val_success() {
     struct httpd_req_aux ra = {0};
-    snprintf(ra.scratch, sizeof(ra.scratch), "Cookie: cookie1=value1; cookie2=value2");
+    char scratch[HTTPD_SCRATCH_INIT_LEN + 1];
+    ra.scratch = scratch;
+    snprintf(ra.scratch, sizeof(scratch), "Cookie: cookie1=value1; cookie2=value2");
     ra.req_hdrs_count = 1;
 
     httpd_req_t req = {0};
@@ -365,8 +377,10 @@ void test_httpd_req_get_cookie_val_success() {
 
 
 void test_httpd_req_get_cookie_val_not_found() {
-     struct httpd_req_aux ra = {0};
-    snprintf(ra.scratch, sizeof(ra.scratch), "Cookie: cookie1=value1; cookie2=value2");
+    struct httpd_req_aux ra = {0};
+    char scratch[HTTPD_SCRATCH_INIT_LEN + 1];
+    ra.scratch = scratch;
+    snprintf(ra.scratch, sizeof(scratch), "Cookie: cookie1=value1; cookie2=value2");
     ra.req_hdrs_count = 1;
 
     httpd_req_t req = {0};
@@ -380,9 +394,11 @@ void test_httpd_req_get_cookie_val_not_found() {
 
 
 void test_httpd_req_get_cookie_val_no_cookie_header() {
-     struct httpd_req_aux ra = {0};
-     memset(ra.scratch, 0, sizeof(ra.scratch));
-    // snprintf(ra.scratch, sizeof(ra.scratch), "");
+    struct httpd_req_aux ra = {0};
+    char scratch[HTTPD_SCRATCH_INIT_LEN + 1];
+    ra.scratch = scratch;
+     memset(ra.scratch, 0, sizeof(scratch));
+    // snprintf(ra.scratch, sizeof(scratch), "");
     ra.req_hdrs_count = 1;
 
     httpd_req_t req = {0};
@@ -397,8 +413,10 @@ void test_httpd_req_get_cookie_val_no_cookie_header() {
 
 
 void test_httpd_req_get_cookie_val_empty_cookie_header() {
-     struct httpd_req_aux ra = {0};
-    snprintf(ra.scratch, sizeof(ra.scratch), "Cookie: ");
+    struct httpd_req_aux ra = {0};
+    char scratch[HTTPD_SCRATCH_INIT_LEN + 1];
+    ra.scratch = scratch;
+    snprintf(ra.scratch, sizeof(scratch), "Cookie: ");
     ra.req_hdrs_count = 1;
 
     httpd_req_t req = {0};
@@ -412,8 +430,10 @@ void test_httpd_req_get_cookie_val_empty_cookie_header() {
 
 
 void test_httpd_req_get_cookie_val_buffer_truncation() {
-     struct httpd_req_aux ra = {0};
-    snprintf(ra.scratch, sizeof(ra.scratch), "Cookie: cookie1=value1; cookie2=value2");
+    struct httpd_req_aux ra = {0};
+    char scratch[HTTPD_SCRATCH_INIT_LEN + 1];
+    ra.scratch = scratch;
+    snprintf(ra.scratch, sizeof(scratch), "Cookie: cookie1=value1; cookie2=value2");
     ra.req_hdrs_count = 1;
 
     httpd_req_t req = {0};
@@ -430,7 +450,9 @@ void test_httpd_req_get_cookie_val_buffer_truncation() {
 
 void test_httpd_req_get_cookie_val_invalid_args() {
     struct httpd_req_aux ra = {0};
-    snprintf(ra.scratch, sizeof(ra.scratch), "Cookie: cookie1=value1; cookie2=value2");
+    char scratch[HTTPD_SCRATCH_INIT_LEN + 1];
+    ra.scratch = scratch;
+    snprintf(ra.scratch, sizeof(scratch), "Cookie: cookie1=value1; cookie2=value2");
     ra.req_hdrs_count = 1;
 
     httpd_req_t req = {0};
@@ -452,6 +474,451 @@ void test_httpd_req_get_cookie_val_invalid_args() {
     TEST_ASSERT_EQUAL_HEX(ESP_ERR_INVALID_ARG, err);
 }
 
+/* Results of the header lookups done by the handler of the test below */
+static struct {
+    bool        first_found;
+    bool        last_found;
+    bool        last_is_view;
+    size_t      last_len;
+    char        last[16];
+    bool        empty_found;
+    size_t      empty_len;
+    esp_err_t   missing_ret;
+} hdr_view_result;
+
+/**
+ * Test: given_request_with_more_headers_than_index_when_getting_header_views_then_all_are_found
+ *
+ * Purpose: Verify that headers are found whether they fall in the index built while parsing
+ *          or past it, and that a view points into the request without copying it.
+ * Expected: httpd_req_get_hdr_view() finds the first and last header case insensitively,
+ *           reports the value length, an empty value and a missing header.
+ */
+void given_request_with_more_headers_than_index_when_getting_header_views_then_all_are_found(void)
+{
+    // Given: A running server whose handler looks up headers
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9051; // Use a unique port
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    memset(&hdr_view_result, 0, sizeof(hdr_view_result));
+    httpd_uri_t test_uri = {
+        .uri      = "/headers",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            const char *val;
+            size_t len = 0;
+            hdr_view_result.first_found = httpd_req_get_hdr_view(req, "x-hdr-00", &val, &len) == ESP_OK &&
+                                          len == 3 && strcmp(val, "v00") == 0;
+            if (httpd_req_get_hdr_view(req, "X-HDR-39", &val, &len) == ESP_OK) {
+                char copy[16];
+                hdr_view_result.last_found = true;
+                hdr_view_result.last_len = len;
+                snprintf(hdr_view_result.last, sizeof(hdr_view_result.last), "%s", val);
+                // The view refers to the same value a copy is made from
+                hdr_view_result.last_is_view = httpd_req_get_hdr_value_str(req, "X-Hdr-39", copy, sizeof(copy)) == ESP_OK &&
+                                               strcmp(copy, val) == 0 && val != copy;
+            }
+            hdr_view_result.empty_found = httpd_req_get_hdr_view(req, "Empty", &val, &hdr_view_result.empty_len) == ESP_OK;
+            hdr_view_result.missing_ret = httpd_req_get_hdr_view(req, "Missing", &val, NULL);
+            httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+
+    // When: A client sends a request with more headers than the index holds
+    char request[TEST_BUFFER_SIZE];
+    int len = snprintf(request, sizeof(request), "GET /headers HTTP/1.1\r\nHost: localhost\r\n");
+    for (int i = 0; i < 40; i++) {
+        len += snprintf(request + len, sizeof(request) - len, "X-Hdr-%02d: v%02d\r\n", i, i);
+    }
+    len += snprintf(request + len, sizeof(request) - len, "Empty:\r\n\r\n");
+    TEST_ASSERT_LESS_THAN(sizeof(request), len);
+
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, 1000));
+    TEST_ASSERT_EQUAL(len, send(client->sockfd, request, len, 0));
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(client->sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    char buffer[256] = {0};
+    TEST_ASSERT_GREATER_THAN(0, recv(client->sockfd, buffer, sizeof(buffer) - 1, 0));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 200 OK"));
+
+    // Then: Every lookup found what the request carried
+    TEST_ASSERT_TRUE(hdr_view_result.first_found);
+    TEST_ASSERT_TRUE(hdr_view_result.last_found);
+    TEST_ASSERT_EQUAL(3, hdr_view_result.last_len);
+    TEST_ASSERT_EQUAL_STRING("v39", hdr_view_result.last);
+    TEST_ASSERT_TRUE(hdr_view_result.last_is_view);
+    TEST_ASSERT_TRUE(hdr_view_result.empty_found);
+    TEST_ASSERT_EQUAL(0, hdr_view_result.empty_len);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, hdr_view_result.missing_ret);
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+/* Receive from a test socket until the given text arrived, the peer closed
+ * the connection or a second passed. Returns the length received */
+static int recv_until(int sockfd, char *buffer, size_t size, const char *text)
+{
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    int total = 0;
+    buffer[0] = '\0';
+    while (total < (int)size - 1 && strstr(buffer, text) == NULL) {
+        int ret = recv(sockfd, buffer + total, size - 1 - total, 0);
+        if (ret <= 0) {
+            break;
+        }
+        total += ret;
+        buffer[total] = '\0';
+    }
+    return total;
+}
+
+/* Well-known header values seen by the handler of the test below */
+static struct {
+    bool host_is_field;
+    char host[32];
+    char content_type[32];
+    char accept_encoding[32];
+    char cookie[32];
+} known_hdr_result;
+
+/**
+ * Test: given_request_with_well_known_headers_when_handled_then_values_are_read_from_request_fields
+ *
+ * Purpose: Verify that the headers recognized while parsing are kept in their own fields,
+ *          and that "Connection: close" from the client is honored.
+ * Expected: The lookups return the values the client sent whatever the case of the name,
+ *           and the response carries "Connection: close" before the server closes the socket.
+ */
+void given_request_with_well_known_headers_when_handled_then_values_are_read_from_request_fields(void)
+{
+    // Given: A running server whose handler looks up well-known headers
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9052; // Use a unique port
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    memset(&known_hdr_result, 0, sizeof(known_hdr_result));
+    httpd_uri_t test_uri = {
+        .uri      = "/known",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            struct httpd_req_aux *ra = (struct httpd_req_aux *)req->aux;
+            const char *host;
+            known_hdr_result.host_is_field = httpd_req_get_hdr_view(req, "host", &host, NULL) == ESP_OK &&
+                                             host == ra->known_hdrs[HTTPD_HDR_HOST].value;
+            httpd_req_get_hdr_value_str(req, "Host", known_hdr_result.host, sizeof(known_hdr_result.host));
+            httpd_req_get_hdr_value_str(req, "CONTENT-TYPE", known_hdr_result.content_type, sizeof(known_hdr_result.content_type));
+            httpd_req_get_hdr_value_str(req, "Accept-Encoding", known_hdr_result.accept_encoding, sizeof(known_hdr_result.accept_encoding));
+            httpd_req_get_hdr_value_str(req, "Cookie", known_hdr_result.cookie, sizeof(known_hdr_result.cookie));
+            httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &test_uri));
+
+    // When: A client sends them, asking for the connection to be closed
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, 1000));
+    const char *request = "GET /known HTTP/1.1\r\n"
+                          "X-Before: 1\r\n"
+                          "HOST: example.com\r\n"
+                          "content-type: text/plain\r\n"
+                          "Accept-Encoding: gzip, br\r\n"
+                          "Cookie: a=1\r\n"
+                          "Cookie: b=2\r\n"
+                          "Connection: Close\r\n"
+                          "\r\n";
+    TEST_ASSERT_EQUAL(strlen(request), send(client->sockfd, request, strlen(request), 0));
+
+    // Then: The response announces the closure and the server closes the connection
+    char buffer[512];
+    recv_until(client->sockfd, buffer, sizeof(buffer), "\r\n\r\nOK");
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 200 OK"));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "Connection: close"));
+    char extra;
+    TEST_ASSERT_EQUAL(0, recv(client->sockfd, &extra, 1, 0));
+
+    // And the handler read the values from the request fields
+    TEST_ASSERT_TRUE(known_hdr_result.host_is_field);
+    TEST_ASSERT_EQUAL_STRING("example.com", known_hdr_result.host);
+    TEST_ASSERT_EQUAL_STRING("text/plain", known_hdr_result.content_type);
+    TEST_ASSERT_EQUAL_STRING("gzip, br", known_hdr_result.accept_encoding);
+    TEST_ASSERT_EQUAL_STRING("a=1", known_hdr_result.cookie);
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+/* Echo handler counting how often it was invoked */
+static int expect_handler_calls;
+static esp_err_t expect_echo_handler(httpd_req_t *req)
+{
+    char body[32] = {0};
+    expect_handler_calls++;
+    if (strcmp(req->uri, "/refuse") == 0) {
+        // Refuse the request without reading the body
+        httpd_resp_set_status(req, "413 Content Too Large");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+    int len = httpd_req_recv(req, body, sizeof(body) - 1);
+    httpd_resp_send(req, body, len > 0 ? len : 0);
+    return ESP_OK;
+}
+
+/**
+ * Test: given_request_expecting_100_continue_when_handler_reads_body_then_interim_response_is_sent
+ *
+ * Purpose: Verify that a client sending "Expect: 100-continue" is told to send its body only
+ *          once the handler reads it, and that a handler may refuse the request without it.
+ * Expected: The handler runs before the body is sent, "100 Continue" arrives when it reads
+ *           the body, and a refused request is answered and closed without "100 Continue".
+ */
+void given_request_expecting_100_continue_when_handler_reads_body_then_interim_response_is_sent(void)
+{
+    // Given: A running server with an echo handler
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9053; // Use a unique port
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+    expect_handler_calls = 0;
+    httpd_uri_t echo_uri = { .uri = "/echo", .method = HTTP_POST, .handler = expect_echo_handler, .user_ctx = NULL };
+    httpd_uri_t refuse_uri = { .uri = "/refuse", .method = HTTP_POST, .handler = expect_echo_handler, .user_ctx = NULL };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &echo_uri));
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &refuse_uri));
+
+    // When: A client sends the headers of a request expecting 100 Continue
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, 1000));
+    const char *headers = "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\nExpect: 100-continue\r\n\r\n";
+    TEST_ASSERT_EQUAL(strlen(headers), send(client->sockfd, headers, strlen(headers), 0));
+
+    // Then: The handler asks for the body with 100 Continue
+    char buffer[512];
+    recv_until(client->sockfd, buffer, sizeof(buffer), "\r\n\r\n");
+    TEST_ASSERT_EQUAL_STRING("HTTP/1.1 100 Continue\r\n\r\n", buffer);
+    TEST_ASSERT_EQUAL(1, expect_handler_calls);
+
+    // And the body sent after it is echoed on the persistent connection
+    TEST_ASSERT_EQUAL(5, send(client->sockfd, "hello", 5, 0));
+    recv_until(client->sockfd, buffer, sizeof(buffer), "hello");
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 200 OK"));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "hello"));
+    TEST_ASSERT_NULL(strstr(buffer, "Connection: close"));
+
+    // When: A request expecting 100 Continue is refused by its handler
+    headers = "POST /refuse HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\nExpect: 100-continue\r\n\r\n";
+    TEST_ASSERT_EQUAL(strlen(headers), send(client->sockfd, headers, strlen(headers), 0));
+
+    // Then: It is answered without 100 Continue and the connection is closed
+    recv_until(client->sockfd, buffer, sizeof(buffer), "\r\n\r\n");
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 413"));
+    TEST_ASSERT_NULL(strstr(buffer, "100 Continue"));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "Connection: close"));
+    char extra;
+    TEST_ASSERT_EQUAL(0, recv(client->sockfd, &extra, 1, 0));
+    TEST_ASSERT_EQUAL(2, expect_handler_calls);
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+/* What the handler saw of a large request */
+static struct {
+    size_t uri_len;
+    size_t cookie_len;
+} large_req_result;
+
+static esp_err_t large_req_handler(httpd_req_t *req)
+{
+    const char *cookie;
+    large_req_result.uri_len = strlen(req->uri);
+    if (httpd_req_get_hdr_view(req, "Cookie", &cookie, &large_req_result.cookie_len) != ESP_OK) {
+        large_req_result.cookie_len = 0;
+    }
+    httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+/**
+ * Test: given_raised_uri_and_header_limits_when_large_request_is_sent_then_it_is_served
+ *
+ * Purpose: Verify that the URI and header limits set at runtime replace the compile-time
+ *          ones, and that the request buffers grown for a large request are given back.
+ * Expected: Out of range limits are rejected, a request beyond the default limits is served,
+ *           memory use returns to its previous level and a URI over the limit gets 414.
+ */
+void given_raised_uri_and_header_limits_when_large_request_is_sent_then_it_is_served(void)
+{
+    // Given: Limits that do not fit the request buffers are rejected
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9054; // Use a unique port
+    httpd_handle_t handle = NULL;
+    config.max_req_hdr_len = 65536;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, httpd_start(&handle, &config));
+    TEST_ASSERT_NULL(handle);
+
+    // And: A running server accepting long URIs and headers
+    config.max_uri_len = 2048;
+    config.max_req_hdr_len = 4096;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+    httpd_uri_t any_uri = { .uri = "/*", .method = HTTP_GET, .handler = large_req_handler, .user_ctx = NULL };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &any_uri));
+
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, 1000));
+    const char *small = "GET /small HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char buffer[512];
+    // An idle connection only holds its session, charged once it is accepted
+    size_t used_before = 0;
+    for (int i = 0; i < 100 && used_before == 0; ++i) {
+        httpd_os_thread_sleep(10);
+        httpd_get_mem_usage(handle, &used_before, NULL);
+    }
+
+    // When: A request with a URI and a header beyond the default limits is sent
+    std::string request = "GET /" + std::string(1999, 'u') + " HTTP/1.1\r\n"
+                          "Host: localhost\r\n"
+                          "Cookie: " + std::string(3000, 'c') + "\r\n\r\n";
+    memset(&large_req_result, 0, sizeof(large_req_result));
+    TEST_ASSERT_EQUAL(request.size(), send(client->sockfd, request.c_str(), request.size(), 0));
+
+    // Then: It is served and the handler sees all of it
+    recv_until(client->sockfd, buffer, sizeof(buffer), "\r\n\r\nOK");
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 200 OK"));
+    TEST_ASSERT_EQUAL(2000, large_req_result.uri_len);
+    TEST_ASSERT_EQUAL(3000, large_req_result.cookie_len);
+
+    // And the grown buffers are given back once the next request is done,
+    // which may only be just after its response was sent
+    TEST_ASSERT_EQUAL(strlen(small), send(client->sockfd, small, strlen(small), 0));
+    recv_until(client->sockfd, buffer, sizeof(buffer), "\r\n\r\nOK");
+    size_t used_after = used_before + 1;
+    for (int i = 0; i < 100 && used_after != used_before; ++i) {
+        httpd_os_thread_sleep(10);
+        httpd_get_mem_usage(handle, &used_after, NULL);
+    }
+
+    // When: The URI exceeds the raised limit
+    request = "GET /" + std::string(2100, 'u') + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    TEST_ASSERT_EQUAL(request.size(), send(client->sockfd, request.c_str(), request.size(), 0));
+
+    // Then: The request is refused as too long
+    recv_until(client->sockfd, buffer, sizeof(buffer), "\r\n\r\n");
+    bool refused = strstr(buffer, "HTTP/1.1 414") != NULL;
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+
+    // Checked once the server is stopped, so that a failure does not leave it running
+    TEST_ASSERT_EQUAL(used_before, used_after);
+    TEST_ASSERT_TRUE(refused);
+}
+
+/**
+ * Test: given_used_request_when_reset_for_next_request_then_only_counters_are_cleared
+ *
+ * Purpose: Verify that resetting the request of a server loop, done for every request
+ *          and WebSocket frame, clears its lengths and counters without clearing the
+ *          buffers, and measure its cost against clearing the buffers as well.
+ * Expected: The counters are cleared, the buffer content is left as it was and the
+ *           time per reset of both variants is logged.
+ */
+void given_used_request_when_reset_for_next_request_then_only_counters_are_cleared(void)
+{
+    // Given: The request of a server loop which was used, without a running server
+    struct httpd_data *hd = (struct httpd_data *)calloc(1, sizeof(struct httpd_data));
+    TEST_ASSERT_NOT_NULL(hd);
+    hd->primary = hd;
+    struct httpd_req_aux *ra = &hd->hd_req_aux;
+    ra->scratch = (char *)malloc(HTTPD_SCRATCH_INIT_LEN + 1);
+    ra->uri = (char *)malloc(HTTPD_URI_INIT_LEN + 1);
+    TEST_ASSERT_NOT_NULL(ra->scratch);
+    TEST_ASSERT_NOT_NULL(ra->uri);
+    ra->scratch_size = HTTPD_SCRATCH_INIT_LEN;
+    ra->uri_size = HTTPD_URI_INIT_LEN;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    ra->resp_hdrs = (decltype(ra->resp_hdrs))calloc(config.max_resp_headers, sizeof(*ra->resp_hdrs));
+    TEST_ASSERT_NOT_NULL(ra->resp_hdrs);
+    httpd_req_reset(hd);
+    memset(ra->scratch, 'x', ra->scratch_size);
+    ra->req_hdrs_count = 3;
+    ra->hdr_index_count = 3;
+    ra->known_hdrs_seen = 1U << HTTPD_HDR_HOST;
+    ra->resp_hdrs_count = 2;
+    ra->remaining_len = 10;
+
+    // When: It is reset for the next request
+    httpd_req_reset(hd);
+
+    // Then: Its lengths and counters are cleared
+    TEST_ASSERT_EQUAL(0, ra->req_hdrs_count);
+    TEST_ASSERT_EQUAL(0, ra->hdr_index_count);
+    TEST_ASSERT_EQUAL(0, ra->known_hdrs_seen);
+    TEST_ASSERT_EQUAL(0, ra->resp_hdrs_count);
+    TEST_ASSERT_EQUAL(0, ra->remaining_len);
+    TEST_ASSERT_EQUAL_STRING("", hd->hd_req.uri);
+
+    // And the buffers are not cleared past their first byte
+    TEST_ASSERT_EQUAL('\0', ra->scratch[0]);
+    TEST_ASSERT_EQUAL('x', ra->scratch[1]);
+    TEST_ASSERT_EQUAL('x', ra->scratch[ra->scratch_size - 1]);
+
+    // And: The cost of a reset compared to also clearing, as before, a scratch buffer and
+    // a URI at the default limits, the well-known header fields and the response headers
+    const int rounds = 100000;
+    size_t scratch_len = MAX(CONFIG_HTTPD_MAX_URI_LEN, CONFIG_HTTPD_MAX_REQ_HDR_LEN) + 1;
+    size_t uri_len = CONFIG_HTTPD_MAX_URI_LEN + 1;
+    char *clear_buf = (char *)malloc(scratch_len + uri_len);
+    TEST_ASSERT_NOT_NULL(clear_buf);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        httpd_req_reset(hd);
+    }
+    auto reset_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        httpd_req_reset(hd);
+        memset(clear_buf, 0, scratch_len);
+        memset(clear_buf + scratch_len, 0, uri_len);
+        memset(ra->known_hdrs, 0, sizeof(ra->known_hdrs));
+        memset(ra->resp_hdrs, 0, config.max_resp_headers * sizeof(*ra->resp_hdrs));
+    }
+    auto clear_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    LOGI(TAG, "request reset: %.1f ns, clearing buffers as well: %.1f ns",
+         (double)reset_ns / rounds, (double)clear_ns / rounds);
+    TEST_ASSERT_EQUAL('\0', clear_buf[scratch_len + uri_len - 1]);
+    free(clear_buf);
+
+    // Cleanup
+    free(ra->resp_hdrs);
+    free(ra->scratch);
+    free(ra->uri);
+    free(hd);
+}
+
 int test_request_processing(void) {
     // UNITY_BEGIN();
     RUN_TEST(given_valid_request_when_calling_httpd_req_get_url_query_len_then_returns_query_length);
@@ -466,6 +933,11 @@ int test_request_processing(void) {
     RUN_TEST(test_httpd_req_get_cookie_val_empty_cookie_header);
     RUN_TEST(test_httpd_req_get_cookie_val_buffer_truncation);
     RUN_TEST(test_httpd_req_get_cookie_val_invalid_args);
+    RUN_TEST(given_request_with_more_headers_than_index_when_getting_header_views_then_all_are_found);
+    RUN_TEST(given_request_with_well_known_headers_when_handled_then_values_are_read_from_request_fields);
+    RUN_TEST(given_request_expecting_100_continue_when_handler_reads_body_then_interim_response_is_sent);
+    RUN_TEST(given_raised_uri_and_header_limits_when_large_request_is_sent_then_it_is_served);
+    RUN_TEST(given_used_request_when_reset_for_next_request_then_only_counters_are_cleared);
     // return UNITY_END();
     return 0;
 }
@@ -4,6 +4,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h> // Required for setvbuf
+#include <string>
+#include <chrono>
+#include <thread>
 #include "esp_httpd_priv.h" // For httpd_data, sock_db, httpd_req_aux, http_parser_url
 #include "http_test_client.h" // Include for http_test_client
 
@@ -21,6 +24,10 @@
 
 #define TEST_TIMEOUT_MS 5000
 
+#ifdef _WIN32
+#include <direct.h> // For _mkdir
+#endif
+
 void nop(void * ctx){};
 
 
@@ -287,6 +294,738 @@ void given_server_with_large_response_handler_when_client_requests_then_receives
 }
 
 
+#define SEND_FILE_SIZE (256 * 1024)
+#define SEND_FILE_OFFSET 1000
+
+/* Creates a temporary file holding SEND_FILE_SIZE bytes of a known pattern */
+static FILE *create_send_file(void)
+{
+    FILE *file = tmpfile();
+    TEST_ASSERT_NOT_NULL(file);
+    for (size_t i = 0; i < SEND_FILE_SIZE; i++) {
+        fputc('a' + (i % 26), file);
+    }
+    fflush(file);
+    return file;
+}
+
+/* Serves the file range starting at SEND_FILE_OFFSET, user_ctx holds the descriptor */
+static esp_err_t send_file_handler(httpd_req_t *req)
+{
+    int fd = *(int *)req->user_ctx;
+    httpd_resp_set_type(req, "application/octet-stream");
+    return httpd_resp_send_file(req, fd, SEND_FILE_OFFSET, SEND_FILE_SIZE - SEND_FILE_OFFSET);
+}
+
+static int counting_send_calls = 0;
+
+static int counting_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    counting_send_calls++;
+    return httpd_default_send(hd, sockfd, buf, buf_len, flags);
+}
+
+/* Requests the file range from a server on port and checks the body against the pattern */
+static void request_send_file(int port)
+{
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", port, TEST_TIMEOUT_MS));
+
+    http_test_response_t response = {0};
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/file", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    TEST_ASSERT_EQUAL(SEND_FILE_SIZE - SEND_FILE_OFFSET, response.body_len);
+    TEST_ASSERT_NOT_NULL(response.body);
+    for (size_t i = 0; i < SEND_FILE_SIZE - SEND_FILE_OFFSET; i++) {
+        TEST_ASSERT_EQUAL('a' + ((i + SEND_FILE_OFFSET) % 26), response.body[i]);
+    }
+
+    http_test_client_free_response(&response);
+    http_test_client_disconnect(client);
+}
+
+/**
+ * Test: given_file_handler_when_client_requests_then_receives_file_range
+ *
+ * Purpose: Verify that httpd_resp_send_file() sends the requested range of a file
+ *          with a Content-Length header.
+ * Expected: The client receives a 200 OK response whose body is the file range.
+ */
+void given_file_handler_when_client_requests_then_receives_file_range(void)
+{
+    // Given: A running server with a handler sending a range of a file
+    FILE *file = create_send_file();
+    int fd = fileno(file);
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9029; // Use a unique port
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t file_uri = {
+        .uri      = "/file",
+        .method   = HTTP_GET,
+        .handler  = send_file_handler,
+        .user_ctx = &fd
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &file_uri));
+
+    // When: A client requests the file
+    // Then: The client receives exactly the file range
+    request_send_file(config.server_port);
+
+    // Cleanup
+    httpd_stop(handle);
+    fclose(file);
+}
+
+/**
+ * Test: given_send_override_when_file_is_requested_then_file_goes_through_override
+ *
+ * Purpose: Verify that httpd_resp_send_file() does not bypass a session send override
+ *          (as installed by TLS) and reads the file through its own buffer instead.
+ * Expected: The client receives the file range and the override sent it.
+ */
+void given_send_override_when_file_is_requested_then_file_goes_through_override(void)
+{
+    // Given: A running server whose sessions have a send override, and a file handler
+    FILE *file = create_send_file();
+    int fd = fileno(file);
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9030; // Use a unique port
+    config.open_fn = [](httpd_handle_t hd, int sockfd) {
+        return httpd_sess_set_send_override(hd, sockfd, counting_send);
+    };
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t file_uri = {
+        .uri      = "/file",
+        .method   = HTTP_GET,
+        .handler  = send_file_handler,
+        .user_ctx = &fd
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &file_uri));
+
+    // When: A client requests the file
+    counting_send_calls = 0;
+
+    // Then: The client receives exactly the file range, sent by the override
+    request_send_file(config.server_port);
+    TEST_ASSERT_GREATER_THAN(0, counting_send_calls);
+
+    // Cleanup
+    httpd_stop(handle);
+    fclose(file);
+}
+
+#define STATIC_PAGE_BODY "<html>static page</html>"
+
+static char static_dir[64];
+static const httpd_static_config_t static_config = {
+    .base_path     = static_dir,
+    .uri_prefix    = "/static",
+    .index_file    = "index.html",
+    .cache_control = "public, max-age=60",
+};
+
+/* Creates a directory holding page.html and index.html, and a server serving it under /static/,
+ * with the default URI limit unless max_uri_len is given */
+static httpd_handle_t start_static_server(int port, size_t max_uri_len = 0)
+{
+#ifdef _WIN32
+    snprintf(static_dir, sizeof(static_dir), "httpd_static_%d", port);
+    _mkdir(static_dir);
+#else
+    snprintf(static_dir, sizeof(static_dir), "/tmp/httpd_static_XXXXXX");
+    TEST_ASSERT_NOT_NULL(mkdtemp(static_dir));
+#endif
+    const char *names[] = { "page.html", "index.html" };
+    for (size_t i = 0; i < 2; i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/%s", static_dir, names[i]);
+        FILE *file = fopen(path, "wb");
+        TEST_ASSERT_NOT_NULL(file);
+        fputs(STATIC_PAGE_BODY, file);
+        fclose(file);
+    }
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    if (max_uri_len) {
+        config.max_uri_len = max_uri_len;
+    }
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t static_uri = {
+        .uri      = "/static/*",
+        .method   = HTTP_GET,
+        .handler  = httpd_static_handler,
+        .user_ctx = (void *) &static_config
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &static_uri));
+    return handle;
+}
+
+static void stop_static_server(httpd_handle_t handle)
+{
+    httpd_stop(handle);
+    const char *names[] = { "page.html", "index.html" };
+    for (size_t i = 0; i < 2; i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/%s", static_dir, names[i]);
+        remove(path);
+    }
+    rmdir(static_dir);
+}
+
+/* Sends one GET on its own connection */
+static void static_get(int port, const char *uri, const char *headers, http_test_response_t *response)
+{
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", port, TEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, uri, headers, NULL, 0, response, TEST_TIMEOUT_MS));
+    http_test_client_disconnect(client);
+}
+
+/**
+ * Test: given_static_handler_when_file_is_requested_then_file_is_sent_with_validators
+ *
+ * Purpose: Verify that httpd_static_handler() serves files of its directory with a content
+ *          type guessed from the extension, an ETag, a Last-Modified and the Cache-Control policy.
+ * Expected: 200 OK with the file as body and all caching headers, for a file and a directory URI.
+ */
+void given_static_handler_when_file_is_requested_then_file_is_sent_with_validators(void)
+{
+    // Given: A server serving a directory under /static/
+    httpd_handle_t handle = start_static_server(9031);
+
+    // When: A file and the directory are requested
+    http_test_response_t response = {0};
+    static_get(9031, "/static/page.html?v=1", NULL, &response);
+
+    // Then: The file is sent with its type and caching headers
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    TEST_ASSERT_EQUAL_STRING(STATIC_PAGE_BODY, response.body);
+    const char *content_type = http_test_client_get_header(&response, "Content-Type");
+    TEST_ASSERT_EQUAL_STRING("text/html", content_type);
+    free((void*)content_type);
+    const char *etag = http_test_client_get_header(&response, "ETag");
+    TEST_ASSERT_NOT_NULL(etag);
+    TEST_ASSERT_EQUAL('"', etag[0]);
+    free((void*)etag);
+    const char *last_modified = http_test_client_get_header(&response, "Last-Modified");
+    TEST_ASSERT_NOT_NULL(last_modified);
+    TEST_ASSERT_NOT_NULL(strstr(last_modified, " GMT"));
+    free((void*)last_modified);
+    const char *cache_control = http_test_client_get_header(&response, "Cache-Control");
+    TEST_ASSERT_EQUAL_STRING("public, max-age=60", cache_control);
+    free((void*)cache_control);
+    http_test_client_free_response(&response);
+
+    // And: The directory URI serves the index file
+    static_get(9031, "/static/", NULL, &response);
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    TEST_ASSERT_EQUAL_STRING(STATIC_PAGE_BODY, response.body);
+    http_test_client_free_response(&response);
+
+    // Cleanup
+    stop_static_server(handle);
+}
+
+/**
+ * Test: given_static_file_when_requested_with_matching_validators_then_304_is_sent
+ *
+ * Purpose: Verify that conditional GETs carrying the ETag (If-None-Match) or the modification
+ *          date (If-Modified-Since) of an unchanged file are answered with 304 and no body.
+ * Expected: 304 Not Modified without body for matching validators, 200 for a different ETag.
+ */
+void given_static_file_when_requested_with_matching_validators_then_304_is_sent(void)
+{
+    // Given: A server serving a directory, and the validators of one of its files
+    httpd_handle_t handle = start_static_server(9032);
+    http_test_response_t response = {0};
+    static_get(9032, "/static/page.html", NULL, &response);
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    const char *etag = http_test_client_get_header(&response, "ETag");
+    const char *last_modified = http_test_client_get_header(&response, "Last-Modified");
+    TEST_ASSERT_NOT_NULL(etag);
+    TEST_ASSERT_NOT_NULL(last_modified);
+    http_test_client_free_response(&response);
+
+    // When: The file is requested again with its ETag
+    char headers[256];
+    snprintf(headers, sizeof(headers), "If-None-Match: \"other\", %s\r\n", etag);
+    static_get(9032, "/static/page.html", headers, &response);
+
+    // Then: 304 is answered, without body or Content-Length, with the validators
+    TEST_ASSERT_EQUAL(304, response.status_code);
+    TEST_ASSERT_EQUAL(0, response.body_len);
+    TEST_ASSERT_NULL(strstr(response.headers, "Content-Length"));
+    TEST_ASSERT_NOT_NULL(strstr(response.headers, etag));
+    http_test_client_free_response(&response);
+
+    // And: The modification date gives the same answer
+    snprintf(headers, sizeof(headers), "If-Modified-Since: %s\r\n", last_modified);
+    static_get(9032, "/static/page.html", headers, &response);
+    TEST_ASSERT_EQUAL(304, response.status_code);
+    http_test_client_free_response(&response);
+
+    // And: A stale ETag gets the file
+    static_get(9032, "/static/page.html", "If-None-Match: \"stale\"\r\n", &response);
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    TEST_ASSERT_EQUAL_STRING(STATIC_PAGE_BODY, response.body);
+    http_test_client_free_response(&response);
+
+    // Cleanup
+    free((void*)etag);
+    free((void*)last_modified);
+    stop_static_server(handle);
+}
+
+/**
+ * Test: given_static_handler_when_uri_leaves_directory_then_404_is_sent
+ *
+ * Purpose: Verify that httpd_static_handler() does not serve files outside of its directory
+ *          and answers missing files with 404.
+ * Expected: 404 Not Found for ".." segments, backslashes and a missing file.
+ */
+void given_static_handler_when_uri_leaves_directory_then_404_is_sent(void)
+{
+    // Given: A server serving a directory under /static/
+    httpd_handle_t handle = start_static_server(9033);
+
+    // When: A URI climbing out of the directory is requested
+    http_test_response_t response = {0};
+    static_get(9033, "/static/../static/page.html", NULL, &response);
+
+    // Then: 404 is answered
+    TEST_ASSERT_EQUAL(404, response.status_code);
+    http_test_client_free_response(&response);
+
+    // And: Backslash separators are refused too
+    static_get(9033, "/static/..\\static\\page.html", NULL, &response);
+    TEST_ASSERT_EQUAL(404, response.status_code);
+    http_test_client_free_response(&response);
+
+    // And: A missing file gets 404 as well
+    static_get(9033, "/static/missing.html", NULL, &response);
+    TEST_ASSERT_EQUAL(404, response.status_code);
+    http_test_client_free_response(&response);
+
+    // Cleanup
+    stop_static_server(handle);
+}
+
+/**
+ * Test: given_raised_uri_limit_when_static_file_is_requested_with_long_uri_then_file_is_sent
+ *
+ * Purpose: Verify that httpd_static_handler() maps URIs longer than CONFIG_HTTPD_MAX_URI_LEN
+ *          when the server accepts them through a raised max_uri_len.
+ * Expected: 200 OK with the file as body for a URI of about twice the compile-time limit.
+ */
+void given_raised_uri_limit_when_static_file_is_requested_with_long_uri_then_file_is_sent(void)
+{
+    // Given: A server serving a directory under /static/ and accepting long URIs
+    httpd_handle_t handle = start_static_server(9057, 2 * CONFIG_HTTPD_MAX_URI_LEN + 64);
+
+    // When: A file is requested through a URI beyond the compile-time limit
+    std::string uri = "/static/";
+    while (uri.size() < 2 * CONFIG_HTTPD_MAX_URI_LEN) {
+        uri += "./";
+    }
+    uri += "page.html";
+    // Sent as is, the request line of the test client is bounded by the compile-time limit
+    std::string request = "GET " + uri + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", 9057, TEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(request.size(), send(client->sockfd, request.c_str(), request.size(), 0));
+    struct timeval tv;
+    tv.tv_sec = 5;
+    tv.tv_usec = 0;
+    setsockopt(client->sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    char buffer[1024];
+    int total = 0;
+    while (total < (int)sizeof(buffer) - 1) {
+        int ret = recv(client->sockfd, buffer + total, sizeof(buffer) - 1 - total, 0);
+        if (ret <= 0) {
+            break;
+        }
+        total += ret;
+    }
+    buffer[total] = '\0';
+    http_test_client_disconnect(client);
+
+    // Then: The file is sent
+    TEST_ASSERT_EQUAL(0, strncmp(buffer, "HTTP/1.1 200 OK\r\n", 17));
+    const char *body = strstr(buffer, "\r\n\r\n");
+    TEST_ASSERT_NOT_NULL(body);
+    TEST_ASSERT_EQUAL_STRING(STATIC_PAGE_BODY, body + 4);
+
+    // Cleanup
+    stop_static_server(handle);
+}
+
+
+#define RANGE_BODY "abcdefghijklmnopqrstuvwxyz"
+
+/* Starts a server answering /range with RANGE_BODY, honouring Range */
+static httpd_handle_t start_range_server(int port)
+{
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t range_uri = {
+        .uri      = "/range",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            httpd_resp_set_type(req, "text/plain");
+            return httpd_resp_send_range(req, RANGE_BODY, strlen(RANGE_BODY), "\"v1\"");
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &range_uri));
+    return handle;
+}
+
+/**
+ * Test: given_range_request_when_single_range_is_asked_then_206_is_sent
+ *
+ * Purpose: Verify that httpd_resp_send_range() answers a single byte range (explicit, open or
+ *          suffix) with 206 and a Content-Range, and an unsatisfiable range with 416.
+ * Expected: 206 with the selected bytes, 416 with the full length in Content-Range for a range past the end.
+ */
+void given_range_request_when_single_range_is_asked_then_206_is_sent(void)
+{
+    // Given: A server sending a buffer with range support
+    httpd_handle_t handle = start_range_server(9034);
+    http_test_response_t response = {0};
+
+    // When: A range in the middle is asked for
+    static_get(9034, "/range", "Range: bytes=2-5\r\n", &response);
+
+    // Then: The range is sent as 206 Partial Content
+    TEST_ASSERT_EQUAL(206, response.status_code);
+    TEST_ASSERT_EQUAL_STRING("cdef", response.body);
+    const char *content_range = http_test_client_get_header(&response, "Content-Range");
+    TEST_ASSERT_EQUAL_STRING("bytes 2-5/26", content_range);
+    free((void*)content_range);
+    const char *accept_ranges = http_test_client_get_header(&response, "Accept-Ranges");
+    TEST_ASSERT_EQUAL_STRING("bytes", accept_ranges);
+    free((void*)accept_ranges);
+    http_test_client_free_response(&response);
+
+    // And: Suffix and open ranges are resolved against the length
+    static_get(9034, "/range", "Range: bytes=-3\r\n", &response);
+    TEST_ASSERT_EQUAL(206, response.status_code);
+    TEST_ASSERT_EQUAL_STRING("xyz", response.body);
+    http_test_client_free_response(&response);
+
+    static_get(9034, "/range", "Range: bytes=20-100\r\n", &response);
+    TEST_ASSERT_EQUAL(206, response.status_code);
+    TEST_ASSERT_EQUAL_STRING("uvwxyz", response.body);
+    http_test_client_free_response(&response);
+
+    // And: A range past the end is answered with 416
+    static_get(9034, "/range", "Range: bytes=26-\r\n", &response);
+    TEST_ASSERT_EQUAL(416, response.status_code);
+    content_range = http_test_client_get_header(&response, "Content-Range");
+    TEST_ASSERT_EQUAL_STRING("bytes */26", content_range);
+    free((void*)content_range);
+    http_test_client_free_response(&response);
+
+    // And: A malformed Range is ignored
+    static_get(9034, "/range", "Range: bytes=5-2\r\n", &response);
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    TEST_ASSERT_EQUAL_STRING(RANGE_BODY, response.body);
+    http_test_client_free_response(&response);
+
+    // Cleanup
+    httpd_stop(handle);
+}
+
+/**
+ * Test: given_range_request_when_several_ranges_are_asked_then_multipart_is_sent
+ *
+ * Purpose: Verify that several byte ranges are sent as a multipart/byteranges body whose
+ *          parts carry the content type and the Content-Range of each range.
+ * Expected: 206 with a multipart/byteranges body holding every range, in order.
+ */
+void given_range_request_when_several_ranges_are_asked_then_multipart_is_sent(void)
+{
+    // Given: A server sending a buffer with range support
+    httpd_handle_t handle = start_range_server(9035);
+    http_test_response_t response = {0};
+
+    // When: Two ranges are asked for
+    static_get(9035, "/range", "Range: bytes=0-1, 24-\r\n", &response);
+
+    // Then: Both ranges are sent, each in its own part
+    TEST_ASSERT_EQUAL(206, response.status_code);
+    const char *content_type = http_test_client_get_header(&response, "Content-Type");
+    TEST_ASSERT_NOT_NULL(content_type);
+    TEST_ASSERT_NOT_NULL(strstr(content_type, "multipart/byteranges; boundary="));
+    char delimiter[80];
+    snprintf(delimiter, sizeof(delimiter), "--%s", strstr(content_type, "boundary=") + strlen("boundary="));
+    free((void*)content_type);
+
+    TEST_ASSERT_NOT_NULL(response.body);
+    const char *first = strstr(response.body, "Content-Range: bytes 0-1/26\r\n\r\nab\r\n");
+    const char *second = strstr(response.body, "Content-Range: bytes 24-25/26\r\n\r\nyz\r\n");
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_TRUE(first < second);
+    TEST_ASSERT_NOT_NULL(strstr(response.body, "Content-Type: text/plain\r\n"));
+    strcat(delimiter, "--\r\n");
+    TEST_ASSERT_NOT_NULL(strstr(second, delimiter));
+
+    // Cleanup
+    http_test_client_free_response(&response);
+    httpd_stop(handle);
+}
+
+/**
+ * Test: given_static_file_when_range_is_asked_with_if_range_then_range_depends_on_validator
+ *
+ * Purpose: Verify that the static handler serves ranges of files, and that an If-Range
+ *          which does not match the ETag of the file gets the whole file.
+ * Expected: 206 with the range for a matching If-Range, 200 with the file otherwise.
+ */
+void given_static_file_when_range_is_asked_with_if_range_then_range_depends_on_validator(void)
+{
+    // Given: A server serving a directory, and the ETag of one of its files
+    httpd_handle_t handle = start_static_server(9036);
+    http_test_response_t response = {0};
+    static_get(9036, "/static/page.html", NULL, &response);
+    const char *etag = http_test_client_get_header(&response, "ETag");
+    TEST_ASSERT_NOT_NULL(etag);
+    http_test_client_free_response(&response);
+
+    // When: A range is asked for with the current ETag
+    char headers[256];
+    snprintf(headers, sizeof(headers), "Range: bytes=1-6\r\nIf-Range: %s\r\n", etag);
+    static_get(9036, "/static/page.html", headers, &response);
+
+    // Then: The range is sent
+    TEST_ASSERT_EQUAL(206, response.status_code);
+    TEST_ASSERT_EQUAL_STRING("html>s", response.body);
+    http_test_client_free_response(&response);
+
+    // And: With another ETag the whole file is sent
+    static_get(9036, "/static/page.html", "Range: bytes=1-6\r\nIf-Range: \"old\"\r\n", &response);
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    TEST_ASSERT_EQUAL_STRING(STATIC_PAGE_BODY, response.body);
+    http_test_client_free_response(&response);
+
+    // Cleanup
+    free((void*)etag);
+    stop_static_server(handle);
+}
+
+
+#define SLOW_RESPONSE_SIZE (1024 * 1024)
+
+static int drained_fd = -1;
+static int drained_count = 0;
+
+/* Keep the server side send buffer small, so the response outgrows it */
+static esp_err_t small_sndbuf_open(httpd_handle_t hd, int sockfd)
+{
+    int sndbuf = 16 * 1024;
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, (const char *)&sndbuf, sizeof(sndbuf));
+    return ESP_OK;
+}
+
+static void record_drain(httpd_handle_t hd, int sockfd)
+{
+    drained_fd = sockfd;
+    drained_count++;
+}
+
+static esp_err_t slow_big_handler(httpd_req_t *req)
+{
+    char *body = (char *)malloc(SLOW_RESPONSE_SIZE);
+    TEST_ASSERT_NOT_NULL(body);
+    for (size_t i = 0; i < SLOW_RESPONSE_SIZE; i++) {
+        body[i] = 'a' + (i % 26);
+    }
+    esp_err_t err = httpd_resp_send(req, body, SLOW_RESPONSE_SIZE);
+    free(body);
+    return err;
+}
+
+static httpd_handle_t start_slow_client_server(uint16_t port, uint16_t max_keep_alive_requests)
+{
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    config.open_fn = small_sndbuf_open;
+    config.drain_fn = record_drain;
+    config.tx_queue_limit = 4 * SLOW_RESPONSE_SIZE;
+    config.max_keep_alive_requests = max_keep_alive_requests;
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t big_uri = {
+        .uri      = "/slow_big",
+        .method   = HTTP_GET,
+        .handler  = slow_big_handler,
+        .user_ctx = NULL
+    };
+    httpd_uri_t quick_uri = {
+        .uri      = "/quick",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            return httpd_resp_send(req, "quick", HTTPD_RESP_USE_STRLEN);
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &big_uri));
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &quick_uri));
+    drained_fd = -1;
+    drained_count = 0;
+    return handle;
+}
+
+/* Connect with a small receive buffer and ask for the large response without reading it */
+static int slow_client_request(uint16_t port)
+{
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    TEST_ASSERT_TRUE(sockfd >= 0);
+    int rcvbuf = 4096;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, (const char *)&rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    TEST_ASSERT_EQUAL(0, connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)));
+    const char *request = "GET /slow_big HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    TEST_ASSERT_EQUAL(strlen(request), send(sockfd, request, strlen(request), 0));
+    struct timeval tv;
+    tv.tv_sec = 5;
+    tv.tv_usec = 0;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    return sockfd;
+}
+
+/* Read the large response and check its body, returns the bytes read past it */
+static int slow_client_read_response(int sockfd)
+{
+    size_t buffer_len = SLOW_RESPONSE_SIZE + 1024;
+    char *buffer = (char *)malloc(buffer_len);
+    TEST_ASSERT_NOT_NULL(buffer);
+    size_t total = 0;
+    const char *body = NULL;
+    while (total < buffer_len) {
+        int ret = recv(sockfd, buffer + total, buffer_len - total, 0);
+        if (ret <= 0) {
+            break;
+        }
+        total += ret;
+        if (!body) {
+            buffer[total < buffer_len ? total : buffer_len - 1] = '\0';
+            const char *end = strstr(buffer, "\r\n\r\n");
+            body = end ? end + 4 : NULL;
+        }
+        if (body && total >= (size_t)(body - buffer) + SLOW_RESPONSE_SIZE) {
+            break;
+        }
+    }
+    TEST_ASSERT_NOT_NULL(body);
+    TEST_ASSERT_EQUAL(0, strncmp(buffer, "HTTP/1.1 200 OK\r\n", 17));
+    size_t body_off = body - buffer;
+    TEST_ASSERT_EQUAL(body_off + SLOW_RESPONSE_SIZE, total);
+    for (size_t i = 0; i < SLOW_RESPONSE_SIZE; i++) {
+        if (body[i] != 'a' + (char)(i % 26)) {
+            TEST_FAIL_MESSAGE("response body corrupted");
+        }
+    }
+    free(buffer);
+    return (int)(total - body_off - SLOW_RESPONSE_SIZE);
+}
+
+/**
+ * Test: given_slow_client_when_large_response_is_queued_then_other_clients_are_served
+ *
+ * Purpose: Verify that a response a client does not read is queued on its session instead
+ *          of blocking the server thread, and written out in full once the client reads.
+ * Expected: Another client is answered right away, the slow client gets the whole response
+ *           and drain_fn reports its session once the queue is written.
+ */
+void given_slow_client_when_large_response_is_queued_then_other_clients_are_served(void)
+{
+    // Given: A running server, and a client asking for a large response without reading it
+    httpd_handle_t handle = start_slow_client_server(9045, 0);
+    int slow_fd = slow_client_request(9045);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // When: Another client sends a request
+    auto start = std::chrono::steady_clock::now();
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", 9045, TEST_TIMEOUT_MS));
+    http_test_response_t response = {0};
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_send_request(client, HTTP_METHOD_GET, "/quick", NULL, NULL, 0, &response, TEST_TIMEOUT_MS));
+    long elapsed_ms = (long) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    // Then: It is answered without waiting for the slow client
+    TEST_ASSERT_EQUAL(200, response.status_code);
+    TEST_ASSERT_EQUAL_STRING("quick", response.body);
+    TEST_ASSERT_TRUE(elapsed_ms < 1000);
+    TEST_ASSERT_EQUAL(0, drained_count);
+
+    // And: The slow client gets the whole response once it reads, after which the queue is drained
+    TEST_ASSERT_EQUAL(0, slow_client_read_response(slow_fd));
+    for (int i = 0; i < 100 && drained_count == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    TEST_ASSERT_EQUAL(1, drained_count);
+    size_t pending = 1;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_sess_get_tx_pending(handle, drained_fd, &pending));
+    TEST_ASSERT_EQUAL(0, pending);
+
+    // Cleanup
+    http_test_client_free_response(&response);
+    http_test_client_disconnect(client);
+    close(slow_fd);
+    httpd_stop(handle);
+}
+
+/**
+ * Test: given_connection_closed_after_response_when_output_is_queued_then_it_is_written_before_close
+ *
+ * Purpose: Verify that a connection the server closes after a response stays open until the
+ *          output queued for a slow client is written.
+ * Expected: The client reads the whole response, then the connection is closed.
+ */
+void given_connection_closed_after_response_when_output_is_queued_then_it_is_written_before_close(void)
+{
+    // Given: A running server closing connections after one request
+    httpd_handle_t handle = start_slow_client_server(9046, 1);
+
+    // When: A slow client asks for a large response and only reads it later
+    int slow_fd = slow_client_request(9046);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // Then: The whole response arrives, followed by the close
+    TEST_ASSERT_EQUAL(0, slow_client_read_response(slow_fd));
+    char c;
+    TEST_ASSERT_EQUAL(0, recv(slow_fd, &c, 1, 0));
+    TEST_ASSERT_EQUAL(0, drained_count);
+
+    // Cleanup
+    close(slow_fd);
+    httpd_stop(handle);
+}
+
 
 /**
  * Test: given_valid_uris_when_calling_httpd_uri_match_wildcard_then_correctly_matches
@@ -360,13 +1099,10 @@ void given_valid_session_context_when_setting_and_getting_then_context_preserved
     // Mock a socket file descriptor (sockfd)
     int mock_sockfd = 100; // A dummy socket FD for testing
 
-    // Get a free session slot and manually set it up
-    struct sock_db *session = httpd_sess_get_free((struct httpd_data *)handle);
+    // Take a free session slot for the mock socket
+    struct sock_db *session = httpd_sess_attach((struct httpd_data *)handle, mock_sockfd);
     TEST_ASSERT_NOT_NULL(session);
-    session->fd = mock_sockfd;
-    session->handle = handle;
     // session->free_ctx = nop;
-    ((struct httpd_data *)handle)->hd_sd_active_count++;
 
     // Create test context
     char test_session_context[] = "test_session_data";
@@ -401,6 +1137,17 @@ int test_response_handling(void) {
     
     RUN_TEST(given_server_with_chunked_handler_when_client_requests_then_receives_chunked_response);
     RUN_TEST(given_server_with_large_response_handler_when_client_requests_then_receives_large_response);
+    RUN_TEST(given_file_handler_when_client_requests_then_receives_file_range);
+    RUN_TEST(given_send_override_when_file_is_requested_then_file_goes_through_override);
+    RUN_TEST(given_static_handler_when_file_is_requested_then_file_is_sent_with_validators);
+    RUN_TEST(given_static_file_when_requested_with_matching_validators_then_304_is_sent);
+    RUN_TEST(given_static_handler_when_uri_leaves_directory_then_404_is_sent);
+    RUN_TEST(given_raised_uri_limit_when_static_file_is_requested_with_long_uri_then_file_is_sent);
+    RUN_TEST(given_range_request_when_single_range_is_asked_then_206_is_sent);
+    RUN_TEST(given_range_request_when_several_ranges_are_asked_then_multipart_is_sent);
+    RUN_TEST(given_static_file_when_range_is_asked_with_if_range_then_range_depends_on_validator);
+    RUN_TEST(given_slow_client_when_large_response_is_queued_then_other_clients_are_served);
+    RUN_TEST(given_connection_closed_after_response_when_output_is_queued_then_it_is_written_before_close);
 
     RUN_TEST(given_valid_uris_when_calling_httpd_uri_match_wildcard_then_correctly_matches);
     RUN_TEST(given_valid_global_context_when_setting_and_getting_then_context_preserved);
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h> // Required for setvbuf
+#include <thread>
 #include "esp_httpd_priv.h" // For httpd_data, sock_db, httpd_req_aux, http_parser_url
 #include "http_test_client.h" // Include for http_test_client
 
@@ -186,6 +187,11 @@ void given_valid_request_with_body_when_calling_httpd_req_recv_then_receives_dat
     TEST_ASSERT_EQUAL(strlen("Hello, world!"), bytes_received);
     TEST_ASSERT_EQUAL_STRING("Hello, world!", recv_buf);
 
+    // And: The short read went through the session receive buffer, charged to the server
+    TEST_ASSERT_NOT_NULL(mock_sd.rx_buf);
+    TEST_ASSERT_EQUAL(CONFIG_HTTPD_RX_BUF_LEN, mock_sd.rx_size);
+    TEST_ASSERT_EQUAL(mock_sd.rx_size, mock_sd.mem_used);
+
     // Test NULL request
     bytes_received = httpd_req_recv(NULL, recv_buf, sizeof(recv_buf));
     TEST_ASSERT_EQUAL(HTTPD_SOCK_ERR_INVALID, bytes_received);
@@ -196,6 +202,8 @@ void given_valid_request_with_body_when_calling_httpd_req_recv_then_receives_dat
 
     // Cleanup
     httpd_sess_set_recv_override(handle, mock_sockfd, NULL); // Clear override
+    httpd_sess_mem_release(&mock_sd, mock_sd.mem_used); // Return the receive buffer to the budget
+    free(mock_sd.rx_buf);
     httpd_stop(handle);
 }
 
@@ -251,8 +259,9 @@ void given_valid_request_when_calling_httpd_send_then_sends_data(void)
         .recv_fn = NULL,
         .pending_fn = NULL,
         .lru_counter = 0,
-        .lru_socket = false,
-        .pending_data = {0}, // Initialize array to zeros
+        .rx_buf = NULL,
+        .rx_size = 0,
+        .rx_start = 0,
         .pending_len = 0,
         .for_async_req = false,
     };
@@ -340,6 +349,7 @@ void given_server_with_custom_uri_match_fn_when_request_matches_then_handler_inv
     // Initialize http_test_client
     http_test_client_handle_t *client = http_test_client_init();
     TEST_ASSERT_NOT_NULL(client);
+    client->keep_alive = true;
     TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
 
     // Test 1 (Match): Client sends a request that should match the custom URI
@@ -435,6 +445,341 @@ void dummy(void)
 }
 
 
+/**
+ * Test: given_body_sent_with_headers_when_handler_reads_it_in_small_pieces_then_body_is_intact
+ *
+ * Purpose: Verify that body bytes received together with the request headers are kept for the
+ *          handler, and that small reads are served from what has already been received.
+ * Expected: The handler reads the whole body 5 bytes at a time and echoes it back.
+ */
+void given_body_sent_with_headers_when_handler_reads_it_in_small_pieces_then_body_is_intact(void)
+{
+    // Given: A running server with a handler echoing the body it reads in small pieces
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9026; // Use a unique port
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t echo_uri = {
+        .uri      = "/echo",
+        .method   = HTTP_POST,
+        .handler  = [](httpd_req_t *req) {
+            char body[64] = {0};
+            size_t received = 0;
+            while (received < req->content_len && received < sizeof(body) - 1) {
+                int ret = httpd_req_recv(req, body + received, 5);
+                if (ret <= 0) {
+                    return ESP_FAIL;
+                }
+                received += ret;
+            }
+            httpd_resp_send(req, body, received);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &echo_uri));
+
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(client->sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+
+    // When: Headers and body are sent with a single write
+    const char *request = "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 26\r\n\r\n"
+                          "abcdefghijklmnopqrstuvwxyz";
+    TEST_ASSERT_EQUAL(strlen(request), send(client->sockfd, request, strlen(request), 0));
+
+    // Then: The whole body is echoed back
+    char buffer[512] = {0};
+    int total = 0;
+    while (total < (int)sizeof(buffer) - 1 && strstr(buffer, "abcdefghijklmnopqrstuvwxyz") == NULL) {
+        int ret = recv(client->sockfd, buffer + total, sizeof(buffer) - 1 - total, 0);
+        if (ret <= 0) {
+            break;
+        }
+        total += ret;
+    }
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 200 OK"));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "abcdefghijklmnopqrstuvwxyz"));
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+
+/**
+ * Test: given_pipelined_requests_when_sent_in_one_write_then_all_are_answered_in_order
+ *
+ * Purpose: Verify that requests sent back to back without waiting for responses are all kept
+ *          and answered, in the order they were sent.
+ * Expected: One response per request, each carrying the query of its request, in order.
+ */
+void given_pipelined_requests_when_sent_in_one_write_then_all_are_answered_in_order(void)
+{
+    // Given: A running server with a handler echoing the query string
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9027; // Use a unique port
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t pipe_uri = {
+        .uri      = "/pipe",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            char query[16] = {0};
+            httpd_req_get_url_query_str(req, query, sizeof(query));
+            httpd_resp_send(req, query, HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &pipe_uri));
+
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(client->sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+
+    // When: Several requests, larger together than a parser block, are sent with a single write
+    char request[2048] = {0};
+    const int num_requests = 12;
+    for (int i = 0; i < num_requests; ++i) {
+        char one[160];
+        snprintf(one, sizeof(one), "GET /pipe?req%02d HTTP/1.1\r\nHost: localhost\r\nX-Padding: pipelined-request-padding\r\n\r\n", i);
+        strcat(request, one);
+    }
+    TEST_ASSERT_EQUAL(strlen(request), send(client->sockfd, request, strlen(request), 0));
+
+    // Then: Every request is answered, in order
+    char buffer[4096] = {0};
+    int total = 0;
+    char last[8];
+    snprintf(last, sizeof(last), "req%02d", num_requests - 1);
+    while (total < (int)sizeof(buffer) - 1 && strstr(buffer, last) == NULL) {
+        int ret = recv(client->sockfd, buffer + total, sizeof(buffer) - 1 - total, 0);
+        if (ret <= 0) {
+            break;
+        }
+        total += ret;
+    }
+    const char *pos = buffer;
+    for (int i = 0; i < num_requests; ++i) {
+        char expected[8];
+        snprintf(expected, sizeof(expected), "req%02d", i);
+        const char *found = strstr(pos, expected);
+        TEST_ASSERT_NOT_NULL(found);
+        pos = found + strlen(expected);
+    }
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+static int sendv_calls = 0;
+
+static int counting_sendv(httpd_handle_t hd, int sockfd, const httpd_iovec_t *iov, int iovcnt, int flags)
+{
+    sendv_calls++;
+    return httpd_default_sendv(hd, sockfd, iov, iovcnt, flags);
+}
+
+/**
+ * Test: given_response_with_custom_headers_when_sent_then_written_with_one_vectored_send
+ *
+ * Purpose: Verify that the status line, the custom headers and the body of a response are
+ *          handed to the transport in a single vectored send.
+ * Expected: The response arrives complete and the vectored send function was called once.
+ */
+void given_response_with_custom_headers_when_sent_then_written_with_one_vectored_send(void)
+{
+    // Given: A running server whose sessions count vectored sends, and a handler setting several headers
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9028; // Use a unique port
+    config.open_fn = [](httpd_handle_t hd, int sockfd) {
+        return httpd_sess_set_sendv_override(hd, sockfd, counting_sendv);
+    };
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+
+    httpd_uri_t hdrs_uri = {
+        .uri      = "/hdrs",
+        .method   = HTTP_GET,
+        .handler  = [](httpd_req_t *req) {
+            httpd_resp_set_hdr(req, "X-First", "one");
+            httpd_resp_set_hdr(req, "X-Second", "two");
+            httpd_resp_set_hdr(req, "X-Third", "three");
+            httpd_resp_send(req, "vectored-body", HTTPD_RESP_USE_STRLEN);
+            return ESP_OK;
+        },
+        .user_ctx = NULL
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_register_uri_handler(handle, &hdrs_uri));
+
+    http_test_client_handle_t *client = http_test_client_init();
+    TEST_ASSERT_NOT_NULL(client);
+    TEST_ASSERT_EQUAL(HTTP_TEST_CLIENT_OK, http_test_client_connect(client, "127.0.0.1", config.server_port, TEST_TIMEOUT_MS));
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(client->sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+
+    // When: The response is requested
+    sendv_calls = 0;
+    const char *request = "GET /hdrs HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    TEST_ASSERT_EQUAL(strlen(request), send(client->sockfd, request, strlen(request), 0));
+
+    char buffer[1024] = {0};
+    int total = 0;
+    while (total < (int)sizeof(buffer) - 1 && strstr(buffer, "vectored-body") == NULL) {
+        int ret = recv(client->sockfd, buffer + total, sizeof(buffer) - 1 - total, 0);
+        if (ret <= 0) {
+            break;
+        }
+        total += ret;
+    }
+
+    // Then: The whole response arrives and was written with one vectored send
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "HTTP/1.1 200 OK\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "X-First: one\r\nX-Second: two\r\nX-Third: three\r\n\r\nvectored-body"));
+    TEST_ASSERT_EQUAL(1, sendv_calls);
+
+    // Cleanup
+    http_test_client_disconnect(client);
+    httpd_stop(handle);
+}
+
+
+
+static int queued_work_runs = 0;
+
+static void count_queued_work(void *arg)
+{
+    __atomic_add_fetch(&queued_work_runs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Test: given_server_running_when_work_is_queued_from_several_threads_then_every_item_runs
+ * Purpose: Verify that bursts of work items queued concurrently through httpd_queue_work
+ *          are all run by the server loop, none lost or run twice.
+ * Expected: The server runs exactly as many items as were queued successfully.
+ */
+void given_server_running_when_work_is_queued_from_several_threads_then_every_item_runs(void)
+{
+    // Given: A running server
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9043; // Use a unique port
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+    queued_work_runs = 0;
+
+    // When: Several threads queue bursts of work items at once
+    const int thread_count = 4;
+    const int items_per_thread = 500;
+    int queued[thread_count] = {0};
+    std::thread producers[thread_count];
+    for (int t = 0; t < thread_count; t++) {
+        producers[t] = std::thread([&, t]() {
+            for (int i = 0; i < items_per_thread; i++) {
+                // A full queue is retried once the server had time to drain it
+                while (httpd_queue_work(handle, count_queued_work, NULL) != ESP_OK) {
+                    std::this_thread::yield();
+                }
+                queued[t]++;
+            }
+        });
+    }
+    for (int t = 0; t < thread_count; t++) {
+        producers[t].join();
+    }
+
+    // Then: Every queued item runs exactly once
+    for (int i = 0; i < 200 && __atomic_load_n(&queued_work_runs, __ATOMIC_RELAXED) < thread_count * items_per_thread; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    for (int t = 0; t < thread_count; t++) {
+        TEST_ASSERT_EQUAL(items_per_thread, queued[t]);
+    }
+    TEST_ASSERT_EQUAL(thread_count * items_per_thread, __atomic_load_n(&queued_work_runs, __ATOMIC_RELAXED));
+
+    // Cleanup
+    httpd_stop(handle);
+}
+
+
+static int blocking_work_state = 0; // 1 once running, 2 to let it return
+
+static void blocking_work(void *arg)
+{
+    __atomic_store_n(&blocking_work_state, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&blocking_work_state, __ATOMIC_SEQ_CST) != 2) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+/**
+ * Test: given_busy_server_with_small_work_queue_when_batch_overflows_then_queue_full_is_reported
+ * Purpose: Verify that a batch of works is queued up to the configured capacity, that the
+ *          overflow is reported with ESP_ERR_HTTPD_QUEUE_FULL and that the depth reflects it.
+ * Expected: Only the works fitting are queued, they all run once the server gets to them.
+ */
+void given_busy_server_with_small_work_queue_when_batch_overflows_then_queue_full_is_reported(void)
+{
+    // Given: A running server with room for 8 works, busy running a blocking work
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 9044; // Use a unique port
+    config.work_queue_len = 8;
+    httpd_handle_t handle = NULL;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_start(&handle, &config));
+    queued_work_runs = 0;
+    blocking_work_state = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_queue_work(handle, blocking_work, NULL));
+    for (int i = 0; i < 100 && __atomic_load_n(&blocking_work_state, __ATOMIC_SEQ_CST) != 1; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    TEST_ASSERT_EQUAL(1, blocking_work_state);
+
+    // When: A batch larger than the queue is submitted
+    httpd_work_t works[10];
+    for (int i = 0; i < 10; i++) {
+        works[i].fn = count_queued_work;
+        works[i].arg = NULL;
+    }
+    size_t queued = 0;
+    esp_err_t ret = httpd_queue_work_batch(handle, works, 10, &queued);
+
+    // Then: The works fitting are queued, the rest is reported as not queued
+    TEST_ASSERT_EQUAL(ESP_ERR_HTTPD_QUEUE_FULL, ret);
+    TEST_ASSERT_EQUAL(8, queued);
+    size_t depth = 0;
+    size_t capacity = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_queue_work_depth(handle, &depth, &capacity));
+    TEST_ASSERT_EQUAL(8, depth);
+    TEST_ASSERT_EQUAL(8, capacity);
+    TEST_ASSERT_EQUAL(ESP_ERR_HTTPD_QUEUE_FULL, httpd_queue_work(handle, count_queued_work, NULL));
+
+    // And: They all run once the server is free again, emptying the queue
+    __atomic_store_n(&blocking_work_state, 2, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < 100 && __atomic_load_n(&queued_work_runs, __ATOMIC_RELAXED) < 8; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    TEST_ASSERT_EQUAL(8, __atomic_load_n(&queued_work_runs, __ATOMIC_RELAXED));
+    TEST_ASSERT_EQUAL(ESP_OK, httpd_queue_work_depth(handle, &depth, NULL));
+    TEST_ASSERT_EQUAL(0, depth);
+
+    // Cleanup
+    httpd_stop(handle);
+}
+
+
 int test_utilities(void) {
     // UNITY_BEGIN();
     RUN_TEST(given_request_with_multiple_headers_when_calling_httpd_req_get_hdr_value_str_then_returns_correct_values);
@@ -443,6 +788,11 @@ int test_utilities(void) {
     RUN_TEST(given_valid_request_when_calling_httpd_send_then_sends_data);
     RUN_TEST(given_server_with_custom_uri_match_fn_when_request_matches_then_handler_invoked);
     RUN_TEST(given_server_with_uri_handler_when_client_connects_then_handler_is_invoked);
+    RUN_TEST(given_body_sent_with_headers_when_handler_reads_it_in_small_pieces_then_body_is_intact);
+    RUN_TEST(given_pipelined_requests_when_sent_in_one_write_then_all_are_answered_in_order);
+    RUN_TEST(given_response_with_custom_headers_when_sent_then_written_with_one_vectored_send);
+    RUN_TEST(given_server_running_when_work_is_queued_from_several_threads_then_every_item_runs);
+    RUN_TEST(given_busy_server_with_small_work_queue_when_batch_overflows_then_queue_full_is_reported);
     RUN_TEST(dummy);
     // return UNITY_END();
     return 0;